@@ -0,0 +1,889 @@
+/**
+ * @file backlog.c
+ * @author edsp
+ * @brief Backlog implementation on top of the dlog or mlog engines, with
+ * group commit of messages staged in RAM
+ * @version 1.0.0
+ * @date 2024-01-10
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * 
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdatomic.h>
+
+#include "backlog.h"
+#include "record.h"
+#include "../rlog.h"
+#include "../port/os/osal.h"
+
+#if RLOG_DLOG_ENABLE
+    #if RLOG_BACKLOG_ENGINE == RLOG_BACKLOG_MMAP
+        #include "mlog.h"
+    #elif RLOG_BACKLOG_ENGINE == RLOG_BACKLOG_SEGMENTS
+        #include "slog.h"
+    #else
+        #define DLOG_LINE_MAX_SIZE MSG_MAX_SIZE_CHAR
+        #include "../dlog/dlog.h"
+    #endif
+#endif
+
+#ifndef _RLOG_DBG_
+    #define _RLOG_DBG_    0
+#endif
+
+#ifndef _RLOG_PRINTF_
+    #define _RLOG_PRINTF_  0
+#endif
+
+#if _RLOG_PRINTF_
+#include <stdio.h>
+#define DBG_PRINTF(...) printf(__VA_ARGS__)
+#else
+#define DBG_PRINTF(...)
+#endif
+
+#if RLOG_DLOG_ENABLE
+#if RLOG_BACKLOG_ENGINE == RLOG_BACKLOG_MMAP
+
+/**
+ * @brief Memory-mapped backlog file
+ */
+static mlog_t logger;
+
+/**
+ * @brief Panic file, see RLOG_BACKLOG_PANIC_NLOGS. Records are written to 
+ * its mapping without any lock, so a panic flush can use it whatever the 
+ * rlog thread is doing with the backup file.
+ */
+static mlog_t panic_log;
+static bool panic_open = false;
+
+#define ENGINE_PANIC_SAFE 1
+
+/**
+ * @brief Move the records a panic flush left in the panic file to the 
+ * backup file
+ */
+static
+void engine_panic_recover(void)
+{
+    const void* rec;
+    uint64_t pos = 0;
+    uint32_t len;
+    unsigned int n = 0;
+
+    while( (len = mlog_read(&panic_log, &pos, &rec)) ) {
+        mlog_put(&logger, rec, len);
+        n++;
+    }
+
+    if( n == 0 )
+        return;
+
+    // stored in the backup file before they are removed from the panic file
+    mlog_sync(&logger);
+    mlog_consume(&panic_log, pos);
+    mlog_sync(&panic_log);
+    DBG_PRINTF("[RLOG] backlog_open recovered %u messages of a panic flush\n", n);
+}
+
+static
+bool engine_open(const char* path, unsigned int nlogs)
+{
+    char panic_path[256];
+
+    // same budget dlog would take, but short messages take less room
+    int err = mlog_open(&logger, path, (size_t) nlogs * MSG_MAX_SIZE_CHAR);
+    if( err != MLOG_OK ) {
+        DBG_PRINTF("[RLOG] backlog_open failed to open mlog. MLOG error %d\n", err);
+        return false;
+    }
+
+    // the backup file works without it, only a panic flush needs it
+    snprintf(panic_path, sizeof(panic_path), "%s.panic", path);
+    err = mlog_open(&panic_log, panic_path, (size_t) RLOG_BACKLOG_PANIC_NLOGS * MSG_MAX_SIZE_CHAR);
+    panic_open = ( err == MLOG_OK );
+    if( panic_open )
+        engine_panic_recover();
+    else
+        DBG_PRINTF("[RLOG] backlog_open failed to open the panic file. MLOG error %d\n", err);
+
+    return true;
+}
+
+static
+void engine_close(void)
+{
+    mlog_close(&logger);
+
+    if( panic_open ) {
+        mlog_close(&panic_log);
+        panic_open = false;
+    }
+}
+
+static
+bool engine_panic_put(const void* rec, int len)
+{
+    return panic_open && mlog_put(&panic_log, rec, len);
+}
+
+static
+void engine_panic_sync(void)
+{
+    if( panic_open )
+        mlog_sync(&panic_log);
+}
+
+static
+bool engine_put(const void* rec, int len, RLOG_LEVEL level)
+{
+    // a ring can only drop its oldest records
+    return mlog_put(&logger, rec, len);
+}
+
+static
+void engine_sync(void)
+{
+    mlog_sync(&logger);
+}
+
+/**
+ * @brief Replay read position and position up to which records were 
+ * acknowledged, see mlog_read()
+ */
+static uint64_t cursor = 0;
+static uint64_t acked = 0;
+
+static
+int engine_read(void* buf, int size)
+{
+    const void* rec;
+    uint32_t len = mlog_read(&logger, &cursor, &rec);
+
+    if( len > (uint32_t) size )
+        len = size;
+
+    memcpy(buf, rec, len);
+    return len;
+}
+
+static
+void engine_ack(void)
+{
+    acked = cursor;
+}
+
+static
+void engine_consume(void)
+{
+    if( acked ) 
+    {
+        // one header update for the whole chunk
+        mlog_consume(&logger, acked);
+        mlog_sync(&logger);
+    }
+
+    cursor = 0;
+    acked = 0;
+}
+
+static
+unsigned int engine_count(void)
+{
+    return mlog_count(&logger);
+}
+
+#elif RLOG_BACKLOG_ENGINE == RLOG_BACKLOG_SEGMENTS
+
+/**
+ * @brief Segmented backlog files
+ */
+static slog_t logger;
+
+/**
+ * @brief Segments are shared with the compression thread under a lock
+ */
+#define ENGINE_PANIC_SAFE 0
+
+/**
+ * @brief Replay read position and position up to which records were 
+ * acknowledged, see slog_read()
+ */
+static slog_cursor_t cursor;
+static slog_cursor_t acked;
+
+/**
+ * @brief Set when a record was acknowledged since the last consume
+ */
+static bool pending = false;
+
+/**
+ * @brief Records put and not acknowledged since the backlog was opened. Does
+ * not see the records left by a previous run or dropped to stay in budget.
+ */
+static unsigned int count = 0;
+
+static
+bool engine_open(const char* path, unsigned int nlogs)
+{
+    count = 0;
+
+    // same budget dlog would take, but segments are compressed once sealed
+    int err = slog_open(&logger, path, (uint64_t) nlogs * MSG_MAX_SIZE_CHAR, RLOG_SEGMENT_SIZE);
+    if( err != SLOG_OK ) {
+        DBG_PRINTF("[RLOG] backlog_open failed to open slog. SLOG error %d\n", err);
+        return false;
+    }
+    return true;
+}
+
+static
+void engine_close(void)
+{
+    slog_close(&logger);
+}
+
+static
+bool engine_put(const void* rec, int len, RLOG_LEVEL level)
+{
+    // errors and worse, then warnings to info, then debug
+    unsigned int cls = (level <= RLOG_ERROR) ? 0 : (level <= RLOG_INFO) ? 1 : 2;
+    if( !slog_put(&logger, cls, rec, len) )
+        return false;
+
+    count++;
+    return true;
+}
+
+static
+void engine_sync(void)
+{
+    slog_sync(&logger);
+}
+
+static
+int engine_read(void* buf, int size)
+{
+    const void* rec;
+    uint32_t len = slog_read(&logger, &cursor, &rec);
+
+    if( len > (uint32_t) size )
+        len = size;
+
+    memcpy(buf, rec, len);
+    return len;
+}
+
+static
+void engine_ack(void)
+{
+    acked = cursor;
+    pending = true;
+    if( count )
+        count--;
+}
+
+static
+void engine_consume(void)
+{
+    if( pending ) 
+        slog_consume(&logger, &acked);
+
+    // the reader is already there unless a message failed
+    cursor = acked;
+    pending = false;
+}
+
+static
+unsigned int engine_count(void)
+{
+    return count;
+}
+
+#else
+
+/**
+ * @brief If backup logging is enabled we shall use
+ * dlog to store messages when disconnected.
+ */
+static dlog_t logger;
+
+/**
+ * @brief dlog may take locks and allocate
+ */
+#define ENGINE_PANIC_SAFE 0
+
+/**
+ * @brief dlog takes null-terminated lines
+ */
+static char line[MSG_MAX_SIZE_CHAR + 1];
+
+/**
+ * @brief Entries put and not acknowledged since the backlog was opened, up to
+ * the number of entries dlog keeps. Does not see the entries left by a 
+ * previous run.
+ */
+static unsigned int count = 0;
+static unsigned int capacity = 0;
+
+static
+bool engine_open(const char* path, unsigned int nlogs)
+{
+    count = 0;
+    capacity = nlogs;
+
+    int err = dlog_open(&logger, path, nlogs);
+    if( err != DLOG_OK ) {
+        DBG_PRINTF("[RLOG] backlog_open failed to open dlog. DLOG error %d\n", err);
+        return false;
+    }
+    return true;
+}
+
+static
+void engine_close(void)
+{
+    // dlog writes every entry straight to the file, nothing to flush
+}
+
+static
+bool engine_put(const void* rec, int len, RLOG_LEVEL level)
+{
+    if( len > MSG_MAX_SIZE_CHAR )
+        len = MSG_MAX_SIZE_CHAR;
+
+    memcpy(line, rec, len);
+    line[len] = '\0';
+    dlog_put(&logger, line);
+
+    // dlog drops its oldest entry once full
+    if( count < capacity )
+        count++;
+    return true;
+}
+
+static
+void engine_sync(void)
+{
+    // dlog has no batch interface, every entry is already on the file
+}
+
+/**
+ * @brief dlog can only read its oldest entry, so it is read again until it
+ * is acknowledged and removed
+ */
+static bool reading = false;
+
+static
+int engine_read(void* buf, int size)
+{
+    if( reading || !dlog_peek(&logger, line, sizeof(line)) )
+        return 0;
+
+    int len = strlen(line);
+    if( len > size )
+        len = size;
+
+    memcpy(buf, line, len);
+    reading = true;
+    return len;
+}
+
+static
+void engine_ack(void)
+{
+    if( reading ) {
+        dlog_next(&logger);
+        reading = false;
+        if( count )
+            count--;
+    }
+}
+
+static
+void engine_consume(void)
+{
+    // every acknowledged entry was already removed
+    reading = false;
+}
+
+static
+unsigned int engine_count(void)
+{
+    return count;
+}
+
+#endif
+
+#if RLOG_BACKLOG_ENGINE != RLOG_BACKLOG_DLOG
+
+static
+int log_encode(const log_t* log, uint8_t* rec, int size)
+{
+    return log_record_encode(log, rec, size);
+}
+
+static
+bool log_decode(const uint8_t* rec, int len, log_t* log)
+{
+    return log_record_decode(rec, len, log);
+}
+
+#else
+
+/**
+ * @brief dlog stores text lines, so records are "<pri> <timestamp> <proc> <msg>"
+ * with "-" standing for an empty proc.
+ */
+static
+int log_encode(const log_t* log, uint8_t* rec, int size)
+{
+    char proc[sizeof(log->proc)];
+
+    // proc can't have spaces, format would replace them anyway
+    snprintf(proc, sizeof(proc), "%s", log->proc[0] ? log->proc : "-");
+    for( char* p = proc; *p; p++ ) {
+        if( *p == ' ' ) *p = '_';
+    }
+
+    int n = snprintf((char*) rec, size, "%u %lld %s %s", log->pri, (long long) log->timestamp, proc, log->msg);
+
+    if( n < 0 || n >= size )
+        return 0;
+
+    return n;
+}
+
+static
+bool log_decode(const uint8_t* rec, int len, log_t* log)
+{
+    char* str = (char*) rec;
+    char* end;
+
+    str[len] = '\0';
+
+    log->pri = strtoul(str, &end, 10);
+    if( *end != ' ' )
+        return false;
+
+    log->timestamp = (time_t) strtoll(end + 1, &end, 10);
+    if( *end != ' ' )
+        return false;
+
+    str = end + 1;
+    end = strchr(str, ' ');
+    if( end == NULL )
+        return false;
+
+    *end = '\0';
+    if( strcmp(str, "-") == 0 )
+        log->proc[0] = '\0';
+    else
+        snprintf(log->proc, sizeof(log->proc), "%s", str);
+
+    snprintf(log->msg, sizeof(log->msg), "%s", end + 1);
+    return true;
+}
+
+#endif
+
+/**
+ * @brief Group commit staging buffer. Holds records back to back, each one 
+ * preceded by its length in 2 bytes and its level in 1 byte.
+ */
+#define STAGE_HDR_SIZE 3
+
+static uint8_t stage[RLOG_BACKLOG_STAGE_SIZE];
+static unsigned int stage_len = 0;
+static unsigned int stage_cnt = 0;
+
+/**
+ * @brief Time the oldest staged record was staged
+ */
+static uint64_t stage_time = 0;
+
+static backlog_commit_t policy;
+
+/**
+ * @brief Scratch buffer for encoding and decoding records
+ */
+static uint8_t record[MSG_MAX_SIZE_CHAR + 1];
+
+/**
+ * @brief Set once a panic flush started. The rlog thread stays out of the 
+ * engine from then on.
+ */
+static atomic_bool engine_panic;
+
+/**
+ * @brief Messages in the engine and the staging buffer, updated every time 
+ * the rlog thread leaves the engine so other threads can read it
+ */
+static atomic_uint depth;
+
+/**
+ * @brief Enter the engine from the rlog thread
+ * 
+ * @return false If a panic flush started
+ */
+static
+bool engine_enter(void)
+{
+    return !atomic_load(&engine_panic);
+}
+
+static
+void engine_leave(void)
+{
+    atomic_store_explicit(&depth, engine_count() + stage_cnt, memory_order_relaxed);
+}
+
+bool backlog_open(const char* path, unsigned int nlogs, backlog_commit_t commit)
+{
+    policy = commit;
+    stage_len = 0;
+    stage_cnt = 0;
+    atomic_store(&engine_panic, false);
+    if( !engine_open(path, nlogs) )
+        return false;
+
+    atomic_store_explicit(&depth, engine_count(), memory_order_relaxed);
+    return true;
+}
+
+/**
+ * @brief Hand the staged records to the engine. Must be called from inside
+ * the engine, see engine_enter()
+ */
+static
+void stage_commit(void)
+{
+    unsigned int i = 0;
+
+    if( stage_cnt == 0 )
+        return;
+
+    while( i < stage_len )
+    {
+        int len = stage[i] | (stage[i + 1] << 8);
+        engine_put(&stage[i + STAGE_HDR_SIZE], len, stage[i + 2]);
+        i += len + STAGE_HDR_SIZE;
+    }
+
+    engine_sync();
+    stage_len = 0;
+    stage_cnt = 0;
+}
+
+void backlog_close(void)
+{
+    if( !engine_enter() )
+        return;
+
+    stage_commit();
+    engine_close();
+
+    // the engine can't be counted once closed
+    atomic_store_explicit(&depth, 0, memory_order_relaxed);
+}
+
+void backlog_commit(void)
+{
+    if( !engine_enter() )
+        return;
+
+    stage_commit();
+    engine_leave();
+}
+
+/**
+ * @brief Stage a record or hand it to the engine according to the group commit policy
+ */
+static
+bool backlog_put_record(const void* rec, int len, RLOG_LEVEL level)
+{
+    if( policy.nlogs == 0 )
+        return engine_put(rec, len, level);
+
+    // does not fit at all, keep the order and write it through
+    if( len + STAGE_HDR_SIZE > sizeof(stage) ) 
+    {
+        stage_commit();
+        bool ok = engine_put(rec, len, level);
+        engine_sync();
+        return ok;
+    }
+
+    if( stage_len + len + STAGE_HDR_SIZE > sizeof(stage) )
+        stage_commit();
+
+    if( stage_cnt == 0 )
+        stage_time = os_get_time_us();
+
+    stage[stage_len] = (uint8_t) len;
+    stage[stage_len + 1] = (uint8_t)(len >> 8);
+    stage[stage_len + 2] = (uint8_t) level;
+    memcpy(&stage[stage_len + STAGE_HDR_SIZE], rec, len);
+    stage_len += len + STAGE_HDR_SIZE;
+    stage_cnt++;
+
+    if( stage_cnt >= policy.nlogs || level <= policy.level )
+        stage_commit();
+
+    return true;
+}
+
+bool backlog_put(const char* msg, RLOG_LEVEL level)
+{
+    if( !engine_enter() )
+        return false;
+
+    bool ok = backlog_put_record(msg, strlen(msg), level);
+    engine_leave();
+    return ok;
+}
+
+bool backlog_put_log(const log_t* log)
+{
+    if( !engine_enter() )
+        return false;
+
+    bool ok = false;
+    int len = log_encode(log, record, sizeof(record));
+    if( len > 0 )
+        ok = backlog_put_record(record, len, log->pri & 0x07);
+
+    engine_leave();
+    return ok;
+}
+
+uint32_t backlog_sync(void)
+{
+    if( stage_cnt == 0 || policy.ms == 0 )
+        return OS_WAIT_FOREVER;
+
+    uint64_t elapsed = (os_get_time_us() - stage_time) / 1000;
+    if( elapsed >= policy.ms ) {
+        backlog_commit();
+        return OS_WAIT_FOREVER;
+    }
+
+    return policy.ms - elapsed;
+}
+
+int backlog_read(char* buf, int size)
+{
+    if( size < 1 || !engine_enter() )
+        return 0;
+
+    stage_commit();
+    int len = engine_read(buf, size - 1);
+    buf[len] = '\0';
+    engine_leave();
+    return len;
+}
+
+bool backlog_read_log(log_t* log)
+{
+    bool ok = false;
+
+    if( !engine_enter() )
+        return false;
+
+    stage_commit();
+
+    while( 1 )
+    {
+        int len = engine_read(record, sizeof(record) - 1);
+        if( len == 0 )
+            break;
+
+        if( log_decode(record, len, log) ) {
+            ok = true;
+            break;
+        }
+
+        // not a valid record, skip it
+        DBG_PRINTF("[RLOG] backlog_read_log dropped an invalid record\n");
+        engine_ack();
+    }
+
+    engine_leave();
+    return ok;
+}
+
+void backlog_ack(void)
+{
+    if( !engine_enter() )
+        return;
+
+    engine_ack();
+    engine_leave();
+}
+
+void backlog_consume(void)
+{
+    if( !engine_enter() )
+        return;
+
+    engine_consume();
+    engine_leave();
+}
+
+unsigned int backlog_count(void)
+{
+    return atomic_load_explicit(&depth, memory_order_relaxed);
+}
+
+bool backlog_panic_begin(void)
+{
+#if ENGINE_PANIC_SAFE
+    unsigned int i = 0;
+    unsigned int end = stage_len;
+
+    if( atomic_exchange(&engine_panic, true) || !panic_open )
+        return false;
+
+    // staged records go first to keep the order. The rlog thread may be 
+    // changing them, so the lengths are not trusted
+    if( end > sizeof(stage) )
+        end = sizeof(stage);
+
+    while( i + STAGE_HDR_SIZE <= end )
+    {
+        unsigned int len = stage[i] | (stage[i + 1] << 8);
+        if( len == 0 || i + STAGE_HDR_SIZE + len > end )
+            break;
+
+        engine_panic_put(&stage[i + STAGE_HDR_SIZE], len);
+        i += len + STAGE_HDR_SIZE;
+    }
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+#if ENGINE_PANIC_SAFE
+
+bool backlog_panic_put(const log_t* log, const char* msg, int len)
+{
+#if RLOG_BACKLOG_BINARY
+    // the replay can't tell a rendered message from a record
+    if( log == NULL )
+        return false;
+
+    len = log_encode(log, record, sizeof(record));
+    if( len == 0 )
+        return false;
+
+    return engine_panic_put(record, len);
+#else
+    return engine_panic_put(msg, len);
+#endif
+}
+
+void backlog_panic_end(void)
+{
+    engine_panic_sync();
+}
+
+#else
+
+bool backlog_panic_put(const log_t* log, const char* msg, int len)
+{
+    return false;
+}
+
+void backlog_panic_end(void)
+{
+}
+
+#endif
+
+#else 
+
+bool backlog_open(const char* path, unsigned int nlogs, backlog_commit_t commit)
+{
+    return true;
+}
+
+void backlog_close(void)
+{
+}
+
+bool backlog_put(const char* msg, RLOG_LEVEL level)
+{
+    return false;
+}
+
+bool backlog_put_log(const log_t* log)
+{
+    return false;
+}
+
+uint32_t backlog_sync(void)
+{
+    return OS_WAIT_FOREVER;
+}
+
+void backlog_commit(void)
+{
+}
+
+int backlog_read(char* buf, int size)
+{
+    return 0;
+}
+
+bool backlog_read_log(log_t* log)
+{
+    return false;
+}
+
+void backlog_ack(void)
+{
+}
+
+void backlog_consume(void)
+{
+}
+
+unsigned int backlog_count(void)
+{
+    return 0;
+}
+
+bool backlog_panic_begin(void)
+{
+    return false;
+}
+
+bool backlog_panic_put(const log_t* log, const char* msg, int len)
+{
+    return false;
+}
+
+void backlog_panic_end(void)
+{
+}
+
+#endif
\ No newline at end of file
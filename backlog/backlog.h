@@ -0,0 +1,191 @@
+/**
+ * @file backlog.h
+ * @author edsp
+ * @brief Backlog of messages that could not be sent. Hides which engine 
+ * stores the messages, see RLOG_BACKLOG_ENGINE.
+ * @version 1.0.0
+ * @date 2024-01-10
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * 
+ */
+
+#ifndef _RLOG_BACKLOG_H_
+#define _RLOG_BACKLOG_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "../format/format.h"
+
+/**
+ * @brief Size in bytes of the RAM staging buffer used for group commit
+ */
+#ifndef RLOG_BACKLOG_STAGE_SIZE
+    #define RLOG_BACKLOG_STAGE_SIZE 4096
+#endif
+
+/**
+ * @brief Size of the panic file in number of message entries. The panic file
+ * sits next to the backup file, with the name of the backup file followed by
+ * ".panic", and only rlog_panic_flush() writes to it. Should hold at least
+ * the messages the queue and the dispatch lanes can hold. Only used by the 
+ * RLOG_BACKLOG_MMAP engine.
+ */
+#ifndef RLOG_BACKLOG_PANIC_NLOGS
+    #define RLOG_BACKLOG_PANIC_NLOGS 256
+#endif
+
+/**
+ * @brief Group commit policy. Messages are staged in RAM and written to the
+ * backup file together once one of the conditions is met. 
+ */
+typedef struct backlog_commit_t
+{
+    /**
+     * @brief Commit once this many messages are staged. If 0, group commit
+     * is disabled and every message is handed to the engine right away.
+     */
+    unsigned int nlogs;
+
+    /**
+     * @brief Commit once the oldest staged message is this old, in 
+     * miliseconds. If 0, there is no time limit.
+     */
+    unsigned int ms;
+
+    /**
+     * @brief Commit right away when a message with this level or more 
+     * severe is staged.
+     */
+    RLOG_LEVEL level;
+
+}backlog_commit_t;
+
+/**
+ * @brief Open the backlog. If RLOG_DLOG_ENABLE is 0 this does nothing.
+ * 
+ * @param path Fullpath for backup file, including filename
+ * @param nlogs Size of backup file in number of message entries
+ * @param commit Group commit policy
+ * @return true If successful
+ */
+bool backlog_open(const char* path, unsigned int nlogs, backlog_commit_t commit);
+
+/**
+ * @brief Commit staged messages and close the backlog
+ */
+void backlog_close(void);
+
+/**
+ * @brief Append a rendered message, dropping the oldest one if full.
+ * The message may be staged in RAM until the next commit.
+ * 
+ * @param msg Null-terminated message
+ * @param level Message level
+ * @return true If the message was stored or staged
+ */
+bool backlog_put(const char* msg, RLOG_LEVEL level);
+
+/**
+ * @brief Append a message in its compact, not rendered, form. 
+ * See RLOG_BACKLOG_BINARY.
+ * 
+ * @param log Message
+ * @return true If the message was stored or staged
+ */
+bool backlog_put_log(const log_t* log);
+
+/**
+ * @brief Commit staged messages if the time limit of the policy has expired.
+ * 
+ * @return Time in miliseconds until the next commit is due or OS_WAIT_FOREVER
+ * if nothing is staged.
+ */
+uint32_t backlog_sync(void);
+
+/**
+ * @brief Write all staged messages to the backup file and make them durable.
+ */
+void backlog_commit(void);
+
+/**
+ * @brief Copy the next message to replay without removing it. Messages are 
+ * read in order starting from the oldest one until backlog_consume() is 
+ * called. Staged messages are committed first.
+ * 
+ * @param buf Buffer to hold the null-terminated message
+ * @param size Size of the buffer
+ * @return Length of the message or 0 if there are no more messages to read 
+ * in this chunk
+ */
+int backlog_read(char* buf, int size);
+
+/**
+ * @brief Same as backlog_read() for messages stored with backlog_put_log().
+ * Invalid records are dropped.
+ * 
+ * @param log Pointer to hold the message
+ * @return true If there was a message
+ */
+bool backlog_read_log(log_t* log);
+
+/**
+ * @brief Mark every message read so far as delivered
+ */
+void backlog_ack(void);
+
+/**
+ * @brief Remove the delivered messages, make the progress durable and start
+ * reading again from the oldest message left. Messages read but not 
+ * acknowledged will be read again.
+ */
+void backlog_consume(void);
+
+/**
+ * @brief Number of messages waiting to be replayed, staged ones included. Can
+ * be called from any thread. Only the mmap engine sees the messages left by 
+ * a previous run.
+ */
+unsigned int backlog_count(void);
+
+/**
+ * @brief Start a panic flush. Safe to call from a signal handler, it never 
+ * waits for the rlog thread: messages go to the panic file, which the rlog 
+ * thread does not use, and are moved to the backup file by the next 
+ * backlog_open(). Staged records are copied to it first, as they are, 
+ * without a lock. From then on the rlog thread can no longer use the backlog.
+ * 
+ * @return false If the engine has no panic file
+ */
+bool backlog_panic_begin(void);
+
+/**
+ * @brief Write a message to the panic file. Only valid after 
+ * backlog_panic_begin() succeeded.
+ * 
+ * @param log Message, NULL if only the rendered message is left, i.e. on a
+ * dispatch lane. Such messages are dropped if RLOG_BACKLOG_BINARY is set.
+ * @param msg Rendered message, used unless RLOG_BACKLOG_BINARY is set
+ * @param len Length of the rendered message
+ */
+bool backlog_panic_put(const log_t* log, const char* msg, int len);
+
+/**
+ * @brief Make the messages written during a panic flush durable
+ */
+void backlog_panic_end(void);
+
+#endif //_RLOG_BACKLOG_H_
\ No newline at end of file
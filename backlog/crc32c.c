@@ -0,0 +1,109 @@
+/**
+ * @file crc32c.c
+ * @author edsp
+ * @brief CRC-32C (Castagnoli) implementation
+ * @version 1.0.0
+ * @date 2024-01-10
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * 
+ */
+
+#include <string.h>
+
+#include "crc32c.h"
+
+#if defined(__SSE4_2__)
+
+#include <nmmintrin.h>
+
+uint32_t crc32c(uint32_t crc, const void* buf, size_t len)
+{
+    const uint8_t* p = (const uint8_t*) buf;
+
+    crc = ~crc;
+
+#if defined(__x86_64__)
+    while( len >= 8 ) 
+    {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        crc = (uint32_t) _mm_crc32_u64(crc, v);
+        p += 8;
+        len -= 8;
+    }
+#endif
+
+    while( len-- )
+        crc = _mm_crc32_u8(crc, *p++);
+
+    return ~crc;
+}
+
+#elif defined(__ARM_FEATURE_CRC32)
+
+#include <arm_acle.h>
+
+uint32_t crc32c(uint32_t crc, const void* buf, size_t len)
+{
+    const uint8_t* p = (const uint8_t*) buf;
+
+    crc = ~crc;
+
+    while( len >= 8 ) 
+    {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        crc = __crc32cd(crc, v);
+        p += 8;
+        len -= 8;
+    }
+
+    while( len-- )
+        crc = __crc32cb(crc, *p++);
+
+    return ~crc;
+}
+
+#else
+
+/**
+ * @brief Reflected polynomial 0x82F63B78, one entry per nibble to keep the
+ * table small on microcontrollers
+ */
+static const uint32_t table[16] = {
+    0x00000000, 0x105EC76F, 0x20BD8EDE, 0x30E349B1,
+    0x417B1DBC, 0x5125DAD3, 0x61C69362, 0x7198540D,
+    0x82F63B78, 0x92A8FC17, 0xA24BB5A6, 0xB21572C9,
+    0xC38D26C4, 0xD3D3E1AB, 0xE330A81A, 0xF36E6F75,
+};
+
+uint32_t crc32c(uint32_t crc, const void* buf, size_t len)
+{
+    const uint8_t* p = (const uint8_t*) buf;
+
+    crc = ~crc;
+
+    while( len-- ) 
+    {
+        crc ^= *p++;
+        crc = (crc >> 4) ^ table[crc & 0x0F];
+        crc = (crc >> 4) ^ table[crc & 0x0F];
+    }
+
+    return ~crc;
+}
+
+#endif
\ No newline at end of file
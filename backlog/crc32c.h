@@ -0,0 +1,41 @@
+/**
+ * @file crc32c.h
+ * @author edsp
+ * @brief CRC-32C (Castagnoli), using the CPU instructions where available
+ * @version 1.0.0
+ * @date 2024-01-10
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * 
+ */
+
+#ifndef _CRC32C_H_
+#define _CRC32C_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Compute or update a CRC-32C. Uses SSE4.2 or the ARMv8 CRC 
+ * instructions when the compiler targets them, a table otherwise.
+ * 
+ * @param crc 0 to start a new CRC or the result of a previous call to continue it
+ * @param buf Data
+ * @param len Data length in bytes
+ * @return Updated CRC
+ */
+uint32_t crc32c(uint32_t crc, const void* buf, size_t len);
+
+#endif //_CRC32C_H_
\ No newline at end of file
@@ -0,0 +1,194 @@
+/**
+ * @file lz.c
+ * @author edsp
+ * @brief Small LZ77 block compressor implementation
+ * @version 1.0.0
+ * @date 2024-01-10
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * 
+ */
+
+#include <string.h>
+#include <stdbool.h>
+
+#include "lz.h"
+
+static inline
+uint32_t lz_read32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/**
+ * @brief Write a length that did not fit in its token nibble
+ */
+static
+uint8_t* lz_put_len(uint8_t* op, int n)
+{
+    while( n >= 255 ) {
+        *op++ = 255;
+        n -= 255;
+    }
+    *op++ = (uint8_t) n;
+    return op;
+}
+
+/**
+ * @brief Write a sequence, match is 0 for the last one
+ * 
+ * @return Pointer past the sequence or NULL if it does not fit
+ */
+static
+uint8_t* lz_put_seq(uint8_t* op, uint8_t* oend, const uint8_t* lit, int nlit, int offset, int match)
+{
+    // worst case for the length bytes
+    if( oend - op < 1 + nlit / 255 + 1 + nlit + 2 + match / 255 + 1 )
+        return NULL;
+
+    uint8_t* token = op++;
+    int mlen = match ? match - LZ_MIN_MATCH : 0;
+
+    *token = (uint8_t)(((nlit < 15 ? nlit : 15) << 4) | (mlen < 15 ? mlen : 15));
+    if( nlit >= 15 )
+        op = lz_put_len(op, nlit - 15);
+
+    memcpy(op, lit, nlit);
+    op += nlit;
+
+    if( match ) 
+    {
+        *op++ = (uint8_t) offset;
+        *op++ = (uint8_t)(offset >> 8);
+        if( mlen >= 15 )
+            op = lz_put_len(op, mlen - 15);
+    }
+
+    return op;
+}
+
+int lz_compress(const uint8_t* src, int len, uint8_t* dst, int cap, uint16_t* table)
+{
+    const uint8_t* ip = src;
+    const uint8_t* anchor = src;
+    const uint8_t* end = src + len;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + cap;
+
+    // positions are stored plus one, 0 is an empty slot
+    memset(table, 0, LZ_HASH_SIZE * sizeof(uint16_t));
+
+    while( end - ip >= LZ_MIN_MATCH )
+    {
+        uint32_t seq = lz_read32(ip);
+        uint32_t h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+        const uint8_t* ref = table[h] ? src + table[h] - 1 : NULL;
+
+        table[h] = (uint16_t)(ip - src + 1);
+
+        if( ref == NULL || ip - ref > LZ_MAX_OFFSET || lz_read32(ref) != seq ) {
+            ip++;
+            continue;
+        }
+
+        int match = LZ_MIN_MATCH;
+        while( ip + match < end && ref[match] == ip[match] )
+            match++;
+
+        op = lz_put_seq(op, oend, anchor, ip - anchor, ip - ref, match);
+        if( op == NULL )
+            return 0;
+
+        ip += match;
+        anchor = ip;
+    }
+
+    op = lz_put_seq(op, oend, anchor, end - anchor, 0, 0);
+    if( op == NULL )
+        return 0;
+
+    return op - dst;
+}
+
+/**
+ * @brief Read a length that did not fit in its token nibble
+ * 
+ * @return false If the block ends before the length does
+ */
+static
+bool lz_get_len(const uint8_t** ip, const uint8_t* iend, int* n)
+{
+    uint8_t b;
+
+    do {
+        if( *ip >= iend )
+            return false;
+        b = *(*ip)++;
+        *n += b;
+    } while( b == 255 );
+
+    return true;
+}
+
+int lz_decompress(const uint8_t* src, int len, uint8_t* dst, int cap)
+{
+    const uint8_t* ip = src;
+    const uint8_t* iend = src + len;
+    uint8_t* op = dst;
+    uint8_t* oend = dst + cap;
+
+    while( ip < iend )
+    {
+        uint8_t token = *ip++;
+        int nlit = token >> 4;
+        int match = token & 0x0F;
+
+        if( nlit == 15 && !lz_get_len(&ip, iend, &nlit) )
+            return -1;
+
+        if( nlit > iend - ip || nlit > oend - op )
+            return -1;
+
+        memcpy(op, ip, nlit);
+        op += nlit;
+        ip += nlit;
+
+        // the last sequence has no match
+        if( ip == iend )
+            break;
+
+        if( iend - ip < 2 )
+            return -1;
+
+        int offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+
+        if( match == 15 && !lz_get_len(&ip, iend, &match) )
+            return -1;
+
+        match += LZ_MIN_MATCH;
+        if( offset == 0 || offset > op - dst || match > oend - op )
+            return -1;
+
+        // may overlap, copy byte by byte
+        const uint8_t* ref = op - offset;
+        while( match-- )
+            *op++ = *ref++;
+    }
+
+    return op - dst;
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+/**
+ * @file lz.h
+ * @author edsp
+ * @brief Small LZ77 block compressor used for sealed backlog segments
+ * @version 1.0.0
+ * @date 2024-01-10
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * A block is a sequence of a token byte, literals, a 2 byte offset and the
+ * match length. The high nibble of the token is the number of literals and
+ * the low nibble the match length minus LZ_MIN_MATCH, 15 meaning more 
+ * length bytes follow, each adding up to 255. The last sequence only has 
+ * literals. Log lines repeat hostnames, process names and message 
+ * templates, so this greedy single pass is enough and it needs no memory 
+ * besides the hash table.
+ */
+
+#ifndef _LZ_H_
+#define _LZ_H_
+
+#include <stdint.h>
+
+#define LZ_MIN_MATCH    4
+#define LZ_MAX_OFFSET   0xFFFF
+#define LZ_HASH_BITS    12
+
+/**
+ * @brief Number of entries of the hash table given to lz_compress()
+ */
+#define LZ_HASH_SIZE    (1 << LZ_HASH_BITS)
+
+/**
+ * @brief Compress a block
+ * 
+ * @param src Data, at most 64 KiB
+ * @param len Data length in bytes
+ * @param dst Buffer to hold the compressed block
+ * @param cap Size of the buffer
+ * @param table Hash table scratch of LZ_HASH_SIZE entries
+ * @return Compressed length or 0 if it does not fit in the buffer
+ */
+int lz_compress(const uint8_t* src, int len, uint8_t* dst, int cap, uint16_t* table);
+
+/**
+ * @brief Decompress a block
+ * 
+ * @param src Compressed block
+ * @param len Compressed length in bytes
+ * @param dst Buffer to hold the data
+ * @param cap Size of the buffer
+ * @return Data length or -1 if the block is malformed or does not fit
+ */
+int lz_decompress(const uint8_t* src, int len, uint8_t* dst, int cap);
+
+#endif //_LZ_H_
\ No newline at end of file
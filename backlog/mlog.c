@@ -0,0 +1,489 @@
+/**
+ * @file mlog.c
+ * @author edsp
+ * @brief Memory-mapped circular backlog file implementation. Requires a 
+ * POSIX mmap().
+ * @version 1.0.0
+ * @date 2024-01-10
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * 
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mlog.h"
+#include "crc32c.h"
+
+/**
+ * @brief CRC of a checkpoint, all fields but the CRC itself
+ */
+static
+uint32_t mlog_hdr_crc(const mlog_hdr_t* hdr)
+{
+    return crc32c(0, hdr, offsetof(mlog_hdr_t, crc));
+}
+
+/**
+ * @brief Check if a checkpoint describes a usable file of the given size
+ */
+static
+bool mlog_hdr_valid(const mlog_hdr_t* hdr, uint64_t size)
+{
+    if( hdr->magic != MLOG_MAGIC || hdr->version != MLOG_VERSION || hdr->size != size )
+        return false;
+
+    if( hdr->head > hdr->tail || hdr->tail - hdr->head > size )
+        return false;
+
+    return hdr->crc == mlog_hdr_crc(hdr);
+}
+
+/**
+ * @brief CRC of a record. The position is included so a stale record left 
+ * from a previous lap around the file is not taken for a new one.
+ */
+static
+uint32_t mlog_rec_crc(uint64_t pos, uint32_t len, const void* data)
+{
+    uint32_t crc = crc32c(0, &pos, sizeof(pos));
+
+    crc = crc32c(crc, &len, sizeof(len));
+    if( data )
+        crc = crc32c(crc, data, len);
+
+    return crc;
+}
+
+/**
+ * @brief Check the record at a given position
+ * 
+ * @param[out] len Record length in bytes, 0 for a padding record
+ * @return Size in bytes taken by the record or 0 if it is not valid
+ */
+static
+uint64_t mlog_rec_check(mlog_t* log, uint64_t pos, uint32_t* len)
+{
+    uint64_t off = pos % log->hdr->size;
+    const mlog_rec_t* r = (const mlog_rec_t*) &log->data[off];
+
+    if( r->len == MLOG_PAD ) 
+    {
+        if( r->crc != mlog_rec_crc(pos, MLOG_PAD, NULL) )
+            return 0;
+
+        *len = 0;
+        return log->hdr->size - off;
+    }
+
+    if( r->len == 0 || MLOG_ALIGN(sizeof(mlog_rec_t) + r->len) > log->hdr->size - off )
+        return 0;
+
+    if( r->crc != mlog_rec_crc(pos, r->len, r + 1) )
+        return 0;
+
+    *len = r->len;
+    return MLOG_ALIGN(sizeof(mlog_rec_t) + r->len);
+}
+
+/**
+ * @brief Find the first valid record after a corrupted one. Its length can't
+ * be trusted, so every aligned position is checked up to the tail.
+ */
+static
+uint64_t mlog_skip(mlog_t* log, uint64_t pos)
+{
+    uint32_t len;
+
+    pos += MLOG_ALIGN(1);
+    while( pos < log->hdr->tail && mlog_rec_check(log, pos, &len) == 0 )
+        pos += MLOG_ALIGN(1);
+
+    if( pos > log->hdr->tail )
+        pos = log->hdr->tail;
+
+    return pos;
+}
+
+/**
+ * @brief Move the head past the oldest record or past a corrupted area
+ */
+static
+void mlog_drop_head(mlog_t* log)
+{
+    mlog_hdr_t* hdr = log->hdr;
+    uint32_t len;
+    uint64_t size = mlog_rec_check(log, hdr->head, &len);
+
+    if( size ) {
+        hdr->head += size;
+    } else {
+        hdr->head = mlog_skip(log, hdr->head);
+        log->corrupt++;
+        len = 1;
+    }
+
+    // padding records are not counted
+    if( len && hdr->count )
+        hdr->count--;
+
+    if( hdr->head == hdr->tail )
+        hdr->count = 0;
+}
+
+/**
+ * @brief Pick up the records appended after the checkpoint, as long as they
+ * are intact and did not overwrite older records
+ */
+static
+void mlog_recover(mlog_t* log)
+{
+    mlog_hdr_t* hdr = log->hdr;
+    uint32_t len;
+    uint64_t size;
+
+    while( (size = mlog_rec_check(log, hdr->tail, &len)) && hdr->tail + size - hdr->head <= hdr->size )
+    {
+        hdr->tail += size;
+        if( len )
+            hdr->count++;
+        log->recovered++;
+    }
+}
+
+/**
+ * @brief Write the header to the next checkpoint slot
+ */
+static
+void mlog_checkpoint(mlog_t* log)
+{
+    mlog_hdr_t* slot = (mlog_hdr_t*)((uint8_t*) log->map + MLOG_SLOT_OFFSET(log->slot));
+
+    log->state.seq++;
+    log->state.crc = mlog_hdr_crc(&log->state);
+    memcpy(slot, &log->state, sizeof(mlog_hdr_t));
+    log->slot ^= 1;
+    log->limit = log->state.head + log->state.size;
+}
+
+/**
+ * @brief Start from the newest valid checkpoint of a mapped file and pick up
+ * the records appended after it
+ * 
+ * @return false If there is no valid checkpoint
+ */
+static
+bool mlog_load(mlog_t* log, uint64_t size)
+{
+    const mlog_hdr_t* cp[2];
+    int newest = -1;
+
+    log->hdr = &log->state;
+    log->data = (uint8_t*) log->map + MLOG_DATA_OFFSET;
+
+    for( int i = 0; i < 2; i++ ) 
+    {
+        cp[i] = (const mlog_hdr_t*)((const uint8_t*) log->map + MLOG_SLOT_OFFSET(i));
+        if( mlog_hdr_valid(cp[i], size) && (newest < 0 || cp[i]->seq > cp[newest]->seq) )
+            newest = i;
+    }
+
+    if( newest < 0 )
+        return false;
+
+    memcpy(&log->state, cp[newest], sizeof(mlog_hdr_t));
+    log->slot = newest ^ 1;
+    mlog_recover(log);
+    return true;
+}
+
+int mlog_open(mlog_t* log, const char* path, size_t size)
+{
+    struct stat st;
+
+    if( log == NULL || path == NULL )
+        return MLOG_ERR_PARAM;
+
+    size = MLOG_ALIGN(size);
+    if( size < 2 * MLOG_ALIGN(sizeof(mlog_rec_t) + 1) )
+        return MLOG_ERR_PARAM;
+
+    memset(log, 0, sizeof(mlog_t));
+    log->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if( log->fd < 0 )
+        return MLOG_ERR_FILE;
+
+    log->map_size = MLOG_DATA_OFFSET + size;
+    if( fstat(log->fd, &st) < 0 || ((size_t) st.st_size != log->map_size && ftruncate(log->fd, log->map_size) < 0) ) 
+    {
+        close(log->fd);
+        log->fd = -1;
+        return MLOG_ERR_FILE;
+    }
+
+    log->map = mmap(NULL, log->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, log->fd, 0);
+    if( log->map == MAP_FAILED ) 
+    {
+        log->map = NULL;
+        close(log->fd);
+        log->fd = -1;
+        return MLOG_ERR_MAP;
+    }
+
+    if( !mlog_load(log, size) )
+    {
+        // new file, different size or garbage, start over
+        log->state.magic = MLOG_MAGIC;
+        log->state.version = MLOG_VERSION;
+        log->state.size = size;
+    }
+
+    log->synced = log->hdr->tail;
+    log->limit = log->hdr->head + log->hdr->size;
+    return MLOG_OK;
+}
+
+int mlog_open_readonly(mlog_t* log, const char* path)
+{
+    struct stat st;
+
+    if( log == NULL || path == NULL )
+        return MLOG_ERR_PARAM;
+
+    memset(log, 0, sizeof(mlog_t));
+    log->fd = open(path, O_RDONLY);
+    if( log->fd < 0 )
+        return MLOG_ERR_FILE;
+
+    if( fstat(log->fd, &st) < 0 || st.st_size <= MLOG_DATA_OFFSET ) 
+    {
+        close(log->fd);
+        log->fd = -1;
+        return MLOG_ERR_FILE;
+    }
+
+    // a private mapping, so nothing done to it ever reaches the file
+    log->map_size = st.st_size;
+    log->map = mmap(NULL, log->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, log->fd, 0);
+    if( log->map == MAP_FAILED ) 
+    {
+        log->map = NULL;
+        close(log->fd);
+        log->fd = -1;
+        return MLOG_ERR_MAP;
+    }
+
+    if( !mlog_load(log, log->map_size - MLOG_DATA_OFFSET) )
+    {
+        munmap(log->map, log->map_size);
+        log->map = NULL;
+        close(log->fd);
+        log->fd = -1;
+        return MLOG_ERR_FILE;
+    }
+
+    log->synced = log->hdr->tail;
+    log->limit = log->hdr->head + log->hdr->size;
+    return MLOG_OK;
+}
+
+void mlog_close(mlog_t* log)
+{
+    if( log->map ) {
+        mlog_sync(log);
+        munmap(log->map, log->map_size);
+        log->map = NULL;
+    }
+
+    if( log->fd >= 0 ) {
+        close(log->fd);
+        log->fd = -1;
+    }
+}
+
+/**
+ * @brief Drop the oldest records until there is room to write up to position end
+ */
+static
+void mlog_make_room(mlog_t* log, uint64_t end)
+{
+    while( end - log->hdr->head > log->hdr->size && log->hdr->head < log->hdr->tail )
+        mlog_drop_head(log);
+}
+
+bool mlog_put(mlog_t* log, const void* rec, uint32_t len)
+{
+    mlog_hdr_t* hdr = log->hdr;
+    uint64_t total = MLOG_ALIGN(sizeof(mlog_rec_t) + len);
+    uint64_t pos = hdr->tail;
+    uint64_t off = pos % hdr->size;
+    uint64_t pad = 0;
+
+    if( len == 0 || total > hdr->size / 2 )
+        return false;
+
+    // records never wrap around
+    if( hdr->size - off < total )
+        pad = hdr->size - off;
+
+    if( pos + pad + total > log->limit ) 
+    {
+        // would overwrite records a crash could bring back, move the checkpoint first
+        mlog_make_room(log, pos + pad + total + MLOG_RESERVE(hdr->size));
+        mlog_sync(log);
+    }
+
+    mlog_make_room(log, pos + pad + total);
+
+    if( pad ) 
+    {
+        mlog_rec_t* p = (mlog_rec_t*) &log->data[off];
+        p->len = MLOG_PAD;
+        p->crc = mlog_rec_crc(pos, MLOG_PAD, NULL);
+        pos += pad;
+        off = 0;
+    }
+
+    mlog_rec_t* r = (mlog_rec_t*) &log->data[off];
+    r->len = len;
+    r->crc = mlog_rec_crc(pos, len, rec);
+    memcpy(r + 1, rec, len);
+
+    hdr->tail = pos + total;
+    hdr->count++;
+
+    // keeps the records to check on open bounded whatever the sync policy
+    if( hdr->tail - log->synced >= MLOG_CHECKPOINT_BYTES )
+        mlog_sync(log);
+
+    return true;
+}
+
+uint32_t mlog_peek(mlog_t* log, const void** rec)
+{
+    mlog_hdr_t* hdr = log->hdr;
+    uint32_t len;
+
+    while( hdr->head < hdr->tail )
+    {
+        if( mlog_rec_check(log, hdr->head, &len) && len ) {
+            *rec = &log->data[hdr->head % hdr->size + sizeof(mlog_rec_t)];
+            return len;
+        }
+
+        // padding or corrupted record
+        mlog_drop_head(log);
+    }
+
+    return 0;
+}
+
+void mlog_next(mlog_t* log)
+{
+    const void* rec;
+
+    // skips padding and corrupted records too
+    if( mlog_peek(log, &rec) == 0 )
+        return;
+
+    mlog_drop_head(log);
+}
+
+uint32_t mlog_read(mlog_t* log, uint64_t* pos, const void** rec)
+{
+    mlog_hdr_t* hdr = log->hdr;
+    uint32_t len;
+
+    if( *pos < hdr->head )
+        *pos = hdr->head;
+
+    while( *pos < hdr->tail )
+    {
+        uint64_t off = *pos % hdr->size;
+        uint64_t size = mlog_rec_check(log, *pos, &len);
+
+        if( size == 0 ) {
+            // corrupted, mlog_peek() drops it when the head gets here
+            *pos = mlog_skip(log, *pos);
+            continue;
+        }
+
+        *pos += size;
+        if( len ) {
+            *rec = &log->data[off + sizeof(mlog_rec_t)];
+            return len;
+        }
+    }
+
+    return 0;
+}
+
+void mlog_consume(mlog_t* log, uint64_t pos)
+{
+    while( log->hdr->head < pos && log->hdr->head < log->hdr->tail )
+        mlog_next(log);
+}
+
+/**
+ * @brief Write back a range of the mapping, extended to page boundaries
+ */
+static
+void mlog_sync_range(mlog_t* log, size_t start, size_t end)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+
+    start -= start % page;
+    msync((uint8_t*) log->map + start, end - start, MS_SYNC);
+}
+
+void mlog_sync(mlog_t* log)
+{
+    mlog_hdr_t* hdr = log->hdr;
+    uint64_t start = log->synced;
+
+    // anything older than the head was overwritten and has to go out anyway
+    if( hdr->tail - start > hdr->size )
+        start = hdr->tail - hdr->size;
+
+    if( start < hdr->tail )
+    {
+        uint64_t from = start % hdr->size;
+        uint64_t to = hdr->tail % hdr->size;
+
+        if( to == 0 )
+            to = hdr->size;
+
+        if( from < to ) {
+            mlog_sync_range(log, MLOG_DATA_OFFSET + from, MLOG_DATA_OFFSET + to);
+        } else {
+            mlog_sync_range(log, MLOG_DATA_OFFSET + from, MLOG_DATA_OFFSET + hdr->size);
+            mlog_sync_range(log, MLOG_DATA_OFFSET, MLOG_DATA_OFFSET + to);
+        }
+    }
+
+    // the checkpoint only goes out once the records it points to are stored
+    mlog_checkpoint(log);
+    mlog_sync_range(log, 0, MLOG_SLOT_OFFSET(1) + sizeof(mlog_hdr_t));
+    log->synced = hdr->tail;
+}
+
+uint32_t mlog_count(mlog_t* log)
+{
+    return log->hdr->count;
+}
\ No newline at end of file
@@ -0,0 +1,295 @@
+/**
+ * @file mlog.h
+ * @author edsp
+ * @brief Memory-mapped circular backlog file
+ * @version 1.0.0
+ * @date 2024-01-10
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * The file has a fixed size: a page holding two \ref mlog_hdr_t checkpoints
+ * followed by the data area. Records are 8 byte aligned and start with a \ref mlog_rec_t 
+ * header. A record never wraps around the end of the data area, if it does 
+ * not fit a padding record is written instead and the record starts again at 
+ * offset 0. Once full, the oldest records are overwritten.
+ * 
+ * Head and tail are monotonic byte counters, the offset in the data area is 
+ * the position modulo the data area size. The whole file is mapped, so 
+ * appending and reading are just memory copies and the OS writes the dirty 
+ * pages back to the file.
+ * 
+ * Every record carries a CRC-32C of its position, length and data, so torn 
+ * or stale records are told apart from valid ones. mlog_sync() writes a 
+ * checkpoint of the header, alternating between two slots, so a torn 
+ * checkpoint leaves the previous one usable. On open the newest valid 
+ * checkpoint gives head and tail right away and only the records appended 
+ * after it are checked, so opening does not depend on the amount of data 
+ * in the file. Corrupted records are skipped when read.
+ * 
+ * Records the last checkpoint counts are never overwritten: before that 
+ * happens, MLOG_RESERVE bytes of the oldest records are dropped and a new 
+ * checkpoint is written. mlog_put() also writes one every 
+ * MLOG_CHECKPOINT_BYTES, so the records checked on open stay bounded even if
+ * mlog_sync() is never called.
+ */
+
+#ifndef _MLOG_H_
+#define _MLOG_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define MLOG_OK             0
+#define MLOG_ERR_PARAM      -1
+#define MLOG_ERR_FILE       -2
+#define MLOG_ERR_MAP        -3
+
+#define MLOG_MAGIC          0x474F4C4D  /* "MLOG" */
+#define MLOG_VERSION        2
+
+/**
+ * @brief Offset of the data area in the file
+ */
+#define MLOG_DATA_OFFSET    4096
+
+/**
+ * @brief Offset of each checkpoint slot in the file, in different sectors so
+ * a torn write can only damage one of them
+ */
+#define MLOG_SLOT_OFFSET(n) ((n) * 512)
+
+/**
+ * @brief Room made ahead when appending would overwrite records the last 
+ * checkpoint counts, so checkpoints are not forced on every append once 
+ * the file is full
+ */
+#define MLOG_RESERVE(size)  ((size) / 16)
+
+/**
+ * @brief Bytes appended since the last checkpoint after which mlog_put() 
+ * calls mlog_sync() itself. Bounds the records checked on open, at the cost 
+ * of blocking one append in that many bytes until they are stored.
+ */
+#ifndef MLOG_CHECKPOINT_BYTES
+    #define MLOG_CHECKPOINT_BYTES (64 * 1024)
+#endif
+
+/**
+ * @brief Record length marking a padding record
+ */
+#define MLOG_PAD            0xFFFFFFFF
+
+#define MLOG_ALIGN(n) (((n) + 7) & ~((uint64_t)7))
+
+/**
+ * @brief File header, stored as a checkpoint
+ */
+typedef struct mlog_hdr_t
+{
+    uint32_t magic;
+    uint32_t version;
+
+    /**
+     * @brief Size of the data area in bytes
+     */
+    uint64_t size;
+
+    /**
+     * @brief Position of the oldest record
+     */
+    uint64_t head;
+
+    /**
+     * @brief Position where the next record will be written
+     */
+    uint64_t tail;
+
+    /**
+     * @brief Number of records in the file
+     */
+    uint32_t count;
+
+    /**
+     * @brief Checkpoint sequence number, the highest valid one wins
+     */
+    uint32_t seq;
+
+    /**
+     * @brief CRC-32C of all the fields above
+     */
+    uint32_t crc;
+
+}mlog_hdr_t;
+
+/**
+ * @brief Record header
+ */
+typedef struct mlog_rec_t
+{
+    /**
+     * @brief Record length in bytes or MLOG_PAD
+     */
+    uint32_t len;
+
+    /**
+     * @brief CRC-32C of the record position, length and data
+     */
+    uint32_t crc;
+
+}mlog_rec_t;
+
+/**
+ * @brief Backlog file handle
+ */
+typedef struct mlog_t
+{
+    int fd;
+    void* map;
+    size_t map_size;
+    uint8_t* data;
+
+    /**
+     * @brief Current header, written to a checkpoint slot by mlog_sync()
+     */
+    mlog_hdr_t state;
+    mlog_hdr_t* hdr;
+
+    /**
+     * @brief Slot the next checkpoint goes to
+     */
+    unsigned int slot;
+
+    /**
+     * @brief Position up to which records can be appended without 
+     * overwriting records the last checkpoint counts
+     */
+    uint64_t limit;
+
+    /**
+     * @brief Number of corrupted records skipped
+     */
+    uint32_t corrupt;
+
+    /**
+     * @brief Position up to which the data has been written back to the file
+     */
+    uint64_t synced;
+
+    /**
+     * @brief Number of records and padding picked up past the checkpoint on
+     * open
+     */
+    uint32_t recovered;
+
+}mlog_t;
+
+/**
+ * @brief Open a backlog file, creating it if it does not exist. An existing 
+ * file is reused if its data area has the requested size and it has a valid
+ * checkpoint, otherwise it is cleared. Records appended after the last 
+ * checkpoint are recovered if they are intact.
+ * 
+ * @param log Backlog file handle
+ * @param path Fullpath of the file, including filename
+ * @param size Size of the data area in bytes
+ * @return MLOG_OK if successful or a negative error code
+ */
+int mlog_open(mlog_t* log, const char* path, size_t size);
+
+/**
+ * @brief Open an existing backlog file for reading only, for instance a copy
+ * pulled off a device. The size is taken from the file and records appended
+ * after the last checkpoint are recovered in memory, the file is never 
+ * modified. Only mlog_read() and mlog_close() may be used on the handle.
+ * 
+ * @param log Backlog file handle
+ * @param path Fullpath of the file, including filename
+ * @return MLOG_OK if successful or a negative error code
+ */
+int mlog_open_readonly(mlog_t* log, const char* path);
+
+/**
+ * @brief Write back all dirty pages and close the file
+ * 
+ * @param log Backlog file handle
+ */
+void mlog_close(mlog_t* log);
+
+/**
+ * @brief Append a record, overwriting the oldest records if needed. Writes a
+ * checkpoint once MLOG_CHECKPOINT_BYTES were appended since the last one.
+ * 
+ * @param log Backlog file handle
+ * @param rec Record data
+ * @param len Record length in bytes
+ * @return true If the record was appended
+ * @return false If the record is empty or larger than half the data area
+ */
+bool mlog_put(mlog_t* log, const void* rec, uint32_t len);
+
+/**
+ * @brief Get a pointer to the oldest record without removing it
+ * 
+ * @param log Backlog file handle
+ * @param[out] rec Pointer to the record data inside the mapping
+ * @return Record length in bytes or 0 if the file is empty
+ */
+uint32_t mlog_peek(mlog_t* log, const void** rec);
+
+/**
+ * @brief Remove the oldest record
+ * 
+ * @param log Backlog file handle
+ */
+void mlog_next(mlog_t* log);
+
+/**
+ * @brief Get a pointer to the record at a read position without removing it
+ * and move the position past it. Reading ahead this way lets many records be
+ * handled before they are removed with a single mlog_consume() call.
+ * 
+ * @param log Backlog file handle
+ * @param[in,out] pos Read position, start with 0 to read from the oldest 
+ * record. Moved to the oldest record if it was overwritten.
+ * @param[out] rec Pointer to the record data inside the mapping
+ * @return Record length in bytes or 0 if there are no more records
+ */
+uint32_t mlog_read(mlog_t* log, uint64_t* pos, const void** rec);
+
+/**
+ * @brief Remove all records before a read position
+ * 
+ * @param log Backlog file handle
+ * @param pos Read position returned by mlog_read()
+ */
+void mlog_consume(mlog_t* log, uint64_t pos);
+
+/**
+ * @brief Write back to the file all records appended since the last call,
+ * then a checkpoint of the header. Blocks until the data is on the storage.
+ * 
+ * @param log Backlog file handle
+ */
+void mlog_sync(mlog_t* log);
+
+/**
+ * @brief Number of records in the file
+ * 
+ * @param log Backlog file handle
+ */
+uint32_t mlog_count(mlog_t* log);
+
+#endif //_MLOG_H_
\ No newline at end of file
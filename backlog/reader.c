@@ -0,0 +1,388 @@
+/**
+ * @file reader.c
+ * @author edsp
+ * @brief Offline reader of backlog files. Host only.
+ * @version 1.0.0
+ * @date 2024-01-10
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * 
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "reader.h"
+#include "record.h"
+
+#define CHAIN_POS(seq, off) (((uint64_t)(seq) << 32) | (off))
+#define CHAIN_SEQ(pos)      ((uint32_t)((pos) >> 32))
+#define CHAIN_OFF(pos)      ((uint32_t)(pos))
+
+/**
+ * @brief Open a segment of a chain, the compressed version if there is one
+ */
+static
+bool chain_open_segment(rlog_backlog_reader_t* r, rlog_backlog_chain_t* c, unsigned int cls, uint32_t seq)
+{
+    char name[SLOG_NAME_MAX];
+
+    if( c->seg.fd >= 0 )
+        close(c->seg.fd);
+
+    memset(&c->seg, 0, offsetof(slog_reader_t, block));
+    c->seg.cls = cls;
+    c->seg.seq = seq;
+    c->seg.compressed = true;
+
+    slog_segment_name(name, r->path, cls, seq, ".z");
+    c->seg.fd = open(name, O_RDONLY);
+    if( c->seg.fd < 0 ) {
+        slog_segment_name(name, r->path, cls, seq, ".log");
+        c->seg.fd = open(name, O_RDONLY);
+        c->seg.compressed = false;
+    }
+
+    return c->seg.fd >= 0;
+}
+
+/**
+ * @brief Read the raw record at the position of a chain and move past it
+ * 
+ * @return Record length or 0 at the end of the chain
+ */
+static
+uint32_t chain_read(rlog_backlog_reader_t* r, rlog_backlog_chain_t* c, const uint8_t** rec)
+{
+    if( !r->segments )
+        return mlog_read(&r->mlog, &c->pos, (const void**) rec);
+
+    unsigned int cls = c - r->chain;
+    slog_rec_t h;
+
+    while( c->first && CHAIN_SEQ(c->pos) <= c->last )
+    {
+        uint32_t seq = CHAIN_SEQ(c->pos);
+        uint32_t off = CHAIN_OFF(c->pos);
+        int ret = 0;
+
+        if( (c->seg.fd >= 0 && c->seg.seq == seq) || chain_open_segment(r, c, cls, seq) )
+            ret = slog_reader_record(&c->seg, off, &h, rec);
+
+        if( ret > 0 ) {
+            c->pos = CHAIN_POS(seq, off + sizeof(slog_rec_t) + h.len);
+            return h.len;
+        }
+
+        if( ret < 0 )
+            r->corrupt++;
+
+        // end of the segment or the rest of it can't be trusted
+        c->pos = CHAIN_POS(seq + 1, 0);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Decode a raw record, falling back to a rendered one
+ */
+static
+int decode(const uint8_t* rec, uint32_t len, log_t* log)
+{
+    if( log_record_decode(rec, len, log) )
+        return RLOG_READER_LOG;
+
+    // "<pri>..."
+    log->timestamp = 0;
+    log->pri = 0;
+    log->proc[0] = '\0';
+    log->msg[0] = '\0';
+    for( uint32_t i = 1; i < len && rec[0] == '<' && rec[i] >= '0' && rec[i] <= '9'; i++ )
+        log->pri = log->pri * 10 + (rec[i] - '0');
+
+    return RLOG_READER_TEXT;
+}
+
+/**
+ * @brief Add an entry to the index of a chain
+ */
+static
+void chain_mark(rlog_backlog_chain_t* c, time_t timestamp, uint64_t pos)
+{
+    // grows by doubling
+    if( (c->nindex & (c->nindex - 1)) == 0 ) 
+    {
+        rlog_backlog_mark_t* index = realloc(c->index, (c->nindex ? 2 * c->nindex : 1) * sizeof(rlog_backlog_mark_t));
+        if( index == NULL )
+            return;
+        c->index = index;
+    }
+
+    c->index[c->nindex].timestamp = timestamp;
+    c->index[c->nindex].pos = pos;
+    c->nindex++;
+}
+
+/**
+ * @brief Build the sparse index of a chain, starting at its first record
+ */
+static
+void chain_index(rlog_backlog_reader_t* r, rlog_backlog_chain_t* c)
+{
+    const uint8_t* rec;
+    uint32_t len;
+    log_t log;
+
+    if( !r->segments ) 
+    {
+        uint64_t n = 0;
+        uint64_t pos = c->pos;
+
+        while( (len = chain_read(r, c, &rec)) ) 
+        {
+            if( n++ % RLOG_READER_INDEX_STEP == 0 && decode(rec, len, &log) == RLOG_READER_LOG )
+                chain_mark(c, log.timestamp, pos);
+            pos = c->pos;
+        }
+        return;
+    }
+
+    // the first record of every segment
+    for( uint32_t seq = c->first; c->first && seq <= c->last; seq++ )
+    {
+        c->pos = CHAIN_POS(seq, 0);
+        len = chain_read(r, c, &rec);
+        if( len && CHAIN_SEQ(c->pos) == seq && decode(rec, len, &log) == RLOG_READER_LOG )
+            chain_mark(c, log.timestamp, CHAIN_POS(seq, 0));
+    }
+}
+
+/**
+ * @brief Find the segments of every class
+ */
+static
+bool scan_segments(rlog_backlog_reader_t* r)
+{
+    char dir[SLOG_PATH_MAX];
+    const char* base = strrchr(r->path, '/');
+    struct dirent* e;
+    unsigned int cls;
+    uint32_t seq;
+    bool found = false;
+
+    if( base ) {
+        snprintf(dir, sizeof(dir), "%.*s", (int)(base - r->path), r->path);
+        base++;
+    } else {
+        snprintf(dir, sizeof(dir), ".");
+        base = r->path;
+    }
+
+    DIR* d = opendir(dir[0] ? dir : "/");
+    if( d == NULL )
+        return false;
+
+    while( (e = readdir(d)) != NULL )
+    {
+        const char* ext = slog_segment_parse(e->d_name, base, &cls, &seq);
+        if( ext == NULL || (strcmp(ext, ".log") != 0 && strcmp(ext, ".z") != 0) )
+            continue;
+
+        rlog_backlog_chain_t* c = &r->chain[cls];
+        if( c->first == 0 || seq < c->first )
+            c->first = seq;
+        if( seq > c->last )
+            c->last = seq;
+        found = true;
+    }
+
+    closedir(d);
+    return found;
+}
+
+/**
+ * @brief Go to the first record of a chain that may be in the time window
+ */
+static
+void chain_seek(rlog_backlog_reader_t* r, rlog_backlog_chain_t* c, time_t from)
+{
+    unsigned int lo = 0;
+    unsigned int hi = c->nindex;
+
+    // first mark at or after from, the record may be right before it
+    while( lo < hi ) 
+    {
+        unsigned int mid = lo + (hi - lo) / 2;
+        if( c->index[mid].timestamp < from )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if( from && lo > 0 )
+        c->pos = c->index[lo - 1].pos;
+    else if( r->segments )
+        c->pos = CHAIN_POS(c->first, 0);
+    else
+        c->pos = 0;
+
+    c->kind = RLOG_READER_END;
+    c->done = false;
+}
+
+/**
+ * @brief Fetch the next record of a chain that passes the filter
+ */
+static
+void chain_fetch(rlog_backlog_reader_t* r, rlog_backlog_chain_t* c)
+{
+    const rlog_backlog_filter_t* f = &r->filter;
+    const uint8_t* rec;
+    uint32_t len;
+
+    while( (len = chain_read(r, c, &rec)) )
+    {
+        int kind = decode(rec, len, &c->log);
+
+        if( (c->log.pri & 0x07) > f->level )
+            continue;
+
+        if( kind == RLOG_READER_TEXT ) 
+        {
+            if( f->from || f->to || f->proc )
+                continue;
+
+            c->text = rec;
+            c->text_len = len;
+        }
+        else 
+        {
+            if( f->to && c->log.timestamp > f->to )
+                break;
+
+            if( c->log.timestamp < f->from || (f->proc && strcmp(c->log.proc, f->proc) != 0) )
+                continue;
+        }
+
+        c->kind = kind;
+        return;
+    }
+
+    c->kind = RLOG_READER_END;
+    c->done = true;
+}
+
+bool rlog_backlog_reader_open(rlog_backlog_reader_t* r, const char* path)
+{
+    struct stat st;
+
+    if( r == NULL || path == NULL || strlen(path) >= SLOG_PATH_MAX )
+        return false;
+
+    memset(r, 0, sizeof(rlog_backlog_reader_t));
+    snprintf(r->path, sizeof(r->path), "%s", path);
+    r->mlog.fd = -1;
+    for( unsigned int i = 0; i < SLOG_CLASSES; i++ )
+        r->chain[i].seg.fd = -1;
+
+    if( stat(path, &st) == 0 && S_ISREG(st.st_mode) ) 
+    {
+        if( mlog_open_readonly(&r->mlog, path) != MLOG_OK )
+            return false;
+        r->nchains = 1;
+    }
+    else 
+    {
+        if( !scan_segments(r) )
+            return false;
+        r->segments = true;
+        r->nchains = SLOG_CLASSES;
+    }
+
+    for( unsigned int i = 0; i < r->nchains; i++ ) {
+        chain_seek(r, &r->chain[i], 0);
+        chain_index(r, &r->chain[i]);
+    }
+
+    // not counted twice when read again
+    r->corrupt = 0;
+
+    rlog_backlog_filter_t all = { .level = RLOG_DEBUG };
+    rlog_backlog_reader_seek(r, &all);
+    return true;
+}
+
+void rlog_backlog_reader_close(rlog_backlog_reader_t* r)
+{
+    for( unsigned int i = 0; i < SLOG_CLASSES; i++ ) 
+    {
+        rlog_backlog_chain_t* c = &r->chain[i];
+
+        if( c->seg.fd >= 0 ) {
+            close(c->seg.fd);
+            c->seg.fd = -1;
+        }
+
+        free(c->index);
+        c->index = NULL;
+        c->nindex = 0;
+    }
+
+    if( r->mlog.fd >= 0 )
+        mlog_close(&r->mlog);
+}
+
+void rlog_backlog_reader_seek(rlog_backlog_reader_t* r, const rlog_backlog_filter_t* filter)
+{
+    r->filter = *filter;
+
+    for( unsigned int i = 0; i < r->nchains; i++ )
+        chain_seek(r, &r->chain[i], filter->from);
+}
+
+int rlog_backlog_reader_next(rlog_backlog_reader_t* r, log_t* log)
+{
+    rlog_backlog_chain_t* next = NULL;
+
+    for( unsigned int i = 0; i < r->nchains; i++ )
+    {
+        rlog_backlog_chain_t* c = &r->chain[i];
+
+        if( c->kind == RLOG_READER_END && !c->done )
+            chain_fetch(r, c);
+
+        // oldest first, rendered records have no timestamp and go right away
+        if( c->kind != RLOG_READER_END && (next == NULL || c->log.timestamp < next->log.timestamp) )
+            next = c;
+    }
+
+    if( next == NULL )
+        return RLOG_READER_END;
+
+    int kind = next->kind;
+    *log = next->log;
+    r->text = (const char*) next->text;
+    r->text_len = next->text_len;
+
+    // fetched again on the next call, which keeps the text where it is until then
+    next->kind = RLOG_READER_END;
+    return kind;
+}
\ No newline at end of file
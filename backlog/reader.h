@@ -0,0 +1,191 @@
+/**
+ * @file reader.h
+ * @author edsp
+ * @brief Offline reader of backlog files pulled off a device. Host only.
+ * @version 1.0.0
+ * @date 2024-01-10
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * Reads the files of the mmap engine (see mlog.h) and of the segmented engine
+ * (see slog.h) without modifying them. Records stored with 
+ * RLOG_BACKLOG_BINARY are decoded, rendered records are returned as they are.
+ * 
+ * Opening a backlog builds a sparse timestamp index: the position of every
+ * RLOG_READER_INDEX_STEP-th record of an mmap file and of the first record of
+ * every segment. rlog_backlog_reader_seek() binary searches it to the start
+ * of a time window. Records are appended in time order, so reading a chain 
+ * stops at the first record past the window. The severity classes of the segmented
+ * engine are merged back into a single stream ordered by timestamp.
+ * 
+ * The dlog engine stores lines in its own format and is not supported.
+ */
+
+#ifndef _BACKLOG_READER_H_
+#define _BACKLOG_READER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "../format/format.h"
+#include "mlog.h"
+#include "slog.h"
+
+/**
+ * @brief Number of records between two entries of the index of an mmap file
+ */
+#ifndef RLOG_READER_INDEX_STEP
+    #define RLOG_READER_INDEX_STEP 256
+#endif
+
+/**
+ * @brief Kind of record returned by rlog_backlog_reader_next()
+ */
+#define RLOG_READER_END     0
+#define RLOG_READER_LOG     1
+#define RLOG_READER_TEXT    2
+
+/**
+ * @brief Records to read
+ */
+typedef struct rlog_backlog_filter_t
+{
+    /**
+     * @brief Time window, 0 for no bound. Rendered records have no timestamp
+     * and are left out when a bound is set.
+     */
+    time_t from;
+    time_t to;
+
+    /**
+     * @brief Least severe level to read, RLOG_DEBUG for all
+     */
+    RLOG_LEVEL level;
+
+    /**
+     * @brief Process name to read or NULL for all
+     */
+    const char* proc;
+
+}rlog_backlog_filter_t;
+
+/**
+ * @brief Index entry: timestamp of a record and where to start reading 
+ * to get to it
+ */
+typedef struct rlog_backlog_mark_t
+{
+    time_t timestamp;
+    uint64_t pos;
+
+}rlog_backlog_mark_t;
+
+/**
+ * @brief Records of an mmap file or of one class of segments, read in order
+ */
+typedef struct rlog_backlog_chain_t
+{
+    /**
+     * @brief Read position. mmap file position or segment number in the 
+     * upper 32 bits and offset in the uncompressed segment in the lower ones.
+     */
+    uint64_t pos;
+
+    /**
+     * @brief Oldest and newest segment numbers, 0 if there are none
+     */
+    uint32_t first;
+    uint32_t last;
+    slog_reader_t seg;
+
+    rlog_backlog_mark_t* index;
+    unsigned int nindex;
+
+    /**
+     * @brief Next record of the chain, kind is RLOG_READER_END until it is
+     * fetched and done is set at the end of the chain
+     */
+    int kind;
+    log_t log;
+    const uint8_t* text;
+    uint32_t text_len;
+    bool done;
+
+}rlog_backlog_chain_t;
+
+/**
+ * @brief Backlog reader
+ */
+typedef struct rlog_backlog_reader_t
+{
+    char path[SLOG_PATH_MAX];
+    bool segments;
+    mlog_t mlog;
+    rlog_backlog_chain_t chain[SLOG_CLASSES];
+    unsigned int nchains;
+    rlog_backlog_filter_t filter;
+
+    /**
+     * @brief Rendered record returned by the last rlog_backlog_reader_next(),
+     * not null-terminated
+     */
+    const char* text;
+    uint32_t text_len;
+
+    /**
+     * @brief Number of corrupted records or blocks skipped
+     */
+    uint32_t corrupt;
+
+}rlog_backlog_reader_t;
+
+/**
+ * @brief Open a backlog and build its index
+ * 
+ * @param r Reader instance
+ * @param path Backlog file of the mmap engine or base path of the segment 
+ * files, that is the filepath given in rlog_cfg_t
+ * @return true If a backlog was found at path
+ */
+bool rlog_backlog_reader_open(rlog_backlog_reader_t* r, const char* path);
+
+/**
+ * @brief Close the backlog and free the index
+ * 
+ * @param r Reader instance
+ */
+void rlog_backlog_reader_close(rlog_backlog_reader_t* r);
+
+/**
+ * @brief Set the records to read and go back to the first record of the 
+ * time window. Without a call to this function all records are read.
+ * 
+ * @param r Reader instance
+ * @param filter Records to read
+ */
+void rlog_backlog_reader_seek(rlog_backlog_reader_t* r, const rlog_backlog_filter_t* filter);
+
+/**
+ * @brief Read the next record that passes the filter
+ * 
+ * @param r Reader instance
+ * @param[out] log Decoded record. Only pri is set for a rendered record.
+ * @return RLOG_READER_LOG for a decoded record, RLOG_READER_TEXT for a 
+ * rendered one, see r->text, or RLOG_READER_END if there are no more records
+ */
+int rlog_backlog_reader_next(rlog_backlog_reader_t* r, log_t* log);
+
+#endif //_BACKLOG_READER_H_
\ No newline at end of file
@@ -0,0 +1,73 @@
+/**
+ * @file record.c
+ * @author edsp
+ * @brief Compact binary form of a log_t
+ * @version 1.0.0
+ * @date 2024-01-10
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * 
+ */
+
+#include <string.h>
+
+#include "record.h"
+
+int log_record_encode(const log_t* log, uint8_t* rec, int size)
+{
+    int64_t ts = (int64_t) log->timestamp;
+    uint8_t proc_len = strnlen(log->proc, sizeof(log->proc));
+    uint16_t msg_len = strnlen(log->msg, sizeof(log->msg));
+
+    if( LOG_REC_HDR_SIZE + proc_len + msg_len > size )
+        return 0;
+
+    for( int i = 0; i < 8; i++ )
+        rec[i] = (uint8_t)(ts >> (8 * i));
+
+    rec[8] = log->pri;
+    rec[9] = proc_len;
+    rec[10] = (uint8_t) msg_len;
+    rec[11] = (uint8_t)(msg_len >> 8);
+    memcpy(&rec[LOG_REC_HDR_SIZE], log->proc, proc_len);
+    memcpy(&rec[LOG_REC_HDR_SIZE + proc_len], log->msg, msg_len);
+    return LOG_REC_HDR_SIZE + proc_len + msg_len;
+}
+
+bool log_record_decode(const uint8_t* rec, int len, log_t* log)
+{
+    uint64_t ts = 0;
+
+    if( len < LOG_REC_HDR_SIZE )
+        return false;
+
+    for( int i = 0; i < 8; i++ )
+        ts |= (uint64_t) rec[i] << (8 * i);
+
+    uint8_t proc_len = rec[9];
+    uint16_t msg_len = rec[10] | (rec[11] << 8);
+
+    if( LOG_REC_HDR_SIZE + proc_len + msg_len != len 
+        || proc_len >= sizeof(log->proc) || msg_len >= sizeof(log->msg) )
+        return false;
+
+    log->timestamp = (time_t) ts;
+    log->pri = rec[8];
+    memcpy(log->proc, &rec[LOG_REC_HDR_SIZE], proc_len);
+    log->proc[proc_len] = '\0';
+    memcpy(log->msg, &rec[LOG_REC_HDR_SIZE + proc_len], msg_len);
+    log->msg[msg_len] = '\0';
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,59 @@
+/**
+ * @file record.h
+ * @author edsp
+ * @brief Compact binary form of a log_t, as stored in the backlog with 
+ * RLOG_BACKLOG_BINARY and read back by the offline reader
+ * @version 1.0.0
+ * @date 2024-01-10
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * 
+ */
+
+#ifndef _BACKLOG_RECORD_H_
+#define _BACKLOG_RECORD_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "../format/format.h"
+
+/**
+ * @brief Binary record: timestamp (8 bytes), pri (1 byte), proc length (1 byte),
+ * msg length (2 bytes), proc and msg, all little endian.
+ */
+#define LOG_REC_HDR_SIZE 12
+
+/**
+ * @brief Encode a message
+ * 
+ * @param log Message
+ * @param[out] rec Buffer to hold the record
+ * @param size Buffer size in bytes
+ * @return Record length in bytes or 0 if it does not fit
+ */
+int log_record_encode(const log_t* log, uint8_t* rec, int size);
+
+/**
+ * @brief Decode a record
+ * 
+ * @param rec Record
+ * @param len Record length in bytes
+ * @param[out] log Message, proc and msg are null-terminated
+ * @return false If it is not a valid record
+ */
+bool log_record_decode(const uint8_t* rec, int len, log_t* log);
+
+#endif //_BACKLOG_RECORD_H_
\ No newline at end of file
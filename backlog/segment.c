@@ -0,0 +1,145 @@
+/**
+ * @file segment.c
+ * @author edsp
+ * @brief Segment file format of the segmented backlog, shared by slog.c and
+ * the offline reader
+ * @version 1.0.0
+ * @date 2024-01-10
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * 
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "slog.h"
+#include "crc32c.h"
+
+void slog_segment_name(char* name, const char* path, unsigned int cls, uint32_t seq, const char* ext)
+{
+    snprintf(name, SLOG_NAME_MAX, "%s.%u.%08lx%s", path, cls, (unsigned long) seq, ext);
+}
+
+uint32_t slog_record_crc(uint32_t off, uint32_t len, const void* data)
+{
+    uint32_t crc = crc32c(0, &off, sizeof(off));
+
+    crc = crc32c(crc, &len, sizeof(len));
+    return crc32c(crc, data, len);
+}
+
+const char* slog_segment_parse(const char* name, const char* base, unsigned int* c, uint32_t* seq)
+{
+    size_t n = strlen(base);
+    char* end;
+
+    if( strncmp(name, base, n) != 0 || name[n] != '.' )
+        return NULL;
+
+    *c = strtoul(&name[n + 1], &end, 10);
+    if( end == &name[n + 1] || *end != '.' || *c >= SLOG_CLASSES )
+        return NULL;
+
+    name = end + 1;
+    *seq = strtoul(name, &end, 16);
+    if( end != name + 8 || *seq == 0 )
+        return NULL;
+
+    return end;
+}
+
+/**
+ * @brief Load the block of a compressed segment holding an offset
+ * 
+ * @return 1 if loaded, 0 at the end of the segment or -1 if corrupted
+ */
+static
+int slog_rd_block(slog_reader_t* rd, uint32_t off)
+{
+    slog_block_t b;
+
+    if( off >= rd->block_off && off < rd->block_off + rd->block_len )
+        return 1;
+
+    // behind the next block, walk the headers from the start again
+    if( off < rd->next_off ) {
+        rd->file_off = 0;
+        rd->next_off = 0;
+    }
+
+    while( 1 )
+    {
+        if( pread(rd->fd, &b, sizeof(b), rd->file_off) != sizeof(b) )
+            return 0;
+
+        if( b.magic != SLOG_BLOCK_MAGIC || b.raw_len == 0 || b.raw_len > SLOG_BLOCK_SIZE || b.len > b.raw_len )
+            return -1;
+
+        if( off < rd->next_off + b.raw_len )
+            break;
+
+        rd->file_off += sizeof(b) + b.len;
+        rd->next_off += b.raw_len;
+    }
+
+    uint8_t* data = (b.len == b.raw_len) ? rd->block : rd->zbuf;
+    if( pread(rd->fd, data, b.len, rd->file_off + sizeof(b)) != b.len || b.crc != crc32c(0, data, b.len) )
+        return -1;
+
+    if( data == rd->zbuf && lz_decompress(data, b.len, rd->block, SLOG_BLOCK_SIZE) != (int) b.raw_len )
+        return -1;
+
+    rd->block_off = rd->next_off;
+    rd->block_len = b.raw_len;
+    rd->file_off += sizeof(b) + b.len;
+    rd->next_off += b.raw_len;
+    return 1;
+}
+
+int slog_reader_record(slog_reader_t* rd, uint32_t off, slog_rec_t* r, const uint8_t** data)
+{
+    if( rd->compressed ) 
+    {
+        int ret = slog_rd_block(rd, off);
+        if( ret <= 0 )
+            return ret;
+
+        uint32_t i = off - rd->block_off;
+        if( rd->block_len - i < sizeof(slog_rec_t) )
+            return -1;
+
+        memcpy(r, &rd->block[i], sizeof(slog_rec_t));
+        if( r->len > rd->block_len - i - sizeof(slog_rec_t) )
+            return -1;
+
+        *data = &rd->block[i + sizeof(slog_rec_t)];
+    }
+    else 
+    {
+        if( pread(rd->fd, r, sizeof(slog_rec_t), off) != sizeof(slog_rec_t) )
+            return 0;
+
+        if( r->len == 0 || r->len > SLOG_BLOCK_SIZE - sizeof(slog_rec_t) 
+            || pread(rd->fd, rd->block, r->len, off + sizeof(slog_rec_t)) != r->len )
+            return -1;
+
+        *data = rd->block;
+    }
+
+    return (r->crc == slog_record_crc(off, r->len, *data)) ? 1 : -1;
+}
\ No newline at end of file
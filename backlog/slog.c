@@ -0,0 +1,739 @@
+/**
+ * @file slog.c
+ * @author edsp
+ * @brief Segmented backlog files implementation
+ * @version 1.0.0
+ * @date 2024-01-10
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * 
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "slog.h"
+#include "crc32c.h"
+
+#define SLOG_SEG(log, c, seq) (&(log)->cls[c].seg[(seq) % SLOG_MAX_SEGMENTS])
+
+static
+void slog_name(const slog_t* log, char* name, unsigned int c, uint32_t seq, const char* ext)
+{
+    slog_segment_name(name, log->path, c, seq, ext);
+}
+
+static
+bool slog_pos_before(const slog_pos_t* a, const slog_pos_t* b)
+{
+    return a->seq < b->seq || (a->seq == b->seq && a->off < b->off);
+}
+
+/**
+ * @brief Delete the oldest segment of a class. Must be called with the lock taken.
+ */
+static
+void slog_evict(slog_t* log, unsigned int c)
+{
+    slog_class_t* k = &log->cls[c];
+    slog_seg_t* s = SLOG_SEG(log, c, k->first);
+    char name[SLOG_NAME_MAX];
+
+    if( s->present ) 
+    {
+        if( log->rd.fd >= 0 && log->rd.cls == c && log->rd.seq == k->first ) {
+            close(log->rd.fd);
+            log->rd.fd = -1;
+            log->rd.seq = 0;
+        }
+
+        slog_name(log, name, c, k->first, s->compressed ? ".z" : ".log");
+        unlink(name);
+        log->total -= s->bytes;
+        memset(s, 0, sizeof(slog_seg_t));
+    }
+
+    k->first++;
+    if( k->head.seq < k->first ) {
+        k->head.seq = k->first;
+        k->head.off = 0;
+    }
+}
+
+/**
+ * @brief Delete the oldest sealed segment of the least important class that
+ * has one. Must be called with the lock taken.
+ * 
+ * @return false If there was none
+ */
+static
+bool slog_evict_lowest(slog_t* log)
+{
+    for( int c = SLOG_CLASSES - 1; c >= 0; c-- )
+    {
+        if( log->cls[c].first < log->cls[c].last ) {
+            slog_evict(log, c);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Write a block of log->in, compressed if it gets any smaller
+ */
+static
+bool slog_write_block(slog_t* log, int fd, uint32_t raw_len, uint32_t* bytes)
+{
+    slog_block_t b = { .magic = SLOG_BLOCK_MAGIC, .raw_len = raw_len };
+    const uint8_t* data = log->out;
+    int n = lz_compress(log->in, raw_len, log->out, raw_len - 1, log->table);
+
+    if( n <= 0 ) {
+        data = log->in;
+        n = raw_len;
+    }
+
+    b.len = n;
+    b.crc = crc32c(0, data, n);
+    if( write(fd, &b, sizeof(b)) != sizeof(b) || write(fd, data, n) != n )
+        return false;
+
+    *bytes += sizeof(b) + n;
+    return true;
+}
+
+/**
+ * @brief Compress a sealed segment into a temporary file and swap it in
+ * 
+ * @return false If it failed and should be tried again later
+ */
+static
+bool slog_compress(slog_t* log, unsigned int c, uint32_t seq)
+{
+    char src[SLOG_NAME_MAX];
+    char dst[SLOG_NAME_MAX];
+    char tmp[SLOG_NAME_MAX];
+    uint32_t off = 0;
+    uint32_t fill = 0;
+    uint32_t bytes = 0;
+    slog_rec_t r;
+
+    slog_name(log, src, c, seq, ".log");
+    slog_name(log, dst, c, seq, ".z");
+    slog_name(log, tmp, c, seq, ".z.tmp");
+
+    int in = open(src, O_RDONLY);
+    int out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = (in >= 0 && out >= 0);
+
+    // pack whole records in each block
+    while( ok )
+    {
+        uint32_t n = 0;
+
+        if( pread(in, &r, sizeof(r), off) == sizeof(r) && r.len > 0 && r.len <= SLOG_BLOCK_SIZE - sizeof(r) )
+            n = sizeof(r) + r.len;
+
+        if( n == 0 || fill + n > SLOG_BLOCK_SIZE ) {
+            if( fill )
+                ok = slog_write_block(log, out, fill, &bytes);
+            fill = 0;
+        }
+
+        if( n == 0 || pread(in, &log->in[fill], n, off) != n )
+            break;
+
+        fill += n;
+        off += n;
+    }
+
+    if( ok && fill )
+        ok = slog_write_block(log, out, fill, &bytes);
+
+    ok = ok && fsync(out) == 0;
+
+    if( in >= 0 )
+        close(in);
+    if( out >= 0 )
+        close(out);
+
+    os_mutex_lock(log->lock);
+
+    slog_seg_t* s = SLOG_SEG(log, c, seq);
+    if( s->present && ok && rename(tmp, dst) == 0 ) 
+    {
+        unlink(src);
+        log->total -= s->bytes;
+        log->total += bytes;
+        s->bytes = bytes;
+        s->compressed = true;
+    }
+    else 
+    {
+        unlink(tmp);
+        // evicted meanwhile, not a failure
+        ok = !s->present;
+    }
+
+    os_mutex_unlock(log->lock);
+    return ok;
+}
+
+/**
+ * @brief Compress the oldest sealed segment not compressed yet, skipping 
+ * the one being replayed
+ * 
+ * @return true If there may be more to compress
+ */
+static
+bool slog_compress_next(slog_t* log)
+{
+    unsigned int cls = 0;
+    uint32_t seq = 0;
+
+    os_mutex_lock(log->lock);
+    for( unsigned int c = 0; c < SLOG_CLASSES && seq == 0; c++ ) 
+    {
+        for( uint32_t i = log->cls[c].first; i < log->cls[c].last; i++ ) 
+        {
+            slog_seg_t* s = SLOG_SEG(log, c, i);
+            bool reading = log->rd.fd >= 0 && log->rd.cls == c && log->rd.seq == i;
+
+            if( s->present && s->sealed && !s->compressed && !reading ) {
+                cls = c;
+                seq = i;
+                break;
+            }
+        }
+    }
+    os_mutex_unlock(log->lock);
+
+    if( seq == 0 )
+        return false;
+
+    return slog_compress(log, cls, seq);
+}
+
+static
+void slog_worker(void* arg)
+{
+    slog_t* log = (slog_t*) arg;
+
+    while( !log->terminate )
+    {
+        // also look again now and then for a segment that was being replayed
+        os_sem_wait(log->wake, 1000);
+        while( !log->terminate && slog_compress_next(log) );
+    }
+
+    os_sem_signal(log->done);
+    os_thread_destroy(NULL);
+}
+
+/**
+ * @brief Find the end of the last intact record of a segment
+ */
+static
+uint32_t slog_check_tail(slog_t* log, int fd)
+{
+    uint32_t off = 0;
+    slog_rec_t r;
+
+    while( pread(fd, &r, sizeof(r), off) == sizeof(r) 
+            && r.len > 0 && r.len <= SLOG_BLOCK_SIZE - sizeof(r)
+            && pread(fd, log->rec, r.len, off + sizeof(r)) == r.len 
+            && r.crc == slog_record_crc(off, r.len, log->rec) )
+    {
+        off += sizeof(r) + r.len;
+    }
+
+    return off;
+}
+
+/**
+ * @brief Start a new active segment. Must be called with the lock taken.
+ */
+static
+void slog_start_segment(slog_t* log, unsigned int c, uint32_t seq)
+{
+    slog_class_t* k = &log->cls[c];
+    char name[SLOG_NAME_MAX];
+
+    // keep the ring of segments from wrapping over the oldest
+    while( k->first < seq && seq - k->first >= SLOG_MAX_SEGMENTS )
+        slog_evict(log, c);
+
+    slog_seg_t* s = SLOG_SEG(log, c, seq);
+    memset(s, 0, sizeof(slog_seg_t));
+    s->present = true;
+    k->last = seq;
+
+    slog_name(log, name, c, seq, ".log");
+    k->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+}
+
+static
+void slog_seal(slog_t* log, unsigned int c)
+{
+    slog_class_t* k = &log->cls[c];
+
+    fsync(k->fd);
+    close(k->fd);
+
+    os_mutex_lock(log->lock);
+    SLOG_SEG(log, c, k->last)->sealed = true;
+    slog_start_segment(log, c, k->last + 1);
+    os_mutex_unlock(log->lock);
+
+    os_sem_signal(log->wake);
+}
+
+/**
+ * @brief Pick up the segments left on storage
+ */
+static
+int slog_scan(slog_t* log)
+{
+    char dir[SLOG_PATH_MAX];
+    char name[SLOG_NAME_MAX];
+    const char* base = strrchr(log->path, '/');
+    struct dirent* e;
+    struct stat st;
+    uint32_t hi[SLOG_CLASSES] = { 0 };
+    unsigned int c;
+    uint32_t seq;
+
+    if( base ) {
+        snprintf(dir, sizeof(dir), "%.*s", (int)(base - log->path), log->path);
+        base++;
+    } else {
+        snprintf(dir, sizeof(dir), ".");
+        base = log->path;
+    }
+
+    DIR* d = opendir(dir[0] ? dir : "/");
+    if( d == NULL )
+        return SLOG_ERR_FILE;
+
+    while( (e = readdir(d)) != NULL )
+    {
+        const char* ext = slog_segment_parse(e->d_name, base, &c, &seq);
+        if( ext && (strcmp(ext, ".log") == 0 || strcmp(ext, ".z") == 0) && seq > hi[c] )
+            hi[c] = seq;
+    }
+
+    for( c = 0; c < SLOG_CLASSES; c++ ) {
+        log->cls[c].first = hi[c] ? hi[c] : 1;
+        log->cls[c].last = hi[c];
+    }
+
+    rewinddir(d);
+    while( (e = readdir(d)) != NULL )
+    {
+        const char* ext = slog_segment_parse(e->d_name, base, &c, &seq);
+        if( ext == NULL )
+            continue;
+
+        slog_name(log, name, c, seq, ext);
+
+        // leftovers of a compression that did not finish or too old to keep
+        if( strcmp(ext, ".z.tmp") == 0 || seq + SLOG_MAX_SEGMENTS <= hi[c] ) {
+            unlink(name);
+            continue;
+        }
+
+        bool compressed = strcmp(ext, ".z") == 0;
+        if( (!compressed && strcmp(ext, ".log") != 0) || stat(name, &st) < 0 )
+            continue;
+
+        slog_seg_t* s = SLOG_SEG(log, c, seq);
+        if( s->present ) 
+        {
+            // both versions: the raw one was about to be deleted
+            slog_name(log, name, c, seq, ".log");
+            unlink(name);
+            if( !compressed ) 
+                continue;
+
+            log->total -= s->bytes;
+        }
+
+        s->present = true;
+        s->compressed = compressed;
+        s->sealed = (seq != hi[c]) || compressed;
+        s->bytes = st.st_size;
+        log->total += st.st_size;
+
+        if( seq < log->cls[c].first )
+            log->cls[c].first = seq;
+    }
+
+    closedir(d);
+    return SLOG_OK;
+}
+
+/**
+ * @brief Load the head positions, falling back to the oldest segments
+ */
+static
+void slog_load_cursor(slog_t* log)
+{
+    char name[SLOG_NAME_MAX];
+    uint32_t c[2 + 2 * SLOG_CLASSES];
+    const size_t n = sizeof(c) - sizeof(uint32_t);
+
+    for( unsigned int i = 0; i < SLOG_CLASSES; i++ ) {
+        log->cls[i].head.seq = log->cls[i].first;
+        log->cls[i].head.off = 0;
+    }
+
+    snprintf(name, sizeof(name), "%s.cur", log->path);
+    log->cur_fd = open(name, O_RDWR | O_CREAT, 0644);
+
+    if( log->cur_fd < 0 || pread(log->cur_fd, c, sizeof(c), 0) != sizeof(c) )
+        return;
+
+    if( c[0] != SLOG_CURSOR_MAGIC || c[n / sizeof(uint32_t)] != crc32c(0, c, n) )
+        return;
+
+    for( unsigned int i = 0; i < SLOG_CLASSES; i++ ) 
+    {
+        slog_class_t* k = &log->cls[i];
+        if( c[1 + 2 * i] >= k->first && c[1 + 2 * i] <= k->last ) {
+            k->head.seq = c[1 + 2 * i];
+            k->head.off = c[2 + 2 * i];
+        }
+    }
+}
+
+static
+void slog_store_cursor(slog_t* log)
+{
+    uint32_t c[2 + 2 * SLOG_CLASSES];
+    const size_t n = sizeof(c) - sizeof(uint32_t);
+
+    if( log->cur_fd < 0 )
+        return;
+
+    c[0] = SLOG_CURSOR_MAGIC;
+    for( unsigned int i = 0; i < SLOG_CLASSES; i++ ) {
+        c[1 + 2 * i] = log->cls[i].head.seq;
+        c[2 + 2 * i] = log->cls[i].head.off;
+    }
+
+    // a torn write only makes the replay start over from the oldest segments
+    c[n / sizeof(uint32_t)] = crc32c(0, c, n);
+    if( pwrite(log->cur_fd, c, sizeof(c), 0) == sizeof(c) )
+        fsync(log->cur_fd);
+}
+
+/**
+ * @brief Open the active segment of a class, cutting off a torn record, or
+ * start a new one
+ */
+static
+void slog_open_class(slog_t* log, unsigned int c)
+{
+    slog_class_t* k = &log->cls[c];
+    slog_seg_t* s = SLOG_SEG(log, c, k->last);
+    char name[SLOG_NAME_MAX];
+
+    k->fd = -1;
+    if( k->last == 0 || !s->present || s->sealed ) {
+        slog_start_segment(log, c, k->last + 1);
+        return;
+    }
+
+    slog_name(log, name, c, k->last, ".log");
+    k->fd = open(name, O_RDWR | O_APPEND);
+    if( k->fd < 0 )
+        return;
+
+    uint32_t end = slog_check_tail(log, k->fd);
+    if( end != s->bytes ) {
+        s->torn = ftruncate(k->fd, end) < 0;
+        log->total -= s->bytes - end;
+        s->bytes = end;
+    }
+}
+
+int slog_open(slog_t* log, const char* path, uint64_t budget, uint32_t seg_size)
+{
+    if( log == NULL || path == NULL || strlen(path) >= SLOG_PATH_MAX || seg_size < SLOG_BLOCK_SIZE )
+        return SLOG_ERR_PARAM;
+
+    memset(log, 0, sizeof(slog_t));
+    snprintf(log->path, sizeof(log->path), "%s", path);
+    log->budget = budget;
+    log->seg_size = seg_size;
+    log->rd.fd = -1;
+    log->cur_fd = -1;
+    for( unsigned int c = 0; c < SLOG_CLASSES; c++ )
+        log->cls[c].fd = -1;
+
+    int err = slog_scan(log);
+    if( err != SLOG_OK )
+        return err;
+
+    log->lock = os_mutex_create();
+    log->wake = os_sem_create(1, 0);
+    log->done = os_sem_create(1, 0);
+    if( log->lock == NULL || log->wake == NULL || log->done == NULL )
+        return SLOG_ERR_OS;
+
+    for( unsigned int c = 0; c < SLOG_CLASSES; c++ ) 
+    {
+        slog_open_class(log, c);
+        if( log->cls[c].fd < 0 )
+            return SLOG_ERR_FILE;
+    }
+
+    slog_load_cursor(log);
+
+    log->thread = os_thread_create("rlog_zip", slog_worker, log, SLOG_STACK_SIZE, SLOG_PRIORITY);
+    if( log->thread == NULL )
+        return SLOG_ERR_OS;
+
+    for( unsigned int c = 0; c < SLOG_CLASSES; c++ ) 
+    {
+        if( SLOG_SEG(log, c, log->cls[c].last)->bytes >= seg_size )
+            slog_seal(log, c);
+    }
+
+    // segments sealed before a restart may still need compressing
+    os_sem_signal(log->wake);
+    return SLOG_OK;
+}
+
+void slog_close(slog_t* log)
+{
+    if( log->thread ) {
+        log->terminate = true;
+        os_sem_signal(log->wake);
+        os_sem_wait(log->done, OS_WAIT_FOREVER);
+        log->thread = NULL;
+    }
+
+    for( unsigned int c = 0; c < SLOG_CLASSES; c++ ) 
+    {
+        if( log->cls[c].fd >= 0 ) {
+            fsync(log->cls[c].fd);
+            close(log->cls[c].fd);
+            log->cls[c].fd = -1;
+        }
+    }
+
+    if( log->rd.fd >= 0 ) {
+        close(log->rd.fd);
+        log->rd.fd = -1;
+    }
+
+    if( log->cur_fd >= 0 ) {
+        close(log->cur_fd);
+        log->cur_fd = -1;
+    }
+
+    if( log->lock ) {
+        os_mutex_destroy(log->lock);
+        log->lock = NULL;
+    }
+
+    if( log->wake ) {
+        os_sem_destroy(log->wake);
+        log->wake = NULL;
+    }
+
+    if( log->done ) {
+        os_sem_destroy(log->done);
+        log->done = NULL;
+    }
+}
+
+bool slog_put(slog_t* log, unsigned int cls, const void* rec, uint32_t len)
+{
+    if( cls >= SLOG_CLASSES )
+        cls = SLOG_CLASSES - 1;
+
+    slog_class_t* k = &log->cls[cls];
+    slog_seg_t* s = SLOG_SEG(log, cls, k->last);
+    slog_rec_t r;
+    uint32_t n = sizeof(slog_rec_t) + len;
+
+    if( len == 0 || n > SLOG_BLOCK_SIZE || k->fd < 0 )
+        return false;
+
+    // never append behind what is left of a failed write
+    if( s->torn ) {
+        if( ftruncate(k->fd, s->bytes) < 0 )
+            return false;
+        s->torn = false;
+    }
+
+    r.len = len;
+    r.crc = slog_record_crc(s->bytes, len, rec);
+    memcpy(log->rec, &r, sizeof(r));
+    memcpy(&log->rec[sizeof(r)], rec, len);
+
+    if( write(k->fd, log->rec, n) != n ) {
+        // storage full, don't leave half a record behind
+        s->torn = ftruncate(k->fd, s->bytes) < 0;
+        return false;
+    }
+
+    os_mutex_lock(log->lock);
+    s->bytes += n;
+    log->total += n;
+    while( log->total > log->budget && slog_evict_lowest(log) );
+    os_mutex_unlock(log->lock);
+
+    if( s->bytes >= log->seg_size )
+        slog_seal(log, cls);
+
+    return true;
+}
+
+void slog_sync(slog_t* log)
+{
+    for( unsigned int c = 0; c < SLOG_CLASSES; c++ ) 
+    {
+        if( log->cls[c].fd >= 0 )
+            fsync(log->cls[c].fd);
+    }
+}
+
+/**
+ * @brief Open a segment for replay
+ */
+static
+bool slog_rd_open(slog_t* log, unsigned int c, uint32_t seq)
+{
+    char name[SLOG_NAME_MAX];
+
+    if( log->rd.fd >= 0 )
+        close(log->rd.fd);
+
+    os_mutex_lock(log->lock);
+    slog_seg_t* s = SLOG_SEG(log, c, seq);
+    log->rd.fd = -1;
+    if( s->present ) {
+        slog_name(log, name, c, seq, s->compressed ? ".z" : ".log");
+        log->rd.fd = open(name, O_RDONLY);
+    }
+    log->rd.cls = c;
+    log->rd.seq = seq;
+    log->rd.compressed = s->compressed;
+    os_mutex_unlock(log->lock);
+
+    log->rd.file_off = 0;
+    log->rd.next_off = 0;
+    log->rd.block_off = 0;
+    log->rd.block_len = 0;
+    return log->rd.fd >= 0;
+}
+
+/**
+ * @brief Check if a class may have records past a position, without 
+ * touching the reader
+ */
+static
+bool slog_pending(slog_t* log, unsigned int c, const slog_pos_t* pos)
+{
+    slog_class_t* k = &log->cls[c];
+    return pos->seq < k->last || pos->off < SLOG_SEG(log, c, k->last)->bytes;
+}
+
+/**
+ * @brief Read the next record of a class
+ */
+static
+uint32_t slog_read_class(slog_t* log, unsigned int c, slog_pos_t* pos, const void** rec)
+{
+    slog_class_t* k = &log->cls[c];
+    const uint8_t* data;
+    slog_rec_t r;
+
+    if( slog_pos_before(pos, &k->head) )
+        *pos = k->head;
+
+    while( slog_pending(log, c, pos) )
+    {
+        int ret = 0;
+        bool open = log->rd.fd >= 0 && log->rd.cls == c && log->rd.seq == pos->seq;
+
+        if( open || slog_rd_open(log, c, pos->seq) )
+            ret = slog_reader_record(&log->rd, pos->off, &r, &data);
+
+        if( ret > 0 ) {
+            pos->off += sizeof(slog_rec_t) + r.len;
+            *rec = data;
+            return r.len;
+        }
+
+        if( ret < 0 )
+            log->corrupt++;
+
+        // records may still be appended to the active segment
+        if( pos->seq == k->last )
+            break;
+
+        // end of the segment or the rest of it can't be trusted
+        pos->seq++;
+        pos->off = 0;
+    }
+
+    return 0;
+}
+
+uint32_t slog_read(slog_t* log, slog_cursor_t* cur, const void** rec)
+{
+    for( unsigned int c = 0; c < SLOG_CLASSES; c++ ) 
+    {
+        uint32_t len = slog_read_class(log, c, &cur->at[c], rec);
+        if( len )
+            return len;
+    }
+
+    return 0;
+}
+
+void slog_consume(slog_t* log, const slog_cursor_t* cur)
+{
+    bool moved = false;
+
+    os_mutex_lock(log->lock);
+    for( unsigned int c = 0; c < SLOG_CLASSES; c++ ) 
+    {
+        slog_class_t* k = &log->cls[c];
+
+        if( !slog_pos_before(&k->head, &cur->at[c]) )
+            continue;
+
+        k->head = cur->at[c];
+        while( k->first < k->head.seq && k->first < k->last )
+            slog_evict(log, c);
+        moved = true;
+    }
+    os_mutex_unlock(log->lock);
+
+    if( moved )
+        slog_store_cursor(log);
+}
\ No newline at end of file
@@ -0,0 +1,395 @@
+/**
+ * @file slog.h
+ * @author edsp
+ * @brief Segmented backlog files with compressed sealed segments
+ * @version 1.0.0
+ * @date 2024-01-10
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * Records are kept in SLOG_CLASSES severity classes, each one a chain of 
+ * segments. They are appended to the active segment of their class, 
+ * "<path>.<class>.<seq>.log", as a \ref slog_rec_t header followed by the 
+ * data. Once it reaches the segment size it is sealed and a new one is 
+ * started. A background thread compresses sealed segments into 
+ * "<path>.<class>.<seq>.z": a sequence of 
+ * \ref slog_block_t blocks, each holding whole records compressed with lz.h.
+ * The uncompressed stream is kept byte for byte, so a position in a segment
+ * is the same before and after compression.
+ * 
+ * Once all segments take more than the byte budget, the oldest sealed 
+ * segment of the least important class is deleted, so low priority records
+ * go first and nothing is rewritten. Replay goes through the classes from 
+ * the most important one, reading compressed segments one block at a time.
+ * The position of the oldest record not yet delivered in each class is kept
+ * in "<path>.cur".
+ * 
+ * Only the POSIX file API is needed (open, pread, write, fsync, rename and
+ * readdir), so any VFS offering it will do.
+ */
+
+#ifndef _SLOG_H_
+#define _SLOG_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "lz.h"
+#include "../port/os/osal.h"
+
+#define SLOG_OK             0
+#define SLOG_ERR_PARAM      -1
+#define SLOG_ERR_FILE       -2
+#define SLOG_ERR_OS         -3
+
+#define SLOG_BLOCK_MAGIC    0x4B4C4253  /* "SBLK" */
+#define SLOG_CURSOR_MAGIC   0x52554353  /* "SCUR" */
+
+/**
+ * @brief Uncompressed size of a block, a record can't be larger than this
+ */
+#ifndef SLOG_BLOCK_SIZE
+    #define SLOG_BLOCK_SIZE     4096
+#endif
+
+/**
+ * @brief Maximum number of segments on storage, per class
+ */
+#ifndef SLOG_MAX_SEGMENTS
+    #define SLOG_MAX_SEGMENTS   256
+#endif
+
+/**
+ * @brief Number of severity classes, class 0 being the most important
+ */
+#ifndef SLOG_CLASSES
+    #define SLOG_CLASSES        3
+#endif
+
+/**
+ * @brief Maximum length of the base path
+ */
+#ifndef SLOG_PATH_MAX
+    #define SLOG_PATH_MAX       96
+#endif
+
+/**
+ * @brief Maximum length of a segment file name, see slog_segment_name()
+ */
+#define SLOG_NAME_MAX       (SLOG_PATH_MAX + 24)
+
+/**
+ * @brief Compression thread stack size and priority
+ */
+#ifndef SLOG_STACK_SIZE
+    #define SLOG_STACK_SIZE     4096
+#endif
+
+#ifndef SLOG_PRIORITY
+    #define SLOG_PRIORITY       1
+#endif
+
+/**
+ * @brief Record header
+ */
+typedef struct slog_rec_t
+{
+    /**
+     * @brief Record length in bytes
+     */
+    uint32_t len;
+
+    /**
+     * @brief CRC-32C of the record position, length and data
+     */
+    uint32_t crc;
+
+}slog_rec_t;
+
+/**
+ * @brief Compressed block header
+ */
+typedef struct slog_block_t
+{
+    uint32_t magic;
+
+    /**
+     * @brief Uncompressed length in bytes
+     */
+    uint32_t raw_len;
+
+    /**
+     * @brief Length in bytes of the data that follows. Equal to raw_len if
+     * the block did not compress and is stored as is.
+     */
+    uint32_t len;
+
+    /**
+     * @brief CRC-32C of the data that follows
+     */
+    uint32_t crc;
+
+}slog_block_t;
+
+/**
+ * @brief Position of a record: segment number and offset in the 
+ * uncompressed segment
+ */
+typedef struct slog_pos_t
+{
+    uint32_t seq;
+    uint32_t off;
+
+}slog_pos_t;
+
+/**
+ * @brief Replay cursor, a read position in every class
+ */
+typedef struct slog_cursor_t
+{
+    slog_pos_t at[SLOG_CLASSES];
+
+}slog_cursor_t;
+
+/**
+ * @brief Reader of a segment file, holds one decompressed block at a time
+ */
+typedef struct slog_reader_t
+{
+    int fd;
+    unsigned int cls;
+    uint32_t seq;
+    bool compressed;
+
+    /**
+     * @brief File offset and uncompressed offset of the next block
+     */
+    uint32_t file_off;
+    uint32_t next_off;
+
+    /**
+     * @brief Uncompressed offset and length of the block loaded
+     */
+    uint32_t block_off;
+    uint32_t block_len;
+    uint8_t block[SLOG_BLOCK_SIZE];
+    uint8_t zbuf[SLOG_BLOCK_SIZE];
+
+}slog_reader_t;
+
+/**
+ * @brief Segment on storage
+ */
+typedef struct slog_seg_t
+{
+    /**
+     * @brief Size of the file in bytes
+     */
+    uint32_t bytes;
+    bool present;
+    bool sealed;
+    bool compressed;
+
+    /**
+     * @brief A failed write left part of a record past bytes that could not
+     * be cut off yet. The next write cuts it off first, a restart cuts it 
+     * off when it opens the segment again
+     */
+    bool torn;
+
+}slog_seg_t;
+
+/**
+ * @brief Chain of segments of a class
+ */
+typedef struct slog_class_t
+{
+    /**
+     * @brief Oldest and active segment numbers, segments are kept in 
+     * seg[seq % SLOG_MAX_SEGMENTS]
+     */
+    uint32_t first;
+    uint32_t last;
+    slog_seg_t seg[SLOG_MAX_SEGMENTS];
+
+    /**
+     * @brief Active segment file
+     */
+    int fd;
+
+    /**
+     * @brief Oldest record not delivered yet
+     */
+    slog_pos_t head;
+
+}slog_class_t;
+
+/**
+ * @brief Segmented backlog handle
+ */
+typedef struct slog_t
+{
+    char path[SLOG_PATH_MAX];
+    uint64_t budget;
+    uint32_t seg_size;
+    slog_class_t cls[SLOG_CLASSES];
+
+    /**
+     * @brief Bytes taken by all segments
+     */
+    uint64_t total;
+
+    /**
+     * @brief Replay reader
+     */
+    slog_reader_t rd;
+
+    /**
+     * @brief File holding the head positions
+     */
+    int cur_fd;
+
+    /**
+     * @brief Number of corrupted records or blocks skipped
+     */
+    uint32_t corrupt;
+
+    /**
+     * @brief Compression thread
+     */
+    os_thread_t* thread;
+    os_sem_t* wake;
+    os_sem_t* done;
+    os_mutex_t* lock;
+    bool terminate;
+    uint8_t in[SLOG_BLOCK_SIZE];
+    uint8_t out[SLOG_BLOCK_SIZE];
+    uint16_t table[LZ_HASH_SIZE];
+
+    /**
+     * @brief Scratch to append a record with a single write
+     */
+    uint8_t rec[SLOG_BLOCK_SIZE];
+
+}slog_t;
+
+/**
+ * @brief Open a segmented backlog, picking up the segments left on storage
+ * and starting the compression thread. The tail of the active segment is 
+ * checked and a torn record is cut off.
+ * 
+ * @param log Backlog handle
+ * @param path Base path of the segment files, including the base filename
+ * @param budget Maximum number of bytes taken by all segments
+ * @param seg_size Size in bytes at which the active segment is sealed
+ * @return SLOG_OK if successful or a negative error code
+ */
+int slog_open(slog_t* log, const char* path, uint64_t budget, uint32_t seg_size);
+
+/**
+ * @brief Stop the compression thread and close the files
+ * 
+ * @param log Backlog handle
+ */
+void slog_close(slog_t* log);
+
+/**
+ * @brief Append a record, deleting segments of the least important classes
+ * if over budget
+ * 
+ * @param log Backlog handle
+ * @param cls Severity class, 0 is the most important
+ * @param rec Record data
+ * @param len Record length in bytes
+ * @return true If the record was appended
+ */
+bool slog_put(slog_t* log, unsigned int cls, const void* rec, uint32_t len);
+
+/**
+ * @brief Make the appended records durable
+ * 
+ * @param log Backlog handle
+ */
+void slog_sync(slog_t* log);
+
+/**
+ * @brief Read the next record of the most important class that has one and
+ * move the cursor past it
+ * 
+ * @param log Backlog handle
+ * @param[in,out] cur Replay cursor, start with a zeroed one to read from the
+ * oldest records not delivered yet
+ * @param[out] rec Pointer to the record data, valid until the next call
+ * @return Record length in bytes or 0 if there are no more records
+ */
+uint32_t slog_read(slog_t* log, slog_cursor_t* cur, const void** rec);
+
+/**
+ * @brief Remove all records before the cursor, deleting the segments left 
+ * behind, and store the position of each class
+ * 
+ * @param log Backlog handle
+ * @param cur Replay cursor returned by slog_read()
+ */
+void slog_consume(slog_t* log, const slog_cursor_t* cur);
+
+/**
+ * @brief Build the file name of a segment
+ * 
+ * @param[out] name Buffer of SLOG_NAME_MAX bytes
+ * @param path Base path of the segment files
+ * @param cls Severity class
+ * @param seq Segment number
+ * @param ext ".log" for an active or sealed segment, ".z" for a compressed one
+ */
+void slog_segment_name(char* name, const char* path, unsigned int cls, uint32_t seq, const char* ext);
+
+/**
+ * @brief Parse the file name of a segment
+ * 
+ * @param name File name, without the directory
+ * @param base Base filename of the segment files
+ * @param[out] cls Severity class
+ * @param[out] seq Segment number
+ * @return Extension after the segment number or NULL if it is not a segment
+ */
+const char* slog_segment_parse(const char* name, const char* base, unsigned int* cls, uint32_t* seq);
+
+/**
+ * @brief CRC of a record, the offset is included so a record is only valid
+ * where it was written
+ * 
+ * @param off Offset of the record in the uncompressed segment
+ * @param len Record length in bytes
+ * @param data Record data
+ * @return CRC-32C to store in the record header
+ */
+uint32_t slog_record_crc(uint32_t off, uint32_t len, const void* data);
+
+/**
+ * @brief Read the record at an offset of the uncompressed segment open in 
+ * a reader. Used by the replay and by offline readers.
+ * 
+ * @param rd Reader, fd and compressed set when the segment is opened and the
+ * offsets cleared
+ * @param off Offset of the record in the uncompressed segment
+ * @param[out] r Record header
+ * @param[out] data Record data, valid until the next call
+ * @return 1 if read, 0 at the end of the segment or -1 if corrupted
+ */
+int slog_reader_record(slog_reader_t* rd, uint32_t off, slog_rec_t* r, const uint8_t** data);
+
+#endif //_SLOG_H_
\ No newline at end of file
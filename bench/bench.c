@@ -0,0 +1,422 @@
+/**
+ * @file bench.c
+ * @author edsp
+ * @brief Producer side benchmark of rlog() and rlogf(). Messages go to a null
+ * interface, so what is measured is the cost of the calls for the threads
+ * that log. Linux only, on top of the POSIX port.
+ * @version 1.0.0
+ * @date 2024-01-10
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *
+ * Build one binary per queue size and run them all, see bench/Makefile:
+ *
+ *     make -C bench run
+ *
+ * Usage: bench [-n calls] [-t threads] [-s sizes] [-f path]
+ *
+ *     -n      Timed calls per producer thread and case, default 100000
+ *     -t      Maximum number of producer threads, default the number of
+ *             CPUs. Each case runs with 1, 2, 4... threads up to it.
+ *     -s      Comma separated message sizes in bytes, default 16,64,200
+ *     -f      Backup file, default /tmp/rlog_bench
+ *
+ * Every case runs in two modes, reported as separate series:
+ *
+ *     paced   Producers log in bursts of half the RLOG_INFO class between
+ *             them and the queue is drained between bursts, out of the timed
+ *             part. The calls take the plain enqueue path, overflowed and 
+ *             spilled stay at 0 unless there are more threads than half the
+ *             class.
+ *     flood   Producers log as fast as they can. Once the rlog thread falls
+ *             behind most calls overwrite a queued message or move it to the
+ *             backup file, so this measures the overflow and spill paths.
+ *
+ * The spill path writes to the backup file given with -f, so the flood 
+ * figures depend on the storage behind it. Point it to a tmpfs, i.e. 
+ * /dev/shm, to leave the disk out.
+ *
+ * Prints one JSON object per line and case, i.e.
+ *
+ *     {"api":"rlogf","mode":"flood","queue":256,"shards":1,"threads":2,
+ *      "size":64,"calls":200000,"ops_per_sec":2412201,"p50_ns":321,
+ *      "p99_ns":1210,"p999_ns":8954,"max_ns":61230,"overflowed":0,
+ *      "spilled":1534}
+ *
+ * Latencies include the cost of reading the clock, some tens of nanoseconds.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "../rlog.h"
+
+/**
+ * @brief Same defaults as rlog.c, the Makefile sets them
+ */
+#ifndef RLOG_QUEUE_SIZE
+    #define RLOG_QUEUE_SIZE 10
+#endif
+
+#ifndef RLOG_QUEUE_SIZE_INFO
+    #define RLOG_QUEUE_SIZE_INFO \
+        ((RLOG_QUEUE_SIZE) / 3 > 0 ? (RLOG_QUEUE_SIZE) / 3 : 1)
+#endif
+
+#ifndef RLOG_QUEUE_SHARDS
+    #define RLOG_QUEUE_SHARDS 1
+#endif
+
+#define BENCH_CALLS     100000
+#define BENCH_WARMUP    1000
+#define BENCH_MAX_SIZES 16
+
+/**
+ * @brief Time to wait for the rlog thread to empty the queue between cases
+ * and bursts
+ */
+#define BENCH_DRAIN_MS  5000
+
+/**
+ * @brief Messages per burst of the paced mode, for all threads together.
+ * Stays below the spill watermark of the class.
+ */
+#define BENCH_BURST     (RLOG_QUEUE_SIZE_INFO / 2)
+
+typedef enum {
+
+    BENCH_RLOG = 0,
+    BENCH_RLOGF = 1,
+
+}BENCH_API;
+
+typedef enum {
+
+    BENCH_PACED = 0,
+    BENCH_FLOOD = 1,
+
+}BENCH_MODE;
+
+/**
+ * @brief Producer thread control block
+ */
+typedef struct bench_thread_t
+{
+    pthread_t           handle;
+    BENCH_API           api;
+    unsigned int        calls;
+
+    /**
+     * @brief Calls between two waits on the barriers, all of them in flood 
+     * mode
+     */
+    unsigned int        burst;
+    const char*         msg;
+
+    /**
+     * @brief Latency of each timed call in nanoseconds
+     */
+    uint32_t*           lat;
+
+    /**
+     * @brief The main thread releases the producers with go once the queue
+     * is empty, and they wait on done after each burst
+     */
+    pthread_barrier_t*  go;
+    pthread_barrier_t*  done;
+
+}bench_thread_t;
+
+static bool null_init(void* arg)
+{
+    return true;
+}
+
+static bool null_poll(void* arg)
+{
+    return true;
+}
+
+static bool null_send(void* arg, const void* buf, int len)
+{
+    return true;
+}
+
+/**
+ * @brief Interface that takes every message and does nothing with it
+ */
+static rlog_ifc_t null_ifc = {
+    .init = null_init,
+    .poll = null_poll,
+    .send = null_send,
+    .notify = true,
+};
+
+static inline
+uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline
+void bench_call(BENCH_API api, const char* msg, unsigned int i)
+{
+    if( api == BENCH_RLOG )
+        rlog(RLOG_INFO, msg);
+    else
+        rlogf(RLOG_INFO, "%s %u", msg, i);
+}
+
+static
+void* producer(void* arg)
+{
+    bench_thread_t* t = (bench_thread_t*) arg;
+
+    for( unsigned int i = 0; i < BENCH_WARMUP; i++ )
+        bench_call(t->api, t->msg, i);
+
+    pthread_barrier_wait(t->done);
+
+    for( unsigned int i = 0; i < t->calls; )
+    {
+        pthread_barrier_wait(t->go);
+
+        for( unsigned int n = 0; n < t->burst && i < t->calls; n++, i++ )
+        {
+            uint64_t t0 = now_ns();
+            bench_call(t->api, t->msg, i);
+            uint64_t dt = now_ns() - t0;
+            t->lat[i] = (dt > UINT32_MAX) ? UINT32_MAX : (uint32_t) dt;
+        }
+
+        pthread_barrier_wait(t->done);
+    }
+
+    return NULL;
+}
+
+static
+int cmp_u32(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*) a;
+    uint32_t y = *(const uint32_t*) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Wait for the rlog thread to empty the queue, so a case does not pay
+ * for the messages of the previous one
+ */
+static
+void drain(void)
+{
+    rlog_stats_t stats;
+    uint64_t deadline = now_ns() + (uint64_t) BENCH_DRAIN_MS * 1000000;
+
+    // polled often, the paced mode drains the queue after every burst
+    while( now_ns() < deadline )
+    {
+        if( rlog_get_stats(&stats) && stats.queue_cnt == 0 )
+            return;
+        usleep(20);
+    }
+}
+
+/**
+ * @brief Run one case and print its results
+ *
+ * @return false If the buffers could not be allocated
+ */
+static
+bool bench_case(FILE* out, BENCH_API api, BENCH_MODE mode, unsigned int nthreads, unsigned int size, unsigned int calls)
+{
+    bench_thread_t* th = calloc(nthreads, sizeof(bench_thread_t));
+    uint32_t* lat = malloc((size_t) nthreads * calls * sizeof(uint32_t));
+    char* msg = malloc(size + 1);
+    pthread_barrier_t go, done;
+    rlog_stats_t before, after;
+    bool ok = false;
+
+    if( !th || !lat || !msg )
+        goto done;
+
+    memset(msg, 'x', size);
+    msg[size] = '\0';
+
+    unsigned int burst = calls;
+    if( mode == BENCH_PACED )
+        burst = (BENCH_BURST / nthreads) ? BENCH_BURST / nthreads : 1;
+
+    drain();
+    pthread_barrier_init(&go, NULL, nthreads + 1);
+    pthread_barrier_init(&done, NULL, nthreads + 1);
+
+    for( unsigned int i = 0; i < nthreads; i++ )
+    {
+        th[i].api = api;
+        th[i].calls = calls;
+        th[i].burst = burst;
+        th[i].msg = msg;
+        th[i].lat = &lat[(size_t) i * calls];
+        th[i].go = &go;
+        th[i].done = &done;
+
+        // the threads already created would wait on the barrier forever
+        if( pthread_create(&th[i].handle, NULL, producer, &th[i]) != 0 ) {
+            fprintf(stderr, "bench: failed to create producer thread\n");
+            exit(1);
+        }
+    }
+
+    // the warm up calls are done once past the first wait, only the bursts
+    // are timed, not the draining between them
+    pthread_barrier_wait(&done);
+    drain();
+    rlog_get_stats(&before);
+    uint64_t elapsed = 0;
+
+    for( unsigned int i = 0; i < calls; i += burst )
+    {
+        uint64_t t0 = now_ns();
+        pthread_barrier_wait(&go);
+        pthread_barrier_wait(&done);
+        elapsed += now_ns() - t0;
+
+        if( mode == BENCH_PACED )
+            drain();
+    }
+
+    for( unsigned int i = 0; i < nthreads; i++ )
+        pthread_join(th[i].handle, NULL);
+
+    pthread_barrier_destroy(&go);
+    pthread_barrier_destroy(&done);
+    rlog_get_stats(&after);
+
+    size_t total = (size_t) nthreads * calls;
+    qsort(lat, total, sizeof(uint32_t), cmp_u32);
+
+    fprintf(out, "{\"api\":\"%s\",\"mode\":\"%s\",\"queue\":%d,\"shards\":%d,\"threads\":%u,"
+        "\"size\":%u,\"calls\":%zu,\"ops_per_sec\":%.0f,\"p50_ns\":%u,\"p99_ns\":%u,"
+        "\"p999_ns\":%u,\"max_ns\":%u,\"overflowed\":%u,\"spilled\":%u}\n",
+        api == BENCH_RLOG ? "rlog" : "rlogf", mode == BENCH_PACED ? "paced" : "flood",
+        RLOG_QUEUE_SIZE, RLOG_QUEUE_SHARDS, nthreads, size,
+        total, total * 1e9 / (elapsed ? elapsed : 1),
+        lat[total / 2], lat[total * 99 / 100], lat[total * 999 / 1000], lat[total - 1],
+        after.overflowed - before.overflowed, after.spilled - before.spilled);
+    fflush(out);
+    ok = true;
+
+done:
+    free(th);
+    free(lat);
+    free(msg);
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned int calls = BENCH_CALLS;
+    unsigned int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int sizes[BENCH_MAX_SIZES] = { 16, 64, 200 };
+    unsigned int nsizes = 3;
+    const char* path = "/tmp/rlog_bench";
+    int opt;
+
+    while( (opt = getopt(argc, argv, "n:t:s:f:")) != -1 )
+    {
+        switch( opt )
+        {
+            case 'n':
+            calls = strtoul(optarg, NULL, 0);
+            break;
+            case 't':
+            max_threads = strtoul(optarg, NULL, 0);
+            break;
+            case 's':
+            nsizes = 0;
+            for( char* s = strtok(optarg, ","); s && nsizes < BENCH_MAX_SIZES; s = strtok(NULL, ",") )
+                sizes[nsizes++] = strtoul(s, NULL, 0);
+            break;
+            case 'f':
+            path = optarg;
+            break;
+            default:
+            fprintf(stderr, "Usage: %s [-n calls] [-t threads] [-s sizes] [-f path]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if( calls < 1 || max_threads < 1 || nsizes < 1 ) {
+        fprintf(stderr, "bench: invalid parameter\n");
+        return 1;
+    }
+
+    // the flood mode spills to this file, its cost depends on the storage
+    rlog_cfg_t cfg = {
+        .name = "bench",
+        .priority = 1,
+        .filepath = path,
+        .nlogs = 1000,
+        .format = RLOG_RFC5424,
+        .level = RLOG_DEBUG,
+    };
+
+    if( !rlog_init(cfg) || !rlog_install_interface(null_ifc) ) {
+        fprintf(stderr, "bench: failed to start rlog\n");
+        return 1;
+    }
+
+    for( int mode = BENCH_PACED; mode <= BENCH_FLOOD; mode++ )
+    {
+        for( int api = BENCH_RLOG; api <= BENCH_RLOGF; api++ )
+        {
+            for( unsigned int s = 0; s < nsizes; s++ )
+            {
+                // longer messages are truncated to RLOG_MAX_SIZE_CHAR anyway
+                unsigned int size = sizes[s];
+                if( size > RLOG_MAX_SIZE_CHAR - 1 )
+                    size = RLOG_MAX_SIZE_CHAR - 1;
+
+                for( unsigned int t = 1; ; t *= 2 )
+                {
+                    if( t > max_threads )
+                        t = max_threads;
+
+                    if( !bench_case(stdout, api, mode, t, size, calls) ) {
+                        rlog_shutdown(1000);
+                        return 1;
+                    }
+
+                    if( t == max_threads )
+                        break;
+                }
+            }
+        }
+    }
+
+    rlog_shutdown(1000);
+    unlink(path);
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,414 @@
+/**
+ * @file resolver.c
+ * @author edsp
+ * @brief Asynchronous host name resolution for remote interfaces. A single
+ * thread serves all registered resolvers using the reentrant getaddrinfo().
+ * @version 1.0.0
+ * @date 2024-01-10
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * 
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "resolver.h"
+#include "../../rlog.h"
+
+#ifndef _RLOG_RESOLVER_DBG_
+    #define _RLOG_RESOLVER_DBG_ 0
+#endif
+
+#if _RLOG_RESOLVER_DBG_
+#include <stdio.h>
+#define DBG_PRINTF(...) printf(__VA_ARGS__)
+#else
+#define DBG_PRINTF(...)
+#endif
+
+#define SEC_TO_US(s) ((uint64_t)(s) * 1000 * 1000)
+
+/**
+ * @brief Period in miliseconds the resolver thread checks for expired entries
+ */
+#define RESOLVER_PERIOD 1000
+
+/**
+ * @brief List of registered resolvers
+ */
+static rlog_resolver_t* resolvers = NULL;
+
+/**
+ * @brief Kernel objects state: 0 not created, 1 being created, 2 ready. They
+ * are created once and kept for the life of the program.
+ */
+static atomic_int objects = 0;
+
+/**
+ * @brief Protects the list and the state of every registered resolver
+ */
+static os_mutex_t* resolver_lock = NULL;
+
+/**
+ * @brief Wakes the resolver thread when a resolution is requested
+ */
+static os_sem_t* resolver_wakeup = NULL;
+
+/**
+ * @brief Signaled by the resolver thread once it has terminated
+ */
+static os_sem_t* resolver_done = NULL;
+
+/**
+ * @brief Resolver being served by the resolver thread right now
+ */
+static rlog_resolver_t* busy = NULL;
+
+/**
+ * @brief The resolver thread runs while there are registered resolvers, so
+ * it is stopped when the interfaces are deinitialized by rlog_shutdown()
+ */
+static os_thread_t* thread_handle = NULL;
+static atomic_bool terminate = false;
+
+/**
+ * @brief The last resolver was deinitialized and the thread is terminating
+ */
+static bool stopping = false;
+
+static void resolver_thread(void* arg);
+
+/**
+ * @brief Create the kernel objects on first use, whatever the number of 
+ * threads calling it at the same time
+ */
+static
+bool resolver_objects(void)
+{
+    int none = 0;
+
+    if( !atomic_compare_exchange_strong(&objects, &none, 1) )
+    {
+        // someone else is creating them
+        while( atomic_load(&objects) == 1 )
+            os_sleep_us(1000);
+        return atomic_load(&objects) == 2;
+    }
+
+    resolver_lock = os_mutex_create();
+    resolver_wakeup = os_sem_create(1, 0);
+    resolver_done = os_sem_create(1, 0);
+
+    if( resolver_lock && resolver_wakeup && resolver_done ) {
+        atomic_store(&objects, 2);
+        return true;
+    }
+
+    if( resolver_lock )
+        os_mutex_destroy(resolver_lock);
+    if( resolver_wakeup )
+        os_sem_destroy(resolver_wakeup);
+    if( resolver_done )
+        os_sem_destroy(resolver_done);
+    resolver_lock = NULL;
+    resolver_wakeup = NULL;
+    resolver_done = NULL;
+    atomic_store(&objects, 0);
+    return false;
+}
+
+/**
+ * @brief Start the resolver thread if it is not running. Must be called with
+ * resolver_lock held.
+ */
+static
+bool resolver_start(void)
+{
+    // the previous thread is still on its way out
+    while( stopping ) 
+    {
+        os_mutex_unlock(resolver_lock);
+        os_sleep_us(10 * 1000);
+        os_mutex_lock(resolver_lock);
+    }
+
+    if( thread_handle )
+        return true;
+
+    terminate = false;
+    thread_handle = os_thread_create("rlog_dns", resolver_thread, NULL, RLOG_RESOLVER_STACK_SIZE, RLOG_RESOLVER_PRIORITY);
+    return ( thread_handle != NULL );
+}
+
+bool rlog_resolver_init(rlog_resolver_t* r, const char* host, uint16_t port)
+{
+    struct in_addr ip;
+
+    if( r == NULL || host == NULL )
+        return false;
+
+    memset(r, 0, sizeof(rlog_resolver_t));
+    strncpy(r->host, host, sizeof(r->host) - 1);
+    r->port = port;
+
+    // no need to bother the resolver thread with numeric addresses
+    if( inet_pton(AF_INET, host, &ip) == 1 ) 
+    {
+        r->addr[0].sin_family = AF_INET;
+        r->addr[0].sin_addr = ip;
+        r->addr[0].sin_port = htons(port);
+        r->n = 1;
+        r->numeric = true;
+        return true;
+    }
+
+    if( !resolver_objects() ) {
+        DBG_PRINTF("[RLOG] rlog_resolver_init failed to create kernel objects\n");
+        return false;
+    }
+
+    os_mutex_lock(resolver_lock);
+    if( !resolver_start() ) {
+        os_mutex_unlock(resolver_lock);
+        DBG_PRINTF("[RLOG] rlog_resolver_init failed to start resolver thread\n");
+        return false;
+    }
+    r->registered = true;
+    r->next = resolvers;
+    resolvers = r;
+    os_mutex_unlock(resolver_lock);
+
+    os_sem_signal(resolver_wakeup);
+    return true;
+}
+
+void rlog_resolver_deinit(rlog_resolver_t* r)
+{
+    if( !r->registered )
+        return;
+
+    os_mutex_lock(resolver_lock);
+    for( rlog_resolver_t** p = &resolvers; *p; p = &(*p)->next )
+    {
+        if( *p == r ) {
+            *p = r->next;
+            break;
+        }
+    }
+    r->registered = false;
+
+    // the resolver thread may still hold a reference to it
+    while( busy == r ) 
+    {
+        os_mutex_unlock(resolver_lock);
+        os_sleep_us(10 * 1000);
+        os_mutex_lock(resolver_lock);
+    }
+
+    // nothing left to resolve, stop the thread
+    bool stop = ( resolvers == NULL && thread_handle != NULL && !stopping );
+    if( stop ) {
+        terminate = true;
+        stopping = true;
+        thread_handle = NULL;
+    }
+    os_mutex_unlock(resolver_lock);
+
+    if( stop ) 
+    {
+        os_sem_signal(resolver_wakeup);
+        os_sem_wait(resolver_done, OS_WAIT_FOREVER);
+
+        os_mutex_lock(resolver_lock);
+        stopping = false;
+        os_mutex_unlock(resolver_lock);
+    }
+}
+
+bool rlog_resolver_get(rlog_resolver_t* r, struct sockaddr_in* addr)
+{
+    bool ok = false;
+
+    if( r->numeric ) {
+        *addr = r->addr[0];
+        return true;
+    }
+
+    os_mutex_lock(resolver_lock);
+    if( r->n ) {
+        *addr = r->addr[r->idx];
+        ok = true;
+    }
+    os_mutex_unlock(resolver_lock);
+
+    return ok;
+}
+
+void rlog_resolver_failed(rlog_resolver_t* r)
+{
+    bool wakeup = false;
+
+    if( r->numeric )
+        return;
+
+    os_mutex_lock(resolver_lock);
+    if( r->n ) 
+    {
+        r->idx = (r->idx + 1) % r->n;
+        r->failures++;
+
+        // every cached address failed, maybe the name points somewhere else now
+        if( r->failures >= r->n ) {
+            r->failures = 0;
+            r->expires = 0;
+            wakeup = true;
+        }
+    }
+    os_mutex_unlock(resolver_lock);
+
+    if( wakeup )
+        os_sem_signal(resolver_wakeup);
+}
+
+/**
+ * @brief Resolve a host name. May block for as long as the DNS takes.
+ * 
+ * @param host Host name
+ * @param port Port number
+ * @param[out] addr Array to hold the addresses
+ * @return Number of addresses found
+ */
+static
+unsigned int resolve(const char* host, uint16_t port, struct sockaddr_in* addr)
+{
+    struct addrinfo hints = { 0 };
+    struct addrinfo* res = NULL;
+    unsigned int n = 0;
+
+    hints.ai_family = AF_INET;
+
+    int err = getaddrinfo(host, NULL, &hints, &res);
+    if( err != 0 || res == NULL ) {
+        DBG_PRINTF("[RLOG] resolve::getaddrinfo(%s) failed, error: %d \n", host, err);
+        return 0;
+    }
+
+    for( struct addrinfo* p = res; p && n < RLOG_RESOLVER_MAX_ADDR; p = p->ai_next )
+    {
+        if( p->ai_family != AF_INET )
+            continue;
+
+        struct in_addr ip = ((struct sockaddr_in*) p->ai_addr)->sin_addr;
+
+        // getaddrinfo returns one entry per socket type, skip repeated addresses
+        bool repeated = false;
+        for( unsigned int i = 0; i < n; i++ ) {
+            if( addr[i].sin_addr.s_addr == ip.s_addr )
+                repeated = true;
+        }
+
+        if( repeated )
+            continue;
+
+        memset(&addr[n], 0, sizeof(struct sockaddr_in));
+        addr[n].sin_family = AF_INET;
+        addr[n].sin_addr = ip;
+        addr[n].sin_port = htons(port);
+        n++;
+    }
+
+    freeaddrinfo(res);
+    return n;
+}
+
+static
+void resolver_thread(void* arg)
+{
+    char host[sizeof(((rlog_resolver_t*)0)->host)];
+    struct sockaddr_in addr[RLOG_RESOLVER_MAX_ADDR];
+    rlog_resolver_t* r;
+    uint16_t port;
+    unsigned int n;
+
+    while( !terminate )
+    {
+        os_sem_wait(resolver_wakeup, RESOLVER_PERIOD);
+
+        // serve one expired entry at a time, DNS is done without holding the lock
+        do {
+            uint64_t now = os_get_time_us();
+
+            os_mutex_lock(resolver_lock);
+            for( r = resolvers; r; r = r->next ) {
+                if( r->expires <= now )
+                    break;
+            }
+
+            if( r ) {
+                busy = r;
+                port = r->port;
+                strcpy(host, r->host);
+            }
+            os_mutex_unlock(resolver_lock);
+
+            if( r == NULL )
+                break;
+
+            n = resolve(host, port, addr);
+
+            os_mutex_lock(resolver_lock);
+            bool first = (n && r->n == 0);
+            if( n ) 
+            {
+                // keep using the same address if it is still in the list
+                unsigned int idx = 0;
+                for( unsigned int i = 0; i < n && r->n; i++ ) {
+                    if( addr[i].sin_addr.s_addr == r->addr[r->idx].sin_addr.s_addr )
+                        idx = i;
+                }
+
+                memcpy(r->addr, addr, n * sizeof(struct sockaddr_in));
+                r->n = n;
+                r->idx = idx;
+                r->failures = 0;
+                r->expires = os_get_time_us() + SEC_TO_US(RLOG_RESOLVER_TTL_SEC);
+            } 
+            else 
+            {
+                // keep the old addresses, they may still work
+                r->expires = os_get_time_us() + SEC_TO_US(RLOG_RESOLVER_RETRY_SEC);
+            }
+            os_mutex_unlock(resolver_lock);
+
+            // the interface has somewhere to send to now. Still busy, so its
+            // deinit, and rlog_shutdown() with it, waits for this to return
+            if( first )
+                rlog_ifc_changed();
+
+            os_mutex_lock(resolver_lock);
+            busy = NULL;
+            os_mutex_unlock(resolver_lock);
+
+        } while( 1 );
+    }
+
+    os_sem_signal(resolver_done);
+    os_thread_destroy(NULL);
+}
\ No newline at end of file
@@ -0,0 +1,113 @@
+#ifndef _RLOG_RESOLVER_H_
+#define _RLOG_RESOLVER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "../../port/os/osal.h"
+
+/**
+ * @brief Maximum number of addresses cached per host name
+ */
+#ifndef RLOG_RESOLVER_MAX_ADDR
+    #define RLOG_RESOLVER_MAX_ADDR  4
+#endif
+
+/**
+ * @brief Period in seconds after which a host name is resolved again
+ */
+#ifndef RLOG_RESOLVER_TTL_SEC
+    #define RLOG_RESOLVER_TTL_SEC  300
+#endif
+
+/**
+ * @brief Period in seconds between attempts while a host name can't be resolved
+ */
+#ifndef RLOG_RESOLVER_RETRY_SEC
+    #define RLOG_RESOLVER_RETRY_SEC  5
+#endif
+
+/**
+ * @brief Resolver thread stack size
+ */
+#ifndef RLOG_RESOLVER_STACK_SIZE
+    #define RLOG_RESOLVER_STACK_SIZE  4096
+#endif
+
+/**
+ * @brief Resolver thread priority
+ */
+#ifndef RLOG_RESOLVER_PRIORITY
+    #define RLOG_RESOLVER_PRIORITY  1
+#endif
+
+/**
+ * @brief Address cache of a remote host. Host names are resolved by a 
+ * background thread, so interfaces never block on DNS. All addresses returned
+ * are cached and rotated through whenever the one in use fails, and the cache
+ * is refreshed every RLOG_RESOLVER_TTL_SEC or once every cached address has 
+ * failed. Numeric addresses are used as they are and never resolved.
+ */
+typedef struct rlog_resolver_t
+{
+    char host[100];
+    uint16_t port;
+
+    struct sockaddr_in addr[RLOG_RESOLVER_MAX_ADDR];
+    unsigned int n;
+    unsigned int idx;
+    unsigned int failures;
+
+    /**
+     * @brief Time of the next resolution in microseconds, see os_get_time_us()
+     */
+    uint64_t expires;
+
+    bool numeric;
+    bool registered;
+    struct rlog_resolver_t* next;
+
+}rlog_resolver_t;
+
+/**
+ * @brief Initialize the cache and request the first resolution of the host name.
+ * Does not block.
+ * 
+ * @param r Resolver instance
+ * @param host Host name or numeric IP address
+ * @param port Port number
+ * @return true If successful
+ * @return false If the host is invalid or failed to start the resolver thread.
+ * The thread is started with the first instance.
+ */
+bool rlog_resolver_init(rlog_resolver_t* r, const char* host, uint16_t port);
+
+/**
+ * @brief Stop resolving the host name. Waits if the instance is being resolved
+ * at the moment. The resolver thread is stopped with the last instance.
+ * 
+ * @param r Resolver instance
+ */
+void rlog_resolver_deinit(rlog_resolver_t* r);
+
+/**
+ * @brief Get the address currently in use. Does not block.
+ * 
+ * @param r Resolver instance
+ * @param[out] addr Address and port to connect or send to
+ * @return true If an address is available
+ * @return false If the host name has not been resolved (yet)
+ */
+bool rlog_resolver_get(rlog_resolver_t* r, struct sockaddr_in* addr);
+
+/**
+ * @brief Report that connecting or sending to the current address failed. 
+ * The next cached address will be used, and the host name is resolved 
+ * again once all cached addresses have failed.
+ * 
+ * @param r Resolver instance
+ */
+void rlog_resolver_failed(rlog_resolver_t* r);
+
+#endif //_RLOG_RESOLVER_H_
\ No newline at end of file
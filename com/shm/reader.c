@@ -0,0 +1,221 @@
+/**
+ * @file reader.c
+ * @author edsp
+ * @brief Reader library for the shared memory ring interface. Readers never 
+ * modify the ring data, the mapping is writable only to register as a waiter 
+ * in the shared header. Linux only.
+ * @version 1.0.0
+ * @date 2024-01-10
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * 
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "reader.h"
+#include "ring.h"
+
+#define HDR(r) ((rlog_shm_hdr_t*) (r)->hdr)
+
+bool rlog_shm_reader_open(rlog_shm_reader_t* r, const char* path, bool from_oldest)
+{
+    struct stat st;
+
+    memset(r, 0, sizeof(rlog_shm_reader_t));
+    r->fd = open(path, O_RDWR);
+    if( r->fd < 0 )
+        return false;
+
+    if( fstat(r->fd, &st) < 0 || st.st_size <= RLOG_SHM_DATA_OFFSET )
+        goto fail;
+
+    r->map_size = st.st_size;
+    r->map = mmap(NULL, r->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, 0);
+    if( r->map == MAP_FAILED ) {
+        r->map = NULL;
+        goto fail;
+    }
+
+    r->hdr = r->map;
+    if( HDR(r)->magic != RLOG_SHM_MAGIC || HDR(r)->version != RLOG_SHM_VERSION )
+        goto fail;
+
+    atomic_thread_fence(memory_order_acquire);
+    r->size = HDR(r)->size;
+    if( r->size + RLOG_SHM_DATA_OFFSET > r->map_size )
+        goto fail;
+
+    r->data = (const uint8_t*) r->map + RLOG_SHM_DATA_OFFSET;
+
+    if( from_oldest )
+        r->pos = atomic_load_explicit(&HDR(r)->oldest, memory_order_acquire);
+    else
+        r->pos = atomic_load_explicit(&HDR(r)->write, memory_order_acquire);
+
+    r->next = r->pos;
+    r->generation = atomic_load(&HDR(r)->generation);
+    return true;
+
+fail:
+    rlog_shm_reader_close(r);
+    return false;
+}
+
+void rlog_shm_reader_close(rlog_shm_reader_t* r)
+{
+    if( r->map ) {
+        munmap(r->map, r->map_size);
+        r->map = NULL;
+    }
+
+    if( r->fd >= 0 ) {
+        close(r->fd);
+        r->fd = -1;
+    }
+}
+
+/**
+ * @brief Check if the record at the reader position is still intact. If not,
+ * jump to the oldest intact record.
+ * 
+ * @return true If the position is still valid
+ */
+static
+bool reader_check(rlog_shm_reader_t* r)
+{
+    // every read of ring data must be done before looking at the oldest position
+    atomic_thread_fence(memory_order_acquire);
+    uint64_t oldest = atomic_load_explicit(&HDR(r)->oldest, memory_order_relaxed);
+
+    if( r->pos < oldest ) 
+    {
+        r->overruns++;
+        r->pos = oldest;
+        r->next = oldest;
+        return false;
+    }
+
+    return true;
+}
+
+int rlog_shm_reader_peek(rlog_shm_reader_t* r, const char** msg)
+{
+    while( 1 )
+    {
+        uint64_t write = atomic_load_explicit(&HDR(r)->write, memory_order_acquire);
+
+        if( !reader_check(r) )
+            continue;
+
+        if( r->pos >= write )
+            return 0;
+
+        uint64_t off = r->pos % r->size;
+        uint32_t len = ((const rlog_shm_rec_t*) &r->data[off])->len;
+
+        if( !reader_check(r) )
+            continue;
+
+        if( len == RLOG_SHM_PAD ) {
+            r->pos += r->size - off;
+            continue;
+        }
+
+        if( RLOG_SHM_ALIGN(sizeof(rlog_shm_rec_t) + len) > r->size - off ) {
+            // can't happen unless the ring is corrupted, start over from the newest record
+            r->overruns++;
+            r->pos = write;
+            continue;
+        }
+
+        r->next = r->pos + RLOG_SHM_ALIGN(sizeof(rlog_shm_rec_t) + len);
+        *msg = (const char*) &r->data[off + sizeof(rlog_shm_rec_t)];
+        return (int) len;
+    }
+}
+
+bool rlog_shm_reader_release(rlog_shm_reader_t* r)
+{
+    if( !reader_check(r) )
+        return false;
+
+    r->pos = r->next;
+    return true;
+}
+
+int rlog_shm_reader_read(rlog_shm_reader_t* r, char* buf, int size)
+{
+    const char* msg;
+    int len;
+
+    if( size < 1 )
+        return 0;
+
+    do {
+        len = rlog_shm_reader_peek(r, &msg);
+        if( len == 0 )
+            return 0;
+
+        if( len > size - 1 )
+            len = size - 1;
+
+        memcpy(buf, msg, len);
+
+    } while( !rlog_shm_reader_release(r) );
+
+    buf[len] = '\0';
+    return len;
+}
+
+bool rlog_shm_reader_restarted(rlog_shm_reader_t* r, bool* valid)
+{
+    uint32_t generation = atomic_load(&HDR(r)->generation);
+
+    if( valid )
+        *valid = ( HDR(r)->magic == RLOG_SHM_MAGIC );
+
+    if( generation == r->generation )
+        return false;
+
+    r->generation = generation;
+    return true;
+}
+
+bool rlog_shm_reader_wait(rlog_shm_reader_t* r, uint32_t time)
+{
+    struct timespec ts = { .tv_sec = time / 1000, .tv_nsec = (time % 1000) * 1000000L };
+    uint32_t seq = atomic_load(&HDR(r)->seq);
+
+    if( atomic_load_explicit(&HDR(r)->write, memory_order_acquire) > r->pos )
+        return true;
+
+    // the producer only issues a wake up syscall if someone is waiting, if it
+    // publishes after we read seq the futex wait returns immediately
+    atomic_fetch_add(&HDR(r)->waiters, 1);
+    if( atomic_load_explicit(&HDR(r)->write, memory_order_acquire) <= r->pos )
+        syscall(SYS_futex, &HDR(r)->seq, FUTEX_WAIT, seq, &ts, NULL, 0);
+    atomic_fetch_sub(&HDR(r)->waiters, 1);
+
+    return ( atomic_load_explicit(&HDR(r)->write, memory_order_acquire) > r->pos );
+}
\ No newline at end of file
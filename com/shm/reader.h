@@ -0,0 +1,117 @@
+#ifndef _RLOG_SHM_READER_H_
+#define _RLOG_SHM_READER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Shared memory ring reader. Each reader keeps its own position so
+ * any number of readers can consume the same ring.
+ */
+typedef struct rlog_shm_reader_t
+{
+    int fd;
+    void* map;
+    size_t map_size;
+    const void* hdr;
+    const uint8_t* data;
+    uint64_t size;
+
+    /**
+     * @brief Position of the next record to be read
+     */
+    uint64_t pos;
+
+    /**
+     * @brief Position after the record returned by the last peek
+     */
+    uint64_t next;
+
+    /**
+     * @brief Number of times the reader fell behind the producer and 
+     * records were lost
+     */
+    uint64_t overruns;
+
+    /**
+     * @brief Ring generation last seen, see rlog_shm_reader_restarted()
+     */
+    uint32_t generation;
+
+}rlog_shm_reader_t;
+
+/**
+ * @brief Attach to a ring file created by the shm interface. The reader needs
+ * read and write permission on the file.
+ * 
+ * @param r Reader instance
+ * @param path Ring file path
+ * @param from_oldest If true start reading from the oldest record in the ring,
+ * otherwise only records published from now on are read.
+ * @return true If successfully attached to the ring
+ * @return false If the file does not exist or is not a valid ring
+ */
+bool rlog_shm_reader_open(rlog_shm_reader_t* r, const char* path, bool from_oldest);
+
+/**
+ * @brief Detach from the ring
+ * 
+ * @param r Reader instance
+ */
+void rlog_shm_reader_close(rlog_shm_reader_t* r);
+
+/**
+ * @brief Get the next record without copying it. The record must be released
+ * with rlog_shm_reader_release() before the next call.
+ * 
+ * @param r Reader instance
+ * @param[out] msg Pointer to the rendered message inside the shared memory. 
+ * The message is not null-terminated.
+ * @return Length of the message in bytes or 0 if there is no new record.
+ */
+int rlog_shm_reader_peek(rlog_shm_reader_t* r, const char** msg);
+
+/**
+ * @brief Release the record returned by the last peek.
+ * 
+ * @param r Reader instance
+ * @return true If the record was intact for the whole time it was used.
+ * @return false If the producer overwrote the record meanwhile, in that case
+ * whatever was read from it must be discarded.
+ */
+bool rlog_shm_reader_release(rlog_shm_reader_t* r);
+
+/**
+ * @brief Copy the next record to a buffer and null-terminate it.
+ * 
+ * @param r Reader instance
+ * @param buf Destination buffer
+ * @param size Size of the destination buffer, messages are truncated to fit
+ * @return Length of the message in bytes or 0 if there is no new record.
+ */
+int rlog_shm_reader_read(rlog_shm_reader_t* r, char* buf, int size);
+
+/**
+ * @brief Check if the producer restarted since the reader attached or since
+ * the last call. A producer restarted on a ring of the same size goes on from
+ * its positions, so reading can go on as well. If the ring was replaced by 
+ * one of another size, the ring is no longer valid and the reader must be 
+ * closed and opened again.
+ * 
+ * @param r Reader instance
+ * @param[out] valid Set to false if the reader must be opened again, may be NULL
+ * @return true If the producer restarted
+ */
+bool rlog_shm_reader_restarted(rlog_shm_reader_t* r, bool* valid);
+
+/**
+ * @brief Sleep until new records are published or the timeout expires.
+ * 
+ * @param r Reader instance
+ * @param time Timeout in miliseconds
+ * @return true If there are new records to be read
+ */
+bool rlog_shm_reader_wait(rlog_shm_reader_t* r, uint32_t time);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,115 @@
+/**
+ * @file ring.h
+ * @author edsp
+ * @brief Layout of the shared memory ring used by the shm interface and
+ * the shm reader library. Linux only.
+ * @version 1.0.0
+ * @date 2024-01-10
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * The file starts with a page holding \ref rlog_shm_hdr_t followed by the 
+ * data area. Records are 8 byte aligned and start with a \ref rlog_shm_rec_t
+ * header followed by the rendered message. A record never wraps around the
+ * end of the data area, if it does not fit a padding record is written instead
+ * and the record starts again at offset 0.
+ * 
+ * Positions are monotonic byte counters, the offset in the data area is the
+ * position modulo the data area size. The producer advances "oldest" before 
+ * overwriting old records and publishes "write" after the new record is in 
+ * place, so readers can detect if a record was overwritten while reading it.
+ * 
+ * A producer that restarts on an existing ring of the same size maps it 
+ * again as it is and goes on from its positions, it never truncates it. If 
+ * the size changed it retires the old file, clears its magic, and creates a
+ * new one under the same path. Either way the generation of the old header 
+ * is incremented so readers can tell.
+ */
+
+#ifndef _RLOG_SHM_RING_H_
+#define _RLOG_SHM_RING_H_
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define RLOG_SHM_MAGIC      0x474F4C52  /* "RLOG" */
+#define RLOG_SHM_VERSION    2
+
+/**
+ * @brief Offset of the data area in the file
+ */
+#define RLOG_SHM_DATA_OFFSET 4096
+
+/**
+ * @brief Record length marking a padding record
+ */
+#define RLOG_SHM_PAD 0xFFFFFFFF
+
+#define RLOG_SHM_ALIGN(n) (((n) + 7) & ~((uint64_t)7))
+
+/**
+ * @brief Ring header
+ */
+typedef struct rlog_shm_hdr_t
+{
+    uint32_t            magic;
+    uint32_t            version;
+
+    /**
+     * @brief Size of the data area in bytes
+     */
+    uint64_t            size;
+
+    /**
+     * @brief Position of the oldest record still intact
+     */
+    _Atomic uint64_t    oldest;
+
+    /**
+     * @brief Position where the next record will be written
+     */
+    _Atomic uint64_t    write;
+
+    /**
+     * @brief Futex word, incremented every time new records are published
+     */
+    _Atomic uint32_t    seq;
+
+    /**
+     * @brief Number of readers sleeping on the futex word
+     */
+    _Atomic uint32_t    waiters;
+
+    /**
+     * @brief Incremented every time a producer attaches to the ring
+     */
+    _Atomic uint32_t    generation;
+
+}rlog_shm_hdr_t;
+
+/**
+ * @brief Record header
+ */
+typedef struct rlog_shm_rec_t
+{
+    /**
+     * @brief Message length in bytes or RLOG_SHM_PAD
+     */
+    uint32_t len;
+    uint32_t reserved;
+
+}rlog_shm_rec_t;
+
+#endif //_RLOG_SHM_RING_H_
\ No newline at end of file
@@ -0,0 +1,363 @@
+/**
+ * @file shm.c
+ * @author edsp
+ * @brief Shared memory ring interface. Single producer (the rlog thread) and 
+ * multiple readers in other processes, see ring.h for the layout. Readers are
+ * woken through a futex word in the shared header, which unlike an eventfd 
+ * does not need to be passed between processes. Linux only.
+ * @version 1.0.0
+ * @date 2024-01-10
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * 
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "shm.h"
+#include "ring.h"
+#include "../interfaces.h"
+
+#ifndef _RLOG_SHM_DBG_
+    #define _RLOG_SHM_DBG_ 0
+#endif
+
+#if _RLOG_SHM_DBG_
+#include <stdio.h>
+#define DBG_PRINTF(...) printf(__VA_ARGS__)
+#else
+#define DBG_PRINTF(...)
+#endif
+
+/**
+ * @brief Shared memory interface instance
+ */
+typedef struct rlog_shm_t
+{
+    char path[100];
+    size_t size;
+    int fd;
+    void* map;
+    size_t map_size;
+    rlog_shm_hdr_t* hdr;
+    uint8_t* data;
+
+    /**
+     * @brief Producer copies of the ring positions
+     */
+    uint64_t write;
+    uint64_t oldest;
+
+}rlog_shm_t;
+
+/**
+ * @brief Create and map the ring file
+ * 
+ * @param me Pointer to interface instance.
+ * @return true if the ring is mapped and ready
+ */
+bool rlog_shm_init(void* me);
+
+/**
+ * @brief Unmap and close the ring file
+ * 
+ * @param me Pointer to interface instance.
+ */
+void rlog_shm_deinit(void* me);
+
+/**
+ * @brief Check if the ring is mapped
+ *
+ * @param me Pointer to interface instance.
+ * @return true if the ring is ready
+ */
+bool rlog_shm_poll(void* me);
+
+/**
+ * @brief Copy a message into the ring and wake up sleeping readers
+ * 
+ * @param me Pointer to interface instance.
+ * @param buf Buffer holding the message to be sent
+ * @param len Length of the message in bytes
+ * @return true if the message was published
+ */
+bool rlog_shm_send(void* me, const void* buf, int len);
+
+rlog_ifc_t rlog_shm_create(const char* path, size_t size)
+{
+    rlog_ifc_t ifc = { 0 };
+
+    if( path == NULL ) {
+        DBG_PRINTF("[RLOG] rlog_shm_create:: invalid path!\n");
+        return ifc;
+    }
+
+    rlog_shm_t* shm = calloc(1, sizeof(rlog_shm_t));
+    if( shm == NULL ) {
+        DBG_PRINTF("[RLOG] rlog_shm_create:: out of memory!\n");
+        return ifc;
+    }
+
+    strncpy(shm->path, path, sizeof(shm->path) - 1);
+    shm->size = RLOG_SHM_ALIGN(size ? size : RLOG_SHM_DEFAULT_SIZE);
+    shm->fd = -1;
+
+    ifc.init = &rlog_shm_init;
+    ifc.deinit = &rlog_shm_deinit;
+    ifc.poll = &rlog_shm_poll;
+    ifc.notify = true;
+    ifc.send = &rlog_shm_send;
+    ifc.ctx = shm;
+    return ifc;
+}
+
+void rlog_shm_destroy(rlog_ifc_t* ifc)
+{
+    if( ifc == NULL || ifc->ctx == NULL )
+        return;
+
+    rlog_shm_deinit(ifc->ctx);
+    free(ifc->ctx);
+    ifc->ctx = NULL;
+}
+
+/**
+ * @brief Tell the readers of a ring file that is about to be replaced: clear
+ * its magic, increment its generation and wake up the sleeping ones. The file
+ * is removed, readers keep their mapping of it until they close it.
+ */
+static
+void shm_retire(rlog_shm_t* shm)
+{
+    rlog_shm_hdr_t* hdr = mmap(NULL, RLOG_SHM_DATA_OFFSET, PROT_READ | PROT_WRITE, MAP_SHARED, shm->fd, 0);
+
+    if( hdr != MAP_FAILED ) 
+    {
+        if( hdr->magic == RLOG_SHM_MAGIC ) {
+            hdr->magic = 0;
+            atomic_fetch_add(&hdr->generation, 1);
+            atomic_fetch_add(&hdr->seq, 1);
+            syscall(SYS_futex, &hdr->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+        }
+        munmap(hdr, RLOG_SHM_DATA_OFFSET);
+    }
+
+    unlink(shm->path);
+    close(shm->fd);
+    shm->fd = -1;
+}
+
+/**
+ * @brief Check if the opened ring file can be attached to as it is
+ */
+static
+bool shm_reusable(rlog_shm_t* shm)
+{
+    struct stat st;
+    rlog_shm_hdr_t hdr;
+
+    if( fstat(shm->fd, &st) < 0 || (size_t) st.st_size != shm->map_size )
+        return false;
+
+    if( pread(shm->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) )
+        return false;
+
+    return ( hdr.magic == RLOG_SHM_MAGIC && hdr.version == RLOG_SHM_VERSION && 
+             hdr.size == shm->size );
+}
+
+bool rlog_shm_init(void* me)
+{
+    rlog_shm_t* shm = (rlog_shm_t*) me;
+    bool reuse;
+
+    if( shm == NULL )
+        return false;
+
+    if( shm->map )
+        return true;
+
+    shm->map_size = RLOG_SHM_DATA_OFFSET + shm->size;
+
+    // never truncate a ring readers may have mapped, they would fault
+    shm->fd = open(shm->path, O_RDWR | O_CREAT, 0666);
+    if( shm->fd < 0 ) {
+        DBG_PRINTF("[RLOG] rlog_shm_init::open() failed %d\n", errno);
+        return false;
+    }
+
+    reuse = shm_reusable(shm);
+    if( !reuse )
+    {
+        struct stat st;
+
+        // anything else than an empty file is replaced by a new one
+        if( fstat(shm->fd, &st) == 0 && st.st_size > 0 ) 
+        {
+            shm_retire(shm);
+            shm->fd = open(shm->path, O_RDWR | O_CREAT | O_EXCL, 0666);
+            if( shm->fd < 0 ) {
+                DBG_PRINTF("[RLOG] rlog_shm_init::open() failed %d\n", errno);
+                return false;
+            }
+        }
+
+        if( ftruncate(shm->fd, shm->map_size) < 0 ) {
+            DBG_PRINTF("[RLOG] rlog_shm_init::ftruncate() failed %d\n", errno);
+            close(shm->fd);
+            shm->fd = -1;
+            return false;
+        }
+    }
+
+    void* map = mmap(NULL, shm->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm->fd, 0);
+    if( map == MAP_FAILED ) {
+        DBG_PRINTF("[RLOG] rlog_shm_init::mmap() failed %d\n", errno);
+        close(shm->fd);
+        shm->fd = -1;
+        return false;
+    }
+
+    shm->hdr = (rlog_shm_hdr_t*) map;
+    shm->data = (uint8_t*) map + RLOG_SHM_DATA_OFFSET;
+
+    if( reuse ) 
+    {
+        // go on from where the previous producer stopped, the records up to
+        // its write position are complete and readers keep their position
+        shm->write = atomic_load(&shm->hdr->write);
+        shm->oldest = atomic_load(&shm->hdr->oldest);
+        atomic_fetch_add(&shm->hdr->generation, 1);
+        shm->map = map;
+        return true;
+    }
+
+    shm->write = 0;
+    shm->oldest = 0;
+
+    shm->hdr->version = RLOG_SHM_VERSION;
+    shm->hdr->size = shm->size;
+    atomic_store(&shm->hdr->oldest, 0);
+    atomic_store(&shm->hdr->write, 0);
+    atomic_store(&shm->hdr->seq, 0);
+    atomic_store(&shm->hdr->waiters, 0);
+    atomic_store(&shm->hdr->generation, 1);
+
+    // readers check the magic last, so publish it after the rest of the header
+    atomic_thread_fence(memory_order_release);
+    shm->hdr->magic = RLOG_SHM_MAGIC;
+
+    shm->map = map;
+    return true;
+}
+
+void rlog_shm_deinit(void* me)
+{
+    rlog_shm_t* shm = (rlog_shm_t*) me;
+
+    if( shm->map ) {
+        munmap(shm->map, shm->map_size);
+        shm->map = NULL;
+    }
+
+    if( shm->fd >= 0 ) {
+        close(shm->fd);
+        shm->fd = -1;
+    }
+}
+
+bool rlog_shm_poll(void* me)
+{
+    rlog_shm_t* shm = (rlog_shm_t*) me;
+    return ( shm->map != NULL );
+}
+
+/**
+ * @brief Advance the oldest position until there is room to write up to 
+ * position end without overwriting any intact record.
+ */
+static
+void shm_make_room(rlog_shm_t* shm, uint64_t end)
+{
+    uint64_t oldest = shm->oldest;
+
+    while( oldest + shm->size < end )
+    {
+        uint64_t off = oldest % shm->size;
+        rlog_shm_rec_t* rec = (rlog_shm_rec_t*) &shm->data[off];
+
+        if( rec->len == RLOG_SHM_PAD )
+            oldest += shm->size - off;
+        else
+            oldest += RLOG_SHM_ALIGN(sizeof(rlog_shm_rec_t) + rec->len);
+    }
+
+    if( oldest != shm->oldest ) 
+    {
+        shm->oldest = oldest;
+        atomic_store_explicit(&shm->hdr->oldest, oldest, memory_order_relaxed);
+
+        // readers must see the new oldest position before any overwritten byte
+        atomic_thread_fence(memory_order_release);
+    }
+}
+
+bool rlog_shm_send(void* me, const void* buf, int len)
+{
+    rlog_shm_t* shm = (rlog_shm_t*) me;
+    uint64_t total = RLOG_SHM_ALIGN(sizeof(rlog_shm_rec_t) + len);
+    uint64_t pos = shm->write;
+    uint64_t off = pos % shm->size;
+    uint64_t pad = 0;
+
+    if( shm->map == NULL || len < 0 || total > shm->size / 2 )
+        return false;
+
+    // records never wrap around
+    if( shm->size - off < total )
+        pad = shm->size - off;
+
+    shm_make_room(shm, pos + pad + total);
+
+    if( pad ) 
+    {
+        ((rlog_shm_rec_t*) &shm->data[off])->len = RLOG_SHM_PAD;
+        pos += pad;
+        off = 0;
+    }
+
+    rlog_shm_rec_t* rec = (rlog_shm_rec_t*) &shm->data[off];
+    rec->len = len;
+    rec->reserved = 0;
+    memcpy(rec + 1, buf, len);
+
+    shm->write = pos + total;
+    atomic_store_explicit(&shm->hdr->write, shm->write, memory_order_release);
+
+    atomic_fetch_add(&shm->hdr->seq, 1);
+    if( atomic_load(&shm->hdr->waiters) )
+        syscall(SYS_futex, &shm->hdr->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,37 @@
+#ifndef _RLOG_SHM_H_
+#define _RLOG_SHM_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "../interfaces.h"
+
+/**
+ * @brief Default size in bytes of the shared memory ring data area
+ */
+#ifndef RLOG_SHM_DEFAULT_SIZE
+    #define RLOG_SHM_DEFAULT_SIZE  (256 * 1024)
+#endif
+
+/**
+ * @brief Create a shared memory ring interface instance (Linux only).
+ * Rendered messages are copied into a memory-mapped ring file from where 
+ * any number of local processes can read them using the shm reader library,
+ * see reader.h. When the ring is full the oldest messages are overwritten.
+ * 
+ * @param path Ring file path, i.e. "/dev/shm/rlog"
+ * @param size Size of the data area in bytes. If 0, RLOG_SHM_DEFAULT_SIZE is used.
+ * @return Interface descriptor to be passed to rlog_install_interface(). If 
+ * allocation failed all callbacks are NULL and installing it will fail.
+ */
+rlog_ifc_t rlog_shm_create(const char* path, size_t size);
+
+/**
+ * @brief Release an interface instance created with rlog_shm_create().
+ * Must not be called while the interface is still installed on a running server.
+ * The ring file is not removed.
+ * 
+ * @param ifc Interface descriptor returned by rlog_shm_create()
+ */
+void rlog_shm_destroy(rlog_ifc_t* ifc);
+
+#endif
\ No newline at end of file
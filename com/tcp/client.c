@@ -1,230 +1,481 @@
-/**
- * @file tcpip.c
- * @author edsp
- * @brief Default TCP APIs for client/server communications. 
- * This implementation support multiple clients however it does not 
- * support multilpe instances of the interface.
- * @version 1.0.0
- * @date 2024-01-10
- * 
- * @copyright Copyright (c) 2024
- * 
- * This program is free software: you can redistribute it and/or modify
- * it under the terms of the GNU General Public License as published by
- * the Free Software Foundation, either version 3 of the License, or
- * (at your option) any later version.
- *
- * This program is distributed in the hope that it will be useful,
- * but WITHOUT ANY WARRANTY; without even the implied warranty of
- * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- * GNU General Public License for more details.
- * You should have received a copy of the GNU General Public License
- * along with this program.  If not, see <https://www.gnu.org/licenses/>.
- * 
- */
-
-#include <stdlib.h>
-#include <string.h>
-#include <netdb.h>
-#include <sys/socket.h>
-
-#include "client.h"
-#include "../interfaces.h"
-#include "../../port/os/osal.h"
-#include "../../rlog.h"
-
-#ifndef _RLOG_TCPIP_DBG_
-    #define _RLOG_TCPIP_DBG_ 0
-#endif
-
-#if _RLOG_TCPIP_DBG_
-#include <stdio.h>
-#define DBG_PRINTF(...) printf(__VA_ARGS__)
-#else
-#define DBG_PRINTF(...)
-#endif
-
-
-/**
- * @brief Initialize TCP socket
- * 
- * @param me Not used.
- * @return true if TCP socket is ready and listening
- */
-bool tcpcli_init(void* me);
-
-/**
- * @brief Check if interface has connected to TCP server
- * Non blocking function!
- *
- * @param me Not used.
- * @return true if its connected.
- */
-bool tcpcli_poll(void* me);
-
-/**
- * @brief Send data to server
- * 
- * @param me Not used.
- * @param buf Buffer holding the message to be sent
- * @param len Length of the message in bytes
- * @return true if was able to send a message to the server
- */
-bool tcpcli_send(void* me, const void* buf, int len);
-
-rlog_ifc_t rlog_tcpcli_ifc = {
-    .init       = &tcpcli_init,
-    .poll       = &tcpcli_poll,
-    .send       = &tcpcli_send,
-    .deinit     = NULL,
-    .ctx        = NULL,
-};
-
-static int my_socket = -1;
-static char server_addr[100] = {} ;
-static struct sockaddr_in sock_addr = { 0 };
-static uint16_t tcpcli_port = 1514;
-static bool connected = false;
-
-/**
- * @brief server thread handle
- */
-static os_thread_t* thread_handle;
-static void tcpcli_thread(void* arg);
-static bool configured = false;
-static bool initialized = false;
-
-bool rlog_tcpcli_config(const char* addr, unsigned int port)
-{
-    if( initialized )
-        return false;
-
-    if( port ) {
-        tcpcli_port = port;
-    }
-    
-    if( addr == NULL ) 
-    {
-        DBG_PRINTF("[RLOG] rlog_tcpcli_config:: invalid server address!\n");
-        return false;      
-    }
-
-    strncpy(server_addr, addr, sizeof(server_addr));
-    configured = true;
-    return true;
-}
-
-bool tcpcli_init(void* me)
-{		
-    if( initialized )
-        return true;
-
-    if( !configured )
-        return false;
-
-    struct hostent *hp;    
-    hp = gethostbyname(server_addr);
-    if(hp == NULL) {
-        DBG_PRINTF("[RLOG] tcpcli_init::gethostbyname failed, error: %d \n", h_errno);
-        return false;
-    }
-
-    sock_addr.sin_family = AF_INET;
-    sock_addr.sin_addr.s_addr = *(u_long *) hp->h_addr_list[0];
-    sock_addr.sin_port = htons( tcpcli_port );
-
-    thread_handle = os_thread_create("tcpcli", tcpcli_thread, NULL, 2048, 8);
-    if( thread_handle == NULL ) {
-        DBG_PRINTF("[RLOG] tcpcli_init failed to create thread\n");
-        return false;
-    }
-
-    initialized = true;
-    return true;
-}
-
-bool tcpcli_check_socket(int sockfd) 
-{ 
-    char sock_buf;
-    if( recv(sockfd, &sock_buf, sizeof(char), MSG_PEEK | MSG_DONTWAIT) == 0 ) {
-        // when a stream socket (i.e TCP) peer has performed an orderly shutdown, the return value will be 0.
-        return false; 
-    } 
-
-    // since the client will never send anything the return -1 might mean
-    // the socket is still open, but just in case lets test for ECONNRESET.
-    // This needs double checking. It does not seem right but it is working :-)
-    if ( errno == ECONNRESET ) { return false; }
-
-    return true; 
-} 
-
-bool tcpcli_poll(void* me)
-{	
-    if( my_socket < 0 )
-        return false;
-
-    return connected;
-}
-
-bool tcpcli_send(void* me, const void* buf, int len)
-{
-    if( my_socket < 0 )
-        return false;
-
-    if( send(my_socket, buf, len, MSG_DONTWAIT) < 0 )
-    {
-        DBG_PRINTF("[RLOG] tcpcli_send::send() failed %d\n", errno);
-        rlogf(RLOG_INFO, "[RLOG] Lost connection to %s", server_addr);
-        close(my_socket);
-        my_socket = -1;
-        connected = false;
-        return false;
-    }
-
-	return true;
-}
-
-static
-void tcpcli_thread(void* arg)
-{                
-    while( 1 )
-    {         
-        if( connected )
-        {
-            if( !tcpcli_check_socket(my_socket) )
-            {
-                rlogf(RLOG_INFO, "[RLOG] Lost connection to %s", server_addr);
-                connected = false;
-            }
-        }
-
-        if( !connected )
-        {
-            if( my_socket != -1 )
-            {
-                close(my_socket);
-                my_socket = -1;                    
-                os_sleep_us(1000 * 1000);
-            } 
-            
-            my_socket = socket(AF_INET , SOCK_STREAM , 0);
-
-            if( my_socket == -1 ) 
-            {
-                DBG_PRINTF("[RLOG] tcpcli_thread::socket() failed %d\n", errno);
-            }
-            else
-            {
-                // Send connection request to server
-                if(connect(my_socket, (struct sockaddr*)&sock_addr, sizeof(sock_addr)) < 0){
-                    connected = false;
-                } else {
-                    rlogf(RLOG_INFO, "[RLOG] New connection to %s", server_addr);
-                    connected = true;
-                }
-            }
-        }
-        os_sleep_us(10 * 1000);
-    }
+/**
+ * @file tcpip.c
+ * @author edsp
+ * @brief Default TCP APIs for client/server communications. 
+ * Multiple instances of the interface can be created with rlog_tcpcli_create(),
+ * each one with its own socket and connection thread.
+ * @version 1.0.0
+ * @date 2024-01-10
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * 
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+
+#include "client.h"
+#include "../interfaces.h"
+#include "../dns/resolver.h"
+#include "../../port/os/osal.h"
+#include "../../rlog.h"
+
+#ifndef _RLOG_TCPIP_DBG_
+    #define _RLOG_TCPIP_DBG_ 0
+#endif
+
+#if _RLOG_TCPIP_DBG_
+#include <stdio.h>
+#define DBG_PRINTF(...) printf(__VA_ARGS__)
+#else
+#define DBG_PRINTF(...)
+#endif
+
+/**
+ * @brief Longest time in miliseconds the connection thread goes without 
+ * checking whether it must terminate
+ */
+#define TCPCLI_SLICE_MS 100
+
+
+/**
+ * @brief TCP client interface instance
+ */
+typedef struct rlog_tcpcli_t
+{
+    /**
+     * @brief Opened, connected and closed by the connection thread only. The
+     * send path uses it with the lock held, the thread changes it with the 
+     * lock held.
+     */
+    int socket;
+    char server_addr[100];
+    struct sockaddr_in sock_addr;
+    rlog_resolver_t resolver;
+    uint16_t port;
+
+    /**
+     * @brief Set by the connection thread, cleared by either thread when the
+     * connection is lost. The connection thread then closes the socket.
+     */
+    atomic_bool connected;
+    bool configured;
+    bool initialized;
+
+    /**
+     * @brief Signals the connection thread must terminate
+     */
+    atomic_bool terminate;
+
+    /**
+     * @brief Keeps the socket from being closed while a message is sent
+     */
+    os_mutex_t* lock;
+
+    /**
+     * @brief Connection thread handle
+     */
+    os_thread_t* thread_handle;
+
+    /**
+     * @brief Signaled by the connection thread once it has terminated
+     */
+    os_sem_t* done;
+
+}rlog_tcpcli_t;
+
+/**
+ * @brief Start resolving the server address and the connection thread.
+ * Does not wait for the address to be resolved.
+ * 
+ * @param me Pointer to interface instance.
+ * @return true if the connection thread is running
+ */
+bool tcpcli_init(void* me);
+
+/**
+ * @brief Stop the connection thread and close the socket
+ * 
+ * @param me Pointer to interface instance.
+ */
+void tcpcli_deinit(void* me);
+
+/**
+ * @brief Check if interface has connected to TCP server
+ * Non blocking function!
+ *
+ * @param me Pointer to interface instance.
+ * @return true if its connected.
+ */
+bool tcpcli_poll(void* me);
+
+/**
+ * @brief Send data to server
+ * 
+ * @param me Pointer to interface instance.
+ * @param buf Buffer holding the message to be sent
+ * @param len Length of the message in bytes
+ * @return true if was able to send a message to the server
+ */
+bool tcpcli_send(void* me, const void* buf, int len);
+
+/**
+ * @brief Default instance, configured with rlog_tcpcli_config()
+ */
+static rlog_tcpcli_t tcpcli_default = {
+    .socket     = -1,
+    .port       = 1514,
+};
+
+rlog_ifc_t rlog_tcpcli_ifc = {
+    .init       = &tcpcli_init,
+    .poll       = &tcpcli_poll,
+    .send       = &tcpcli_send,
+    .deinit     = &tcpcli_deinit,
+    .ctx        = &tcpcli_default,
+    .notify     = true,
+};
+
+static void tcpcli_thread(void* arg);
+
+static
+bool tcpcli_config(rlog_tcpcli_t* cli, const char* addr, unsigned int port)
+{
+    if( cli->initialized )
+        return false;
+
+    if( port ) {
+        cli->port = port;
+    }
+    
+    if( addr == NULL ) 
+    {
+        DBG_PRINTF("[RLOG] rlog_tcpcli_config:: invalid server address!\n");
+        return false;      
+    }
+
+    strncpy(cli->server_addr, addr, sizeof(cli->server_addr) - 1);
+    cli->configured = true;
+    return true;
+}
+
+bool rlog_tcpcli_config(const char* addr, unsigned int port)
+{
+    return tcpcli_config(&tcpcli_default, addr, port);
+}
+
+rlog_ifc_t rlog_tcpcli_create(const char* addr, unsigned int port)
+{
+    rlog_ifc_t ifc = { 0 };
+    rlog_tcpcli_t* cli = calloc(1, sizeof(rlog_tcpcli_t));
+
+    if( cli == NULL ) {
+        DBG_PRINTF("[RLOG] rlog_tcpcli_create:: out of memory!\n");
+        return ifc;
+    }
+
+    cli->socket = -1;
+    cli->port = 1514;
+
+    if( !tcpcli_config(cli, addr, port) ) {
+        free(cli);
+        return ifc;
+    }
+
+    ifc = rlog_tcpcli_ifc;
+    ifc.ctx = cli;
+    return ifc;
+}
+
+void rlog_tcpcli_destroy(rlog_ifc_t* ifc)
+{
+    if( ifc == NULL || ifc->ctx == NULL || ifc->ctx == &tcpcli_default )
+        return;
+
+    tcpcli_deinit(ifc->ctx);
+    free(ifc->ctx);
+    ifc->ctx = NULL;
+}
+
+bool tcpcli_init(void* me)
+{		
+    rlog_tcpcli_t* cli = (rlog_tcpcli_t*) me;
+
+    if( cli == NULL )
+        return false;
+
+    if( cli->initialized )
+        return true;
+
+    if( !cli->configured )
+        return false;
+
+    if( !rlog_resolver_init(&cli->resolver, cli->server_addr, cli->port) ) {
+        DBG_PRINTF("[RLOG] tcpcli_init::rlog_resolver_init failed\n");
+        return false;
+    }
+
+    cli->done = os_sem_create(1, 0);
+    cli->lock = os_mutex_create();
+    if( cli->done == NULL || cli->lock == NULL ) {
+        DBG_PRINTF("[RLOG] tcpcli_init failed to create kernel objects\n");
+        goto fail;
+    }
+
+    cli->terminate = false;
+    cli->connected = false;
+    cli->thread_handle = os_thread_create("tcpcli", tcpcli_thread, cli, 2048, 8);
+    if( cli->thread_handle == NULL ) {
+        DBG_PRINTF("[RLOG] tcpcli_init failed to create thread\n");
+        goto fail;
+    }
+
+    cli->initialized = true;
+    return true;
+
+fail:
+    rlog_resolver_deinit(&cli->resolver);
+    if( cli->done )
+        os_sem_destroy(cli->done);
+    if( cli->lock )
+        os_mutex_destroy(cli->lock);
+    cli->done = NULL;
+    cli->lock = NULL;
+    return false;
+}
+
+void tcpcli_deinit(void* me)
+{
+    rlog_tcpcli_t* cli = (rlog_tcpcli_t*) me;
+
+    if( !cli->initialized )
+        return;
+
+    // wait for the connection thread to close the socket and exit, it checks
+    // terminate at least every TCPCLI_SLICE_MS
+    cli->terminate = true;
+    os_sem_wait(cli->done, OS_WAIT_FOREVER);
+    os_sem_destroy(cli->done);
+    os_mutex_destroy(cli->lock);
+    rlog_resolver_deinit(&cli->resolver);
+    cli->done = NULL;
+    cli->lock = NULL;
+    cli->thread_handle = NULL;
+    cli->initialized = false;
+}
+
+bool tcpcli_check_socket(int sockfd) 
+{ 
+    char sock_buf;
+    if( recv(sockfd, &sock_buf, sizeof(char), MSG_PEEK | MSG_DONTWAIT) == 0 ) {
+        // when a stream socket (i.e TCP) peer has performed an orderly shutdown, the return value will be 0.
+        return false; 
+    } 
+
+    // since the client will never send anything the return -1 might mean
+    // the socket is still open, but just in case lets test for ECONNRESET.
+    // This needs double checking. It does not seem right but it is working :-)
+    if ( errno == ECONNRESET ) { return false; }
+
+    return true; 
+} 
+
+bool tcpcli_poll(void* me)
+{	
+    rlog_tcpcli_t* cli = (rlog_tcpcli_t*) me;
+
+    return cli->connected;
+}
+
+bool tcpcli_send(void* me, const void* buf, int len)
+{
+    rlog_tcpcli_t* cli = (rlog_tcpcli_t*) me;
+    bool ok = false;
+    bool lost = false;
+
+    if( !cli->connected )
+        return false;
+
+    // the connection thread closes the socket, not while it is in use here
+    os_mutex_lock(cli->lock);
+    if( cli->connected && cli->socket >= 0 )
+    {
+        ok = ( send(cli->socket, buf, len, MSG_DONTWAIT) >= 0 );
+        if( !ok ) {
+            DBG_PRINTF("[RLOG] tcpcli_send::send() failed %d\n", errno);
+            cli->connected = false;
+            lost = true;
+        }
+    }
+    os_mutex_unlock(cli->lock);
+
+    if( lost ) {
+        rlogf(RLOG_INFO, "[RLOG] Lost connection to %s", cli->server_addr);
+        rlog_resolver_failed(&cli->resolver);
+    }
+
+	return ok;
+}
+
+/**
+ * @brief Close the socket of the connection thread
+ */
+static
+void tcpcli_close(rlog_tcpcli_t* cli)
+{
+    os_mutex_lock(cli->lock);
+    cli->connected = false;
+    if( cli->socket != -1 )
+    {
+        close(cli->socket);
+        cli->socket = -1;
+    }
+    os_mutex_unlock(cli->lock);
+}
+
+/**
+ * @brief Sleep in the connection thread, returns early if it must terminate
+ */
+static
+void tcpcli_pause(rlog_tcpcli_t* cli, unsigned int ms)
+{
+    for( unsigned int t = 0; t < ms && !cli->terminate; t += TCPCLI_SLICE_MS )
+        os_sleep_us(TCPCLI_SLICE_MS * 1000);
+}
+
+/**
+ * @brief Connect the socket to the server within RLOG_TCPCLI_CONNECT_MS. 
+ * The socket is non-blocking while connecting, so a terminate request does 
+ * not wait for the connect timeout of the TCP stack.
+ * 
+ * @return true If connected
+ */
+static
+bool tcpcli_connect(rlog_tcpcli_t* cli, int sock)
+{
+    int flags = fcntl(sock, F_GETFL, 0);
+    if( flags < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0 )
+        return false;
+
+    if( connect(sock, (struct sockaddr*)&cli->sock_addr, sizeof(cli->sock_addr)) < 0 )
+    {
+        bool ready = false;
+
+        if( errno != EINPROGRESS ) {
+            DBG_PRINTF("[RLOG] tcpcli_connect::connect() failed %d\n", errno);
+            return false;
+        }
+
+        for( unsigned int t = 0; !ready && t < RLOG_TCPCLI_CONNECT_MS && !cli->terminate; t += TCPCLI_SLICE_MS )
+        {
+            fd_set wr;
+            struct timeval tv = { .tv_sec = 0, .tv_usec = TCPCLI_SLICE_MS * 1000 };
+
+            FD_ZERO(&wr);
+            FD_SET(sock, &wr);
+            int n = select(sock + 1, NULL, &wr, NULL, &tv);
+            if( n < 0 && errno != EINTR ) {
+                DBG_PRINTF("[RLOG] tcpcli_connect::select() failed %d\n", errno);
+                return false;
+            }
+            ready = ( n > 0 );
+        }
+
+        if( !ready )
+            return false;
+
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if( getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0 ) {
+            DBG_PRINTF("[RLOG] tcpcli_connect::connect() failed %d\n", err);
+            return false;
+        }
+    }
+
+    // back to blocking, the send path sets MSG_DONTWAIT itself
+    fcntl(sock, F_SETFL, flags);
+    return true;
+}
+
+static
+void tcpcli_thread(void* arg)
+{                
+    rlog_tcpcli_t* cli = (rlog_tcpcli_t*) arg;
+
+    while( !cli->terminate )
+    {         
+        if( cli->connected )
+        {
+            if( !tcpcli_check_socket(cli->socket) )
+            {
+                rlogf(RLOG_INFO, "[RLOG] Lost connection to %s", cli->server_addr);
+                cli->connected = false;
+                rlog_ifc_changed();
+            }
+        }
+
+        if( !cli->connected )
+        {
+            if( cli->socket != -1 )
+            {
+                tcpcli_close(cli);
+                tcpcli_pause(cli, 1000);
+            } 
+
+            // wait until the server address has been resolved
+            if( !rlog_resolver_get(&cli->resolver, &cli->sock_addr) )
+            {
+                os_sleep_us(100 * 1000);
+                continue;
+            }
+            
+            int sock = socket(AF_INET , SOCK_STREAM , 0);
+
+            if( sock == -1 ) 
+            {
+                DBG_PRINTF("[RLOG] tcpcli_thread::socket() failed %d\n", errno);
+            }
+            else
+            {
+                // Send connection request to server
+                if( !tcpcli_connect(cli, sock) ){
+                    // try the next address next time
+                    rlog_resolver_failed(&cli->resolver);
+                    close(sock);
+                    tcpcli_pause(cli, 1000);
+                } else {
+                    rlogf(RLOG_INFO, "[RLOG] New connection to %s", cli->server_addr);
+                    os_mutex_lock(cli->lock);
+                    cli->socket = sock;
+                    cli->connected = true;
+                    os_mutex_unlock(cli->lock);
+                    rlog_ifc_changed();
+                }
+            }
+        }
+        os_sleep_us(10 * 1000);
+    }
+
+    tcpcli_close(cli);
+
+    os_sem_signal(cli->done);
+    os_thread_destroy(NULL);
 }
\ No newline at end of file
@@ -1,16 +1,46 @@
-#ifndef _RLOG_TCP_CLIENT_H_
-#define _RLOG_TCP_CLIENT_H_
-
-#include <stdbool.h>
-
-/**
- * @brief Configure server address and port.
- * 
- * @param addr C String containing server address, this could be an URL or an IP address.
- * @param port Port number.
- * @return true If successfully configured the interface
- * @return false If failed.
- */
-bool rlog_tcpcli_config(const char* addr, unsigned int port);
-
+#ifndef _RLOG_TCP_CLIENT_H_
+#define _RLOG_TCP_CLIENT_H_
+
+#include <stdbool.h>
+#include "../interfaces.h"
+
+/**
+ * @brief Maximum time in miliseconds to establish a connection to the server.
+ * The connection thread checks every 100 ms whether it must terminate, so 
+ * removing the interface is not held up by an unreachable server.
+ */
+#ifndef RLOG_TCPCLI_CONNECT_MS
+    #define RLOG_TCPCLI_CONNECT_MS 5000
+#endif
+
+/**
+ * @brief Configure server address and port.
+ * 
+ * @param addr C String containing server address, this could be an URL or an IP address.
+ * @param port Port number.
+ * @return true If successfully configured the interface
+ * @return false If failed.
+ */
+bool rlog_tcpcli_config(const char* addr, unsigned int port);
+
+/**
+ * @brief Create a new TCP client interface instance with its own socket and 
+ * connection thread. Several instances can be installed at the same time, 
+ * i.e to log to redundant collectors.
+ * 
+ * @param addr C String containing server address, this could be an URL or an IP address.
+ * @param port Port number. If 0, port 1514 is used.
+ * @return Interface descriptor to be passed to rlog_install_interface(). If 
+ * allocation failed all callbacks are NULL and installing it will fail.
+ */
+rlog_ifc_t rlog_tcpcli_create(const char* addr, unsigned int port);
+
+/**
+ * @brief Release an interface instance created with rlog_tcpcli_create().
+ * Must not be called while the interface is still installed on a running server.
+ * 
+ * @param ifc Interface descriptor returned by rlog_tcpcli_create()
+ */
+void rlog_tcpcli_destroy(rlog_ifc_t* ifc);
+
 #endif
\ No newline at end of file
@@ -2,8 +2,8 @@
  * @file server.c
  * @author edsp
  * @brief Default TCP server interface implementation. 
- * This implementation support multiple clients however it does not 
- * support multilpe instances of the interface.
+ * This implementation support multiple clients and multiple instances of 
+ * the interface, see rlog_tcp_server_create().
  * @version 1.0.0
  * @date 2024-01-10
  * 
@@ -50,19 +50,47 @@
     #define RLOG_TCPIP_MAX_CLI 2
 #endif
 
+typedef struct rlog_tcp_cli_t
+{
+	int socket;
+	struct in_addr ip;
+	char ip_str[INET_ADDRSTRLEN];
+	
+}rlog_tcp_cli_t;
+
+/**
+ * @brief TCP server interface instance
+ */
+typedef struct rlog_tcp_server_t
+{
+    int server_socket;
+    uint16_t server_port;
+    struct sockaddr_in sock_addr;
+    rlog_tcp_cli_t cli[RLOG_TCPIP_MAX_CLI];
+    bool initialized;
+
+}rlog_tcp_server_t;
+
 /**
  * @brief Initialize server TCP socket
  * 
- * @param me Not used.
+ * @param me Pointer to interface instance.
  * @return true if TCP socket is ready and listening
  */
 bool rlog_tcp_init(void* me);
 
+/**
+ * @brief Close all client connections and the server socket
+ * 
+ * @param me Pointer to interface instance.
+ */
+void rlog_tcp_deinit(void* me);
+
 /**
  * @brief Check if at least one client has connected and test all connections. 
  * Non blocking function!
  *
- * @param me Not used.
+ * @param me Pointer to interface instance.
  * @return true if there is at least one client connected.
  */
 bool rlog_tcp_poll(void* me);
@@ -70,63 +98,90 @@ bool rlog_tcp_poll(void* me);
 /**
  * @brief Send data to all connected TCP clients
  * 
- * @param me Not used.
+ * @param me Pointer to interface instance.
  * @param buf Buffer holding the message to be sent
  * @param len Length of the message in bytes
  * @return true if was able to send a message to at least one client 
  */
 bool rlog_tcp_send(void* me, const void* buf, int len);
 
+/**
+ * @brief Default instance, configured with rlog_tcp_server_config()
+ */
+static rlog_tcp_server_t server_default = {
+    .server_socket  = -1,
+    .server_port    = RLOG_TCP_SERVER_PORT,
+};
+
 rlog_ifc_t rlog_tcp_server_ifc = {
     .init       = &rlog_tcp_init,
     .poll       = &rlog_tcp_poll,
     .send       = &rlog_tcp_send,
-    .deinit     = NULL,
-    .ctx        = NULL,
+    .deinit     = &rlog_tcp_deinit,
+    .ctx        = &server_default,
 };
 
-typedef struct rlog_tcp_cli_t
-{
-	int socket;
-	struct in_addr ip;
-	char ip_str[INET_ADDRSTRLEN];
-	
-}rlog_tcp_cli_t;
-
-static int server_socket = -1;
-static uint16_t server_port = RLOG_TCP_SERVER_PORT;
-static struct sockaddr_in sock_addr = { 0 };
-static rlog_tcp_cli_t cli[RLOG_TCPIP_MAX_CLI];
-static bool initialized = false;
-
 bool rlog_tcp_server_config(unsigned int port)
 {
-    if( initialized )
+    if( server_default.initialized )
         return false;
 
     if( port ) {
-        server_port = port;
+        server_default.server_port = port;
     }
     
     return true;
 }
 
+rlog_ifc_t rlog_tcp_server_create(unsigned int port)
+{
+    rlog_ifc_t ifc = { 0 };
+    rlog_tcp_server_t* srv = calloc(1, sizeof(rlog_tcp_server_t));
+
+    if( srv == NULL ) {
+        DBG_PRINTF("[RLOG] rlog_tcp_server_create:: out of memory!\n");
+        return ifc;
+    }
+
+    srv->server_socket = -1;
+    srv->server_port = port ? port : RLOG_TCP_SERVER_PORT;
+
+    ifc = rlog_tcp_server_ifc;
+    ifc.ctx = srv;
+    return ifc;
+}
+
+void rlog_tcp_server_destroy(rlog_ifc_t* ifc)
+{
+    if( ifc == NULL || ifc->ctx == NULL || ifc->ctx == &server_default )
+        return;
+
+    rlog_tcp_deinit(ifc->ctx);
+    free(ifc->ctx);
+    ifc->ctx = NULL;
+}
 
 bool rlog_tcp_init(void* me)
 {	
-    if( initialized ) {
+    rlog_tcp_server_t* srv = (rlog_tcp_server_t*) me;
+
+    if( srv == NULL ) {
+        return false;
+    }
+
+    if( srv->initialized ) {
         return true;
     }
     
 	for (int i=0; i < RLOG_TCPIP_MAX_CLI; i++)
 	{			
-		cli[i].socket = -1;
-		strcpy(cli[i].ip_str, "0.0.0.0");
+		srv->cli[i].socket = -1;
+		strcpy(srv->cli[i].ip_str, "0.0.0.0");
 	}
 	
-    server_socket = socket(AF_INET , SOCK_STREAM , 0);
+    srv->server_socket = socket(AF_INET , SOCK_STREAM , 0);
 
-    if( server_socket == -1 ) 
+    if( srv->server_socket == -1 ) 
     {
         DBG_PRINTF("[RLOG] rlog_tcp_init::socket() failed %d\n", errno);
         return false;
@@ -135,41 +190,62 @@ bool rlog_tcp_init(void* me)
     //set server socket to allow multiple connections,  
     //this is just a good habit, it will work without this  
     int opt = 1;   
-    if( setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, (char *)&opt, sizeof(opt)) < 0 )   
+    if( setsockopt(srv->server_socket, SOL_SOCKET, SO_REUSEADDR, (char *)&opt, sizeof(opt)) < 0 )   
     {   
         DBG_PRINTF("[RLOG] rlog_tcp_init::bind() failed %d\n", errno);
-        close(server_socket);
-        server_socket = -1;
+        close(srv->server_socket);
+        srv->server_socket = -1;
 		return false;   
     }  
 
-    sock_addr.sin_family = AF_INET;
-    sock_addr.sin_addr.s_addr = INADDR_ANY;
-    sock_addr.sin_port = htons( server_port );
+    srv->sock_addr.sin_family = AF_INET;
+    srv->sock_addr.sin_addr.s_addr = INADDR_ANY;
+    srv->sock_addr.sin_port = htons( srv->server_port );
 
-    int flags = fcntl(server_socket, F_GETFL, 0);
-    fcntl(server_socket, F_SETFL, flags | O_NONBLOCK);
+    int flags = fcntl(srv->server_socket, F_GETFL, 0);
+    fcntl(srv->server_socket, F_SETFL, flags | O_NONBLOCK);
     
-	if( bind(server_socket,(struct sockaddr *)&sock_addr , sizeof(sock_addr)) < 0 )
+	if( bind(srv->server_socket,(struct sockaddr *)&srv->sock_addr , sizeof(srv->sock_addr)) < 0 )
 	{
         DBG_PRINTF("[RLOG] rlog_tcp_init::bind() failed %d\n", errno);
-        close(server_socket);
-        server_socket = -1;
+        close(srv->server_socket);
+        srv->server_socket = -1;
 		return false;
 	}
 
-    if( listen(server_socket, RLOG_TCPIP_MAX_CLI) != 0 )
+    if( listen(srv->server_socket, RLOG_TCPIP_MAX_CLI) != 0 )
     {
         DBG_PRINTF("[RLOG] rlog_tcp_init::listen() failed %d\n", errno);
-        close(server_socket);
-        server_socket = -1;
+        close(srv->server_socket);
+        srv->server_socket = -1;
         return false;
     }
 
-    initialized = true;
+    srv->initialized = true;
     return true;
 }
 
+void rlog_tcp_deinit(void* me)
+{
+    rlog_tcp_server_t* srv = (rlog_tcp_server_t*) me;
+
+    if( !srv->initialized )
+        return;
+
+    for (int i=0; i < RLOG_TCPIP_MAX_CLI; i++)
+    {
+        if ( srv->cli[i].socket > 0 )
+        {
+            close(srv->cli[i].socket);
+            srv->cli[i].socket = -1;
+        }
+    }
+
+    close(srv->server_socket);
+    srv->server_socket = -1;
+    srv->initialized = false;
+}
+
 bool rlog_tcp_check_socket(int sockfd) 
 { 
     char sock_buf;
@@ -188,11 +264,13 @@ bool rlog_tcp_check_socket(int sockfd)
 
 bool rlog_tcp_poll(void* me)
 {
+    rlog_tcp_server_t* srv = (rlog_tcp_server_t*) me;
+    rlog_tcp_cli_t* cli = srv->cli;
     int len;
     struct sockaddr_in client;
     int fd = -1;
 
-    if( server_socket < 0 ) {
+    if( srv->server_socket < 0 ) {
         return false;
     }
 
@@ -204,13 +282,14 @@ bool rlog_tcp_poll(void* me)
             {
                 // we lost the connection but haven't detected till now
                 rlogf(RLOG_WARNING, "[RLOG] Lost connection from %s", cli[i].ip_str);	
+                close(cli[i].socket);
                 cli[i].socket = -1;
             }				
         }			
     }
 
     len = sizeof(client);
-    fd = accept(server_socket, (struct sockaddr *)&client, (socklen_t*)&len);
+    fd = accept(srv->server_socket, (struct sockaddr *)&client, (socklen_t*)&len);
 
 	if( fd > 0 ) // accept() was successful	
 	{
@@ -230,6 +309,7 @@ bool rlog_tcp_poll(void* me)
 		
 		// should never pass here, but in any case..
 		DBG_PRINTF("[RLOG] rlog_tcp_poll: a new connection was accepted but no socket is available! \n");		
+		close(fd);
 		return false;		
 	}
 	else // accept() failed 
@@ -257,6 +337,8 @@ bool rlog_tcp_poll(void* me)
 
 bool rlog_tcp_send(void* me, const void* buf, int len)
 {
+    rlog_tcp_server_t* srv = (rlog_tcp_server_t*) me;
+    rlog_tcp_cli_t* cli = srv->cli;
 	int ret = 0;
 	unsigned int logs_sent = 0;
 	
@@ -269,6 +351,7 @@ bool rlog_tcp_send(void* me, const void* buf, int len)
 			if( ret == -1 )
 			{
 				DBG_PRINTF("[RLOG] rlog_tcp_send::send() failed %d\n", errno);
+				close(cli[i].socket);
 				cli[i].socket = -1;
 				rlogf(RLOG_INFO, "[RLOG] Lost connection from %s", cli[i].ip_str);
 			}
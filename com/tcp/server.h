@@ -1,15 +1,34 @@
-#ifndef _RLOG_TCP_SERVER_H_
-#define _RLOG_TCP_SERVER_H_
-
-#include <stdbool.h>
-
-/**
- * @brief Default TCP server port 
- */
-#ifndef RLOG_TCP_SERVER_PORT
-    #define RLOG_TCP_SERVER_PORT  1514
-#endif
-
-bool rlog_tcp_server_config(unsigned int port);
-
+#ifndef _RLOG_TCP_SERVER_H_
+#define _RLOG_TCP_SERVER_H_
+
+#include <stdbool.h>
+#include "../interfaces.h"
+
+/**
+ * @brief Default TCP server port 
+ */
+#ifndef RLOG_TCP_SERVER_PORT
+    #define RLOG_TCP_SERVER_PORT  1514
+#endif
+
+bool rlog_tcp_server_config(unsigned int port);
+
+/**
+ * @brief Create a new TCP server interface instance with its own listening 
+ * socket and client list.
+ * 
+ * @param port Port number. If 0, RLOG_TCP_SERVER_PORT is used.
+ * @return Interface descriptor to be passed to rlog_install_interface(). If 
+ * allocation failed all callbacks are NULL and installing it will fail.
+ */
+rlog_ifc_t rlog_tcp_server_create(unsigned int port);
+
+/**
+ * @brief Release an interface instance created with rlog_tcp_server_create().
+ * Must not be called while the interface is still installed on a running server.
+ * 
+ * @param ifc Interface descriptor returned by rlog_tcp_server_create()
+ */
+void rlog_tcp_server_destroy(rlog_ifc_t* ifc);
+
 #endif //_RLOG_TCP_SERVER_H_
\ No newline at end of file
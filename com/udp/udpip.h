@@ -1,23 +1,44 @@
-#ifndef _RLOG_UDPIP_H_
-#define _RLOG_UDPIP_H_
-
-#include <stdbool.h>
-
-/**
- * @brief RLOG default UDP Port
- */
-#ifndef RLOG_UDP_DEFAULT_PORT
-    #define RLOG_UDP_DEFAULT_PORT  514
-#endif
-
-/**
- * @brief Configure server address and port.
- * 
- * @param addr C String containing server address, this could be an URL or an IP address.
- * @param port Port number.
- * @return true If successfully configured the interface
- * @return false If failed.
- */
-bool rlog_udp_config(const char* ip, unsigned int port);
-
+#ifndef _RLOG_UDPIP_H_
+#define _RLOG_UDPIP_H_
+
+#include <stdbool.h>
+#include "../interfaces.h"
+
+/**
+ * @brief RLOG default UDP Port
+ */
+#ifndef RLOG_UDP_DEFAULT_PORT
+    #define RLOG_UDP_DEFAULT_PORT  514
+#endif
+
+/**
+ * @brief Configure server address and port.
+ * 
+ * @param addr C String containing server address, this could be an URL or an IP address.
+ * @param port Port number.
+ * @return true If successfully configured the interface
+ * @return false If failed.
+ */
+bool rlog_udp_config(const char* ip, unsigned int port);
+
+/**
+ * @brief Create a new UDP interface instance with its own socket and 
+ * server address. Several instances can be installed at the same time 
+ * to send the same logs to multiple collectors.
+ * 
+ * @param addr C String containing server address, this could be an URL or an IP address.
+ * @param port Port number. If 0, RLOG_UDP_DEFAULT_PORT is used.
+ * @return Interface descriptor to be passed to rlog_install_interface(). If 
+ * allocation failed all callbacks are NULL and installing it will fail.
+ */
+rlog_ifc_t rlog_udp_create(const char* addr, unsigned int port);
+
+/**
+ * @brief Release an interface instance created with rlog_udp_create().
+ * Must not be called while the interface is still installed on a running server.
+ * 
+ * @param ifc Interface descriptor returned by rlog_udp_create()
+ */
+void rlog_udp_destroy(rlog_ifc_t* ifc);
+
 #endif
\ No newline at end of file
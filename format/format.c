@@ -1,81 +1,221 @@
-#include <string.h>
-#include <stdint.h>
-#include <stdlib.h>
-#include <stdio.h>
-#include <sys/time.h>
-
-#include "rlog.h"
-#include "format.h"
-
-static char date[80] = { 0 };
-
-int make_rfc3164_string(char* hostname, char* str, log_t* log)
-{
-    int nchar = 0;
-
-#if RLOG_TIMESTAMP_ENABLE    
-    struct tm * timeinfo;
-    timeinfo = localtime ( &log->timestamp );
-    strftime(date, sizeof(date), "%b %d %H:%M:%S", timeinfo);
-#endif
-    if( strlen(log->proc) ) {
-
-        char * pcTmp  = log->proc;
-        while (*pcTmp) {
-            if (*pcTmp == ' ') *pcTmp = '_';
-            ++pcTmp;
-        }
-
-        nchar = snprintf(str, MSG_MAX_SIZE_CHAR,"<%d>%s %s %s: %s\r\n", log->pri, date, hostname, log->proc, log->msg);
-    } else {
-        nchar = snprintf(str, MSG_MAX_SIZE_CHAR,"<%d>%s %s -: %s\r\n", log->pri, date, hostname, log->msg);
-    }
-   
-    if( nchar < 0 || nchar > MSG_MAX_SIZE_CHAR )
-        return -1;
-
-    return nchar;
-}
-
-int make_rfc5424_log(char* hostname, char* str, log_t* log)
-{
-    int nchar = 0;
-
-#if RLOG_TIMESTAMP_ENABLE    
-    struct tm * timeinfo;
-    timeinfo = localtime ( &log->timestamp );
-    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", timeinfo);
-#endif
-    if( strlen(log->proc ) ) {
-
-        char * pcTmp  = log->proc;
-        while (*pcTmp) {
-            if (*pcTmp == ' ') *pcTmp = '_';
-            ++pcTmp;
-        }
-
-        nchar = snprintf(str, MSG_MAX_SIZE_CHAR,"<%d>1 %s %s %s - - %s\r\n", log->pri, date, hostname, log->proc, log->msg);
-    } else {
-        nchar = snprintf(str, MSG_MAX_SIZE_CHAR,"<%d>1 %s %s - - - %s\r\n", log->pri, date, hostname, log->msg);
-    }
-   
-    if( nchar < 0 || nchar > MSG_MAX_SIZE_CHAR )
-        return -1;
-
-    return nchar;
-}
-
-int make_log_string(int format, char* hostname, char* str, log_t* log)
-{
-    switch(format)
-    {
-        case RLOG_RFC3164:
-        return make_rfc3164_string(hostname, str, log);
-        break;
-        case RLOG_RFC5424:
-        return make_rfc5424_log(hostname, str, log);
-        break;
-    }
-
-    return 0;
-}
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "rlog.h"
+#include "format.h"
+
+int make_rfc3164_string(char* hostname, char* str, log_t* log, const char* sd)
+{
+    int nchar = 0;
+    char date[80] = { 0 };
+
+#if RLOG_TIMESTAMP_ENABLE    
+    struct tm timeinfo;
+    localtime_r( &log->timestamp, &timeinfo );
+    strftime(date, sizeof(date), "%b %d %H:%M:%S", &timeinfo);
+#endif
+    if( strlen(log->proc) ) {
+
+        char * pcTmp  = log->proc;
+        while (*pcTmp) {
+            if (*pcTmp == ' ') *pcTmp = '_';
+            ++pcTmp;
+        }
+
+        nchar = snprintf(str, MSG_MAX_SIZE_CHAR,"<%d>%s %s %s: %s%s%s\r\n", log->pri, date, hostname, log->proc, sd, *sd ? " " : "", log->msg);
+    } else {
+        nchar = snprintf(str, MSG_MAX_SIZE_CHAR,"<%d>%s %s -: %s%s%s\r\n", log->pri, date, hostname, sd, *sd ? " " : "", log->msg);
+    }
+   
+    if( nchar < 0 )
+        return -1;
+
+    // snprintf cut the string short, return what was written
+    if( nchar >= MSG_MAX_SIZE_CHAR )
+        nchar = MSG_MAX_SIZE_CHAR - 1;
+
+    return nchar;
+}
+
+int make_rfc5424_log(char* hostname, char* str, log_t* log, const char* sd)
+{
+    int nchar = 0;
+    char date[80] = { 0 };
+
+#if RLOG_TIMESTAMP_ENABLE    
+    struct tm timeinfo;
+    localtime_r( &log->timestamp, &timeinfo );
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &timeinfo);
+#endif
+    if( strlen(log->proc ) ) {
+
+        char * pcTmp  = log->proc;
+        while (*pcTmp) {
+            if (*pcTmp == ' ') *pcTmp = '_';
+            ++pcTmp;
+        }
+
+        nchar = snprintf(str, MSG_MAX_SIZE_CHAR,"<%d>1 %s %s %s - - %s%s%s\r\n", log->pri, date, hostname, log->proc, sd, *sd ? " " : "", log->msg);
+    } else {
+        nchar = snprintf(str, MSG_MAX_SIZE_CHAR,"<%d>1 %s %s - - - %s%s%s\r\n", log->pri, date, hostname, sd, *sd ? " " : "", log->msg);
+    }
+   
+    if( nchar < 0 )
+        return -1;
+
+    // snprintf cut the string short, return what was written
+    if( nchar >= MSG_MAX_SIZE_CHAR )
+        nchar = MSG_MAX_SIZE_CHAR - 1;
+
+    return nchar;
+}
+
+int make_log_string(int format, char* hostname, char* str, log_t* log)
+{
+    return make_log_string_sd(format, hostname, str, log, "");
+}
+
+int make_log_string_sd(int format, char* hostname, char* str, log_t* log, const char* sd)
+{
+    switch(format)
+    {
+        case RLOG_RFC3164:
+        return make_rfc3164_string(hostname, str, log, sd);
+        break;
+        case RLOG_RFC5424:
+        return make_rfc5424_log(hostname, str, log, sd);
+        break;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Append a string to the output, stopping at n characters, at the end
+ * of the string or at the end of the output
+ */
+static
+int safe_puts(char* str, int pos, int size, const char* s, int n, bool proc)
+{
+    for( int i = 0; i < n && s[i] && pos < size; i++ )
+        str[pos++] = (proc && s[i] == ' ') ? '_' : s[i];
+
+    return pos;
+}
+
+/**
+ * @brief Append an unsigned number to the output, zero padded to width digits
+ */
+static
+int safe_putu(char* str, int pos, int size, unsigned long v, int width)
+{
+    char digits[24];
+    int n = 0;
+
+    do {
+        digits[n++] = '0' + (v % 10);
+        v /= 10;
+    } while( v && n < sizeof(digits) );
+
+    while( n < width && n < sizeof(digits) )
+        digits[n++] = '0';
+
+    while( n && pos < size )
+        str[pos++] = digits[--n];
+
+    return pos;
+}
+
+/**
+ * @brief Append the UTC date of a timestamp to the output, without going 
+ * through the time zone database
+ */
+static
+int safe_putdate(char* str, int pos, int size, int format, time_t timestamp)
+{
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    int64_t t = (int64_t) timestamp;
+    int64_t days = t / 86400;
+    int64_t secs = t % 86400;
+
+    if( secs < 0 ) {
+        secs += 86400;
+        days--;
+    }
+
+    // civil date from days since 1970-01-01
+    days += 719468;
+    int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    int64_t doe = days - era * 146097;
+    int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int64_t mp = (5 * doy + 2) / 153;
+    int day = (int)(doy - (153 * mp + 2) / 5 + 1);
+    int month = (int)(mp < 10 ? mp + 3 : mp - 9);
+    int64_t year = yoe + era * 400 + (month <= 2);
+
+    if( format == RLOG_RFC5424 ) 
+    {
+        pos = safe_putu(str, pos, size, (unsigned long) year, 4);
+        pos = safe_puts(str, pos, size, "-", 1, false);
+        pos = safe_putu(str, pos, size, month, 2);
+        pos = safe_puts(str, pos, size, "-", 1, false);
+        pos = safe_putu(str, pos, size, day, 2);
+        pos = safe_puts(str, pos, size, "T", 1, false);
+    } 
+    else 
+    {
+        pos = safe_puts(str, pos, size, &months[(month - 1) * 3], 3, false);
+        pos = safe_puts(str, pos, size, " ", 1, false);
+        pos = safe_putu(str, pos, size, day, 2);
+        pos = safe_puts(str, pos, size, " ", 1, false);
+    }
+
+    pos = safe_putu(str, pos, size, (unsigned long)(secs / 3600), 2);
+    pos = safe_puts(str, pos, size, ":", 1, false);
+    pos = safe_putu(str, pos, size, (unsigned long)(secs / 60 % 60), 2);
+    pos = safe_puts(str, pos, size, ":", 1, false);
+    pos = safe_putu(str, pos, size, (unsigned long)(secs % 60), 2);
+
+    if( format == RLOG_RFC5424 )
+        pos = safe_puts(str, pos, size, "Z", 1, false);
+
+    return pos;
+}
+
+int make_log_string_safe(int format, const char* hostname, char* str, int size, const log_t* log)
+{
+    int pos = 0;
+
+    if( size < 1 )
+        return 0;
+
+    // keep room for the terminating null char
+    size--;
+
+    pos = safe_puts(str, pos, size, "<", 1, false);
+    pos = safe_putu(str, pos, size, log->pri, 0);
+    pos = safe_puts(str, pos, size, format == RLOG_RFC5424 ? ">1 " : ">", 3, false);
+#if RLOG_TIMESTAMP_ENABLE
+    pos = safe_putdate(str, pos, size, format, log->timestamp);
+#endif
+    pos = safe_puts(str, pos, size, " ", 1, false);
+    pos = safe_puts(str, pos, size, hostname, size, false);
+    pos = safe_puts(str, pos, size, " ", 1, false);
+
+    if( log->proc[0] )
+        pos = safe_puts(str, pos, size, log->proc, sizeof(log->proc), true);
+    else
+        pos = safe_puts(str, pos, size, "-", 1, false);
+
+    pos = safe_puts(str, pos, size, format == RLOG_RFC5424 ? " - - " : ": ", 5, false);
+    pos = safe_puts(str, pos, size, log->msg, sizeof(log->msg), false);
+    pos = safe_puts(str, pos, size, "\r\n", 2, false);
+
+    str[pos] = '\0';
+    return pos;
+}
@@ -1,50 +1,72 @@
-#ifndef _RLOG_FORMAT_H_
-#define _RLOG_FORMAT_H_
-
-#include <stdint.h>
-#include <stdbool.h>
-#include <sys/time.h>
-#include "../port/os/osal.h"
-
-/**
- * @brief User defined maximum size of log messages.
- */
-#ifndef RLOG_MAX_SIZE_CHAR
-    #define RLOG_MAX_SIZE_CHAR  80
-#endif
-
-#define MSG_MAX_SIZE_CHAR (RLOG_MAX_SIZE_CHAR + 80)
-
-typedef enum {
-
-    RLOG_RFC3164 = 0,
-    RLOG_RFC5424 = 1,
-    RLOG_NO_FORMAT,
-
-}RLOG_FORMAT;
-
-typedef enum
-{
-    RLOG_EMERGENCY  = 0,    // Emergency: system is unusable
-    RLOG_ALERT      = 1,    // Alert: action must be taken immediately
-    RLOG_CRIT       = 2,    // Critical: critical conditions
-    RLOG_ERROR      = 3,    // Error: error conditions
-    RLOG_WARNING    = 4,    // Warning: warning conditions
-    RLOG_NOTICE     = 5,    // Notice: normal but significant condition
-    RLOG_INFO       = 6,    // Informational: informational messages
-    RLOG_DEBUG      = 7,    // Debug: debug-level message
-
-}RLOG_LEVEL;
-
-typedef struct log_t
-{
-    time_t timestamp;
-    uint8_t pri;
-    char proc[16];  
-    char msg[RLOG_MAX_SIZE_CHAR];
-}log_t;
-
-int make_log_string(int format, char* hostname, char* str, log_t* log);
-
-
+#ifndef _RLOG_FORMAT_H_
+#define _RLOG_FORMAT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/time.h>
+#include "../port/os/osal.h"
+
+/**
+ * @brief User defined maximum size of log messages.
+ */
+#ifndef RLOG_MAX_SIZE_CHAR
+    #define RLOG_MAX_SIZE_CHAR  80
+#endif
+
+#define MSG_MAX_SIZE_CHAR (RLOG_MAX_SIZE_CHAR + 80)
+
+typedef enum {
+
+    RLOG_RFC3164 = 0,
+    RLOG_RFC5424 = 1,
+    RLOG_NO_FORMAT,
+
+}RLOG_FORMAT;
+
+typedef enum
+{
+    RLOG_EMERGENCY  = 0,    // Emergency: system is unusable
+    RLOG_ALERT      = 1,    // Alert: action must be taken immediately
+    RLOG_CRIT       = 2,    // Critical: critical conditions
+    RLOG_ERROR      = 3,    // Error: error conditions
+    RLOG_WARNING    = 4,    // Warning: warning conditions
+    RLOG_NOTICE     = 5,    // Notice: normal but significant condition
+    RLOG_INFO       = 6,    // Informational: informational messages
+    RLOG_DEBUG      = 7,    // Debug: debug-level message
+
+}RLOG_LEVEL;
+
+typedef struct log_t
+{
+    time_t timestamp;
+    uint8_t pri;
+    char proc[16];  
+    char msg[RLOG_MAX_SIZE_CHAR];
+}log_t;
+
+int make_log_string(int format, char* hostname, char* str, log_t* log);
+
+/**
+ * @brief Same as make_log_string with RFC5424 structured data ahead of the
+ * message. RFC3164 has no structured data field, so it is put at the start 
+ * of the message.
+ * 
+ * @param sd Structured data elements, i.e. [id@12345 name="value"], or an 
+ * empty string for none
+ * @return Length of the string written to str, MSG_MAX_SIZE_CHAR - 1 if it 
+ * was truncated, or -1 on error
+ */
+int make_log_string_sd(int format, char* hostname, char* str, log_t* log, const char* sd);
+
+/**
+ * @brief Same as make_log_string but safe to call from a signal handler: it 
+ * takes no lock and allocates nothing. Timestamps are rendered in UTC and the
+ * message is read as is, so a message written at the same time may come out
+ * garbled but never overflows.
+ * 
+ * @return Length of the string written to str, at most size - 1
+ */
+int make_log_string_safe(int format, const char* hostname, char* str, int size, const log_t* log);
+
+
 #endif //_RLOG_FORMAT_H_
\ No newline at end of file
@@ -32,6 +32,10 @@
 #include "freertos/event_groups.h"
 #include <time.h>
 
+#ifdef ESP_PLATFORM
+#include "esp_timer.h"
+#endif
+
 #include "../osal.h"
 
 #define TIME_TO_TICKS(ms) \
@@ -51,8 +55,27 @@ os_thread_t* os_thread_create(
                                 uint32_t stack, 
                                 uint32_t prio
                                 )
+{
+    os_thread_attr_t attr = {
+        .stack = stack,
+        .prio = prio,
+        .affinity = 0,
+        .policy = OS_SCHED_DEFAULT,
+    };
+
+    return os_thread_create_attr(name, task, arg, &attr);
+}
+
+os_thread_t* os_thread_create_attr(
+                                const char * name,
+                                void (*task)(void*), 
+                                void* arg, 
+                                const os_thread_attr_t* attr
+                                )
 {
     TaskHandle_t hTask = NULL;
+    uint32_t stack = attr->stack;
+    uint32_t prio = attr->prio;
 
 #if 0
    /* stacksize in freertos is not in bytes but in stack depth, it should be
@@ -61,6 +84,30 @@ os_thread_t* os_thread_create(
 
     if (xTaskCreate ((TaskFunction_t)task, NULL, stacksize, arg, prio, &hTask) != 1)
     	return NULL;
+#elif defined(ESP_PLATFORM) && portNUM_PROCESSORS > 1
+    // a core that doesn't exist is a configuration error, not a fatal one
+    if( attr->affinity >> portNUM_PROCESSORS )
+        return NULL;
+
+    // tasks can only be pinned to a single core
+    BaseType_t core = tskNO_AFFINITY;
+    if( attr->affinity != 0 && (attr->affinity & (attr->affinity - 1)) == 0 )
+        core = __builtin_ctz(attr->affinity);
+
+    if( xTaskCreatePinnedToCore((TaskFunction_t)task, name, stack, arg, prio, &hTask, core) != pdPASS )
+        return NULL;
+#elif configUSE_CORE_AFFINITY && configNUMBER_OF_CORES > 1
+    // a core that doesn't exist is a configuration error, not a fatal one
+    if( attr->affinity >> configNUMBER_OF_CORES )
+        return NULL;
+
+    BaseType_t ret;
+    if( attr->affinity != 0 )
+        ret = xTaskCreateAffinitySet((TaskFunction_t)task, name, stack, arg, prio, (UBaseType_t)attr->affinity, &hTask);
+    else
+        ret = xTaskCreate((TaskFunction_t)task, name, stack, arg, prio, &hTask);
+    if( ret != pdPASS )
+        return NULL;
 #else
     xTaskCreate((TaskFunction_t)task, name, stack, arg, prio, &hTask);
     OS_ASSERT(hTask != NULL);
@@ -245,6 +292,24 @@ void os_get_date(char* buffer)
     sprintf(buffer, "%02d-%02d-%d %02d:%02d:%02d",timeinfo->tm_mday, timeinfo->tm_mon + 1, timeinfo->tm_year + 1900, timeinfo->tm_hour, timeinfo->tm_min, timeinfo->tm_sec);
 }
 
+uint64_t os_get_time_us(void)
+{
+#ifdef ESP_PLATFORM
+    return (uint64_t) esp_timer_get_time();
+#else
+    return (uint64_t) xTaskGetTickCount() * portTICK_PERIOD_MS * 1000;
+#endif
+}
+
+uint32_t os_get_cpu(void)
+{
+#if portNUM_PROCESSORS > 1
+    return (uint32_t) xPortGetCoreID();
+#else
+    return 0;
+#endif
+}
+
 void os_sleep_us(uint32_t t)
 {
     if(t == 0)
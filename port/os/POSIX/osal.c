@@ -0,0 +1,514 @@
+/**
+ * @file osal.c
+ * @author edsp
+ * @brief OSAL implementation for POSIX threads. Uses the GNU extensions of
+ * Linux for thread names, CPU affinity and the current CPU.
+ * @version 1.0.0
+ * @date 2024-01-10
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "../osal.h"
+
+/**
+ * @brief Minimum thread stack size in bytes. Stack sizes are chosen for
+ * embedded targets, the C library needs more on Linux. Default 64 KiB
+ */
+#ifndef OS_MIN_STACK_SIZE
+    #define OS_MIN_STACK_SIZE (64 * 1024)
+#endif
+
+typedef struct aux_thread
+{
+    pthread_t thread;
+    void (*task)(void*);
+    void* arg;
+    char name[16];
+} aux_thread_t;
+
+typedef struct aux_event
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t bits;
+} aux_event_t;
+
+typedef struct aux_sem
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    size_t count;
+    size_t max;
+} aux_sem_t;
+
+typedef struct aux_timer
+{
+    timer_t handle;
+    uint32_t us;
+    bool oneshot;
+    void(*fn) (os_timer_t *, void * arg);
+    void * arg;
+} aux_timer_t;
+
+/**
+ * @brief Handle of the calling thread, freed when the thread terminates. The
+ * threads are detached, nobody joins them, so callers must drop their copy 
+ * of the handle before the thread returns, see os_thread_create().
+ */
+static pthread_key_t self_key;
+static pthread_once_t self_once = PTHREAD_ONCE_INIT;
+
+static void self_key_create(void)
+{
+    pthread_key_create(&self_key, free);
+}
+
+/**
+ * @brief Absolute CLOCK_MONOTONIC time a timeout in miliseconds expires
+ */
+static void deadline(struct timespec* ts, uint32_t ms)
+{
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (long)(ms % 1000) * 1000000L;
+    if( ts->tv_nsec >= 1000000000L ) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+static void cond_init(pthread_cond_t* cond)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static void* thread_start(void* arg)
+{
+    aux_thread_t* t = (aux_thread_t*)arg;
+
+    pthread_setspecific(self_key, t);
+    pthread_setname_np(pthread_self(), t->name);
+    t->task(t->arg);
+    return NULL;
+}
+
+/**
+ * @brief Set the stack, affinity and scheduling of the attributes
+ *
+ * @param rt Set the real-time scheduling policy, if any
+ */
+static void thread_attr(pthread_attr_t* pattr, const os_thread_attr_t* attr, bool rt)
+{
+    size_t stack = attr->stack;
+    if( stack < OS_MIN_STACK_SIZE )
+        stack = OS_MIN_STACK_SIZE;
+    if( stack < (size_t) PTHREAD_STACK_MIN )
+        stack = PTHREAD_STACK_MIN;
+
+    pthread_attr_init(pattr);
+    pthread_attr_setdetachstate(pattr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(pattr, stack);
+
+    if( attr->affinity != 0 )
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for( int i = 0; i < 32 && i < CPU_SETSIZE; i++ )
+        {
+            if( attr->affinity & (1UL << i) )
+                CPU_SET(i, &set);
+        }
+        pthread_attr_setaffinity_np(pattr, sizeof(set), &set);
+    }
+
+    if( rt && attr->policy != OS_SCHED_DEFAULT )
+    {
+        int policy = (attr->policy == OS_SCHED_FIFO) ? SCHED_FIFO : SCHED_RR;
+        struct sched_param param = { .sched_priority = (int)attr->prio };
+
+        if( param.sched_priority < sched_get_priority_min(policy) )
+            param.sched_priority = sched_get_priority_min(policy);
+        if( param.sched_priority > sched_get_priority_max(policy) )
+            param.sched_priority = sched_get_priority_max(policy);
+
+        pthread_attr_setinheritsched(pattr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(pattr, policy);
+        pthread_attr_setschedparam(pattr, &param);
+    }
+}
+
+os_thread_t* os_thread_create(
+                                const char * name,
+                                void (*task)(void*),
+                                void* arg,
+                                uint32_t stack,
+                                uint32_t prio
+                                )
+{
+    os_thread_attr_t attr = {
+        .stack = stack,
+        .prio = prio,
+        .affinity = 0,
+        .policy = OS_SCHED_DEFAULT,
+    };
+
+    return os_thread_create_attr(name, task, arg, &attr);
+}
+
+os_thread_t* os_thread_create_attr(
+                                const char * name,
+                                void (*task)(void*),
+                                void* arg,
+                                const os_thread_attr_t* attr
+                                )
+{
+    pthread_attr_t pattr;
+    int err;
+
+    pthread_once(&self_once, self_key_create);
+
+    aux_thread_t* t = malloc(sizeof(aux_thread_t));
+    OS_ASSERT(t != NULL);
+
+    t->task = task;
+    t->arg = arg;
+    snprintf(t->name, sizeof(t->name), "%s", name ? name : "");
+
+    thread_attr(&pattr, attr, true);
+    err = pthread_create(&t->thread, &pattr, thread_start, t);
+    pthread_attr_destroy(&pattr);
+
+    // real-time policies need CAP_SYS_NICE, run with the default one instead
+    if( err == EPERM && attr->policy != OS_SCHED_DEFAULT )
+    {
+        thread_attr(&pattr, attr, false);
+        err = pthread_create(&t->thread, &pattr, thread_start, t);
+        pthread_attr_destroy(&pattr);
+    }
+
+    if( err != 0 ) {
+        free(t);
+        return NULL;
+    }
+
+    return (os_thread_t*)t;
+}
+
+void os_thread_destroy(os_thread_t* id)
+{
+    if( id == NULL )
+        pthread_exit(NULL);
+
+    pthread_cancel(((aux_thread_t*)id)->thread);
+}
+
+char* os_thread_get_name(os_thread_t* id)
+{
+    static __thread char name[16];
+
+    if( id == NULL )
+        id = os_get_active_thread();
+
+    if( id != NULL )
+        return ((aux_thread_t*)id)->name;
+
+    // not created by os_thread_create
+    if( pthread_getname_np(pthread_self(), name, sizeof(name)) != 0 )
+        name[0] = '\0';
+    return name;
+}
+
+os_thread_t* os_get_active_thread(void)
+{
+    pthread_once(&self_once, self_key_create);
+    return (os_thread_t*) pthread_getspecific(self_key);
+}
+
+os_mutex_t * os_mutex_create()
+{
+    pthread_mutexattr_t attr;
+
+    pthread_mutex_t* lock = malloc(sizeof(pthread_mutex_t));
+    OS_ASSERT(lock != NULL);
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    return (os_mutex_t*)lock;
+}
+
+void os_mutex_destroy(os_mutex_t* lock)
+{
+    OS_ASSERT(lock != NULL);
+    pthread_mutex_destroy((pthread_mutex_t*)lock);
+    free(lock);
+}
+
+bool os_mutex_lock(os_mutex_t* lock)
+{
+    return pthread_mutex_lock((pthread_mutex_t*)lock) == 0;
+}
+
+bool os_mutex_unlock(os_mutex_t* lock)
+{
+    return pthread_mutex_unlock((pthread_mutex_t*)lock) == 0;
+}
+
+os_event_t* os_event_create()
+{
+    aux_event_t* event = calloc(1, sizeof(aux_event_t));
+    OS_ASSERT(event != NULL);
+
+    pthread_mutex_init(&event->lock, NULL);
+    cond_init(&event->cond);
+    return (os_event_t *)event;
+}
+
+uint32_t os_event_wait(os_event_t * event, uint32_t mask, uint32_t time)
+{
+    aux_event_t* e = (aux_event_t*)event;
+    struct timespec ts;
+    uint32_t bits;
+
+    deadline(&ts, time);
+
+    pthread_mutex_lock(&e->lock);
+    while( (e->bits & mask) == 0 )
+    {
+        if( time == OS_WAIT_FOREVER )
+            pthread_cond_wait(&e->cond, &e->lock);
+        else if( pthread_cond_timedwait(&e->cond, &e->lock, &ts) == ETIMEDOUT )
+            break;
+    }
+    bits = e->bits;
+    pthread_mutex_unlock(&e->lock);
+
+    return bits;
+}
+
+void os_event_set(os_event_t * event, uint32_t value)
+{
+    aux_event_t* e = (aux_event_t*)event;
+
+    pthread_mutex_lock(&e->lock);
+    e->bits |= value;
+    pthread_cond_broadcast(&e->cond);
+    pthread_mutex_unlock(&e->lock);
+}
+
+void os_event_clear(os_event_t * event, uint32_t value)
+{
+    aux_event_t* e = (aux_event_t*)event;
+
+    pthread_mutex_lock(&e->lock);
+    e->bits &= ~value;
+    pthread_mutex_unlock(&e->lock);
+}
+
+void os_event_destroy(os_event_t * event)
+{
+    aux_event_t* e = (aux_event_t*)event;
+
+    pthread_mutex_destroy(&e->lock);
+    pthread_cond_destroy(&e->cond);
+    free(e);
+}
+
+static void timer_callback(union sigval val)
+{
+    aux_timer_t * timer = (aux_timer_t *)val.sival_ptr;
+
+    if (timer->fn)
+        timer->fn (timer, timer->arg);
+}
+
+os_timer_t* os_timer_create(
+                                uint32_t us,
+                                void (*fn) (os_timer_t * timer, void * arg),
+                                void * arg,
+                                bool oneshot
+                                )
+{
+    struct sigevent sev;
+    aux_timer_t * timer;
+
+    timer = malloc (sizeof (aux_timer_t));
+    OS_ASSERT(timer != NULL);
+
+    timer->fn  = fn;
+    timer->arg = arg;
+    timer->us = us;
+    timer->oneshot = oneshot;
+
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_THREAD;
+    sev.sigev_notify_function = timer_callback;
+    sev.sigev_value.sival_ptr = timer;
+
+    int err = timer_create(CLOCK_MONOTONIC, &sev, &timer->handle);
+    OS_ASSERT(err == 0);
+    (void)err;
+
+    return (os_timer_t *)timer;
+}
+
+void os_timer_start(os_timer_t * timer)
+{
+    aux_timer_t* tmp = (aux_timer_t*)timer;
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = tmp->us / 1000000;
+    its.it_value.tv_nsec = (long)(tmp->us % 1000000) * 1000L;
+    if( !tmp->oneshot )
+        its.it_interval = its.it_value;
+
+    timer_settime(tmp->handle, 0, &its, NULL);
+}
+
+void os_timer_stop(os_timer_t * timer)
+{
+    aux_timer_t* tmp = (aux_timer_t*)timer;
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+    timer_settime(tmp->handle, 0, &its, NULL);
+}
+
+void os_timer_destroy(os_timer_t * timer)
+{
+    aux_timer_t* tmp = (aux_timer_t*)timer;
+
+    timer_delete(tmp->handle);
+    free (timer);
+}
+
+os_sem_t * os_sem_create (size_t max, size_t count)
+{
+    aux_sem_t* sem = calloc(1, sizeof(aux_sem_t));
+    OS_ASSERT(sem != NULL);
+
+    pthread_mutex_init(&sem->lock, NULL);
+    cond_init(&sem->cond);
+    sem->max = max;
+    sem->count = count;
+    return (os_sem_t *)sem;
+}
+
+bool os_sem_wait(os_sem_t * sem, uint32_t time)
+{
+    aux_sem_t* s = (aux_sem_t*)sem;
+    struct timespec ts;
+    bool taken = true;
+
+    deadline(&ts, time);
+
+    pthread_mutex_lock(&s->lock);
+    while( s->count == 0 )
+    {
+        if( time == OS_WAIT_FOREVER ) {
+            pthread_cond_wait(&s->cond, &s->lock);
+        } else if( pthread_cond_timedwait(&s->cond, &s->lock, &ts) == ETIMEDOUT ) {
+            /* Timed out */
+            taken = false;
+            break;
+        }
+    }
+
+    if( taken )
+        s->count--;
+    pthread_mutex_unlock(&s->lock);
+
+    return taken;
+}
+
+void os_sem_signal(os_sem_t * sem)
+{
+    aux_sem_t* s = (aux_sem_t*)sem;
+
+    pthread_mutex_lock(&s->lock);
+    if( s->count < s->max )
+        s->count++;
+    pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+}
+
+void os_sem_destroy(os_sem_t * sem)
+{
+    aux_sem_t* s = (aux_sem_t*)sem;
+
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->cond);
+    free(s);
+}
+
+void os_get_date(char* buffer)
+{
+    time_t rawtime;
+    struct tm timeinfo;
+
+    time ( &rawtime );
+    localtime_r ( &rawtime, &timeinfo );
+    sprintf(buffer, "%02d-%02d-%d %02d:%02d:%02d",timeinfo.tm_mday, timeinfo.tm_mon + 1, timeinfo.tm_year + 1900, timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec);
+}
+
+uint64_t os_get_time_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint32_t os_get_cpu(void)
+{
+    int cpu = sched_getcpu();
+    return (cpu < 0) ? 0 : (uint32_t) cpu;
+}
+
+void os_sleep_us(uint32_t t)
+{
+    if(t == 0)
+    {
+        sched_yield();
+    }
+    else
+    {
+        struct timespec ts = {
+            .tv_sec = t / 1000000,
+            .tv_nsec = (long)(t % 1000000) * 1000L,
+        };
+        while( nanosleep(&ts, &ts) != 0 && errno == EINTR );
+    }
+}
\ No newline at end of file
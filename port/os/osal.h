@@ -41,6 +41,45 @@ typedef void os_event_t;
 typedef void os_timer_t;
 typedef void os_sem_t;
 
+/**
+ * @brief Thread scheduling policy
+ */
+typedef enum os_sched_t
+{
+    OS_SCHED_DEFAULT = 0,   // Default policy of the OS
+    OS_SCHED_FIFO,          // Real-time, runs until it blocks or yields
+    OS_SCHED_RR,            // Real-time, time sliced with equal priorities
+} os_sched_t;
+
+/**
+ * @brief Thread attributes, see os_thread_create_attr()
+ */
+typedef struct os_thread_attr_t
+{
+    /**
+     * @brief Stack size in bytes
+     */
+    uint32_t stack;
+
+    /**
+     * @brief Thread priority. With OS_SCHED_FIFO and OS_SCHED_RR on systems 
+     * that have them, the real-time priority of the thread.
+     */
+    uint32_t prio;
+
+    /**
+     * @brief Bit mask of the CPU cores the thread may run on, bit 0 for 
+     * core 0. 0 to let the scheduler choose.
+     */
+    uint32_t affinity;
+
+    /**
+     * @brief Scheduling policy. Ignored on systems with a single policy.
+     */
+    os_sched_t policy;
+
+} os_thread_attr_t;
+
 /**
  * @brief Create a thread.
  * 
@@ -49,7 +88,8 @@ typedef void os_sem_t;
  * @param arg Argument to pass to task
  * @param stack Stack size in bytes
  * @param prio Thread priority
- * @return Pointer to thread handle
+ * @return Pointer to thread handle. It is only valid while the thread runs,
+ * it must not be used nor compared once the thread terminated.
  */
 os_thread_t* os_thread_create(
                                 const char * name, 
@@ -59,10 +99,30 @@ os_thread_t* os_thread_create(
                                 uint32_t prio
                                 );
 
+/**
+ * @brief Create a thread with CPU affinity and scheduling policy. Systems 
+ * that can only pin a thread to a single core ignore affinity masks with 
+ * several cores set.
+ * 
+ * @param name Thread name
+ * @param task Function to execute
+ * @param arg Argument to pass to task
+ * @param attr Thread attributes
+ * @return Pointer to thread handle, NULL if it could not be created, i.e. 
+ * the affinity mask has a core that doesn't exist. Same lifetime as the one
+ * of os_thread_create().
+ */
+os_thread_t* os_thread_create_attr(
+                                const char * name, 
+                                void (*task)(void*), 
+                                void* arg, 
+                                const os_thread_attr_t* attr
+                                );
+
 /**
  * @brief Destroy a thread
  * 
- * @param id Pointer to thread handle
+ * @param id Pointer to thread handle. If set to NULL the calling thread is destroyed.
  */
 void os_thread_destroy(os_thread_t* id);
 
@@ -223,6 +283,21 @@ void os_sem_destroy (os_sem_t * sem);
  */
 void os_get_date(char* buffer);
 
+/**
+ * @brief Monotonic time since boot, not affected by changes of the date time.
+ * 
+ * @return Time in microseconds
+ */
+uint64_t os_get_time_us(void);
+
+/**
+ * @brief Index of the CPU core running the calling thread. The thread may 
+ * be moved to another core right after, so use it as a hint only.
+ * 
+ * @return Core index, 0 on single core systems
+ */
+uint32_t os_get_cpu(void);
+
 /**
  * @brief Suspend execution for microsecond intervals
  * 
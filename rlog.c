@@ -24,14 +24,14 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
 
 #include "rlog.h"
 #include "port/os/osal.h"
-
-#if RLOG_DLOG_ENABLE
-    #define DLOG_LINE_MAX_SIZE MSG_MAX_SIZE_CHAR
-    #include "dlog/dlog.h"
-#endif
+#include "backlog/backlog.h"
 
 #ifndef _RLOG_DBG_
     #define _RLOG_DBG_    0
@@ -61,6 +61,79 @@
     #define RLOG_QUEUE_SIZE 10
 #endif
 
+/**
+ * @brief Capacity of each severity class of the message queue, at least 1. 
+ * Messages with level RLOG_ERROR or more severe, from RLOG_WARNING to 
+ * RLOG_INFO and RLOG_DEBUG messages are queued separately, so a flood of one
+ * class only overwrites messages of the same class. By default the classes 
+ * share RLOG_QUEUE_SIZE: half of it for errors, a third for RLOG_INFO and the
+ * rest for RLOG_DEBUG, so a shard takes the same RAM as a single queue of 
+ * RLOG_QUEUE_SIZE messages. Each slot holds a log_t, a bit more than 
+ * RLOG_MAX_SIZE_CHAR bytes, raising a class raises the RAM of every shard
+ */
+#ifndef RLOG_QUEUE_SIZE_ERROR
+    #define RLOG_QUEUE_SIZE_ERROR \
+        ((RLOG_QUEUE_SIZE) / 2 > 0 ? (RLOG_QUEUE_SIZE) / 2 : 1)
+#endif
+
+#ifndef RLOG_QUEUE_SIZE_INFO
+    #define RLOG_QUEUE_SIZE_INFO \
+        ((RLOG_QUEUE_SIZE) / 3 > 0 ? (RLOG_QUEUE_SIZE) / 3 : 1)
+#endif
+
+#ifndef RLOG_QUEUE_SIZE_DEBUG
+    #define RLOG_QUEUE_SIZE_DEBUG \
+        ((RLOG_QUEUE_SIZE) - (RLOG_QUEUE_SIZE) / 2 - (RLOG_QUEUE_SIZE) / 3 > 0 ? \
+         (RLOG_QUEUE_SIZE) - (RLOG_QUEUE_SIZE) / 2 - (RLOG_QUEUE_SIZE) / 3 : 1)
+#endif
+
+/**
+ * @brief The rlog thread sends the most severe class of queued messages 
+ * first. Once this many messages went ahead of a message of a less severe 
+ * class, that one is sent next, so a flood of errors can't hold back the 
+ * other classes for ever. Set to 0 to always send the most severe class
+ * first. Default 8
+ */
+#ifndef RLOG_QUEUE_QUOTA
+    #define RLOG_QUEUE_QUOTA 8
+#endif
+
+/**
+ * @brief Fill level of a severity class, in percent of its capacity, at which
+ * the rlog thread moves the oldest messages to the backlog instead of letting
+ * new messages overwrite them. Only used if RLOG_DLOG_ENABLE is set to 1. Set
+ * to 0 to disable. Default 75
+ */
+#ifndef RLOG_QUEUE_HIGH_WATERMARK
+    #define RLOG_QUEUE_HIGH_WATERMARK 75
+#endif
+
+/**
+ * @brief Fill level of a severity class, in percent of its capacity, left 
+ * once the excess was moved to the backlog. Default 25
+ */
+#ifndef RLOG_QUEUE_LOW_WATERMARK
+    #define RLOG_QUEUE_LOW_WATERMARK 25
+#endif
+
+/**
+ * @brief Watermarks in number of messages of a class of the given capacity.
+ * The high one is rounded up so that it is never 0.
+ */
+#define QUEUE_HIGH_WATERMARK(size) (((size) * RLOG_QUEUE_HIGH_WATERMARK + 99) / 100)
+#define QUEUE_LOW_WATERMARK(size) ((size) * RLOG_QUEUE_LOW_WATERMARK / 100)
+
+/**
+ * @brief Number of message queue shards. Each thread queues its messages on
+ * the shard of the CPU core it runs on, so producers on different cores don't
+ * contend for the same lock and cache lines. The rlog thread takes messages 
+ * from the shards in the order they were queued. Each shard holds all 
+ * severity classes. Default 1
+ */
+#ifndef RLOG_QUEUE_SHARDS
+    #define RLOG_QUEUE_SHARDS 1
+#endif
+
 /**
  * @brief Enable (1) or disable (0) the sending of periodic heartbeat messages
  */
@@ -77,15 +150,141 @@
     #endif
 #endif
 
-#ifndef RLOG_MAX_NUM_IFC
-    #define RLOG_MAX_NUM_IFC 2
+/**
+ * @brief RFC5424 structured data ID of the heartbeat metrics. The default 
+ * uses the private enterprise number reserved for documentation (RFC5612), 
+ * replace it with your own. The metrics are left out if the heartbeat does
+ * not fit in MSG_MAX_SIZE_CHAR, see RLOG_MAX_SIZE_CHAR.
+ */
+#ifndef RLOG_HEARTBEAT_SD_ID
+    #define RLOG_HEARTBEAT_SD_ID "rlog@32473"
+#endif
+
+/**
+ * @brief Dispatch lane worker stack size. Default RLOG_STACK_SIZE
+ */
+#ifndef RLOG_LANE_STACK_SIZE
+    #define RLOG_LANE_STACK_SIZE RLOG_STACK_SIZE
+#endif
+
+/**
+ * @brief Period in miliseconds an idle dispatch lane polls its interface
+ */
+#define LANE_POLLING_PERIOD 1000
+
+/**
+ * @brief Window over which the replay rate is measured
+ */
+#define REPLAY_RATE_WINDOW_US 1000000
+
+/**
+ * @brief Time in miliseconds rlog_shutdown() waits past its timeout for the 
+ * rlog thread to move the remaining messages to the backlog and terminate
+ */
+#ifndef RLOG_SHUTDOWN_GRACE_MS
+    #define RLOG_SHUTDOWN_GRACE_MS 1000
 #endif
 
-#define MSG_QUEUE_SIZE RLOG_QUEUE_SIZE
+#define MSG_QUEUE_SIZE (RLOG_QUEUE_SIZE_ERROR + RLOG_QUEUE_SIZE_INFO + RLOG_QUEUE_SIZE_DEBUG)
+
+/**
+ * @brief Number of severity classes of the message queue, see queue_class()
+ */
+#define QUEUE_CLASSES 3
+
+/**
+ * @brief Alignment of the queue shards, so that two of them never share a 
+ * cache line
+ */
+#define QUEUE_ALIGN 64
 
 #define EVENT_NEW_MSG           ( 1 << 0 )
-#define EVENTS_MASK             ( EVENT_NEW_MSG )
+#define EVENT_IFC_CHANGED       ( 1 << 1 )
+#define EVENT_TERMINATE         ( 1 << 2 )
+#define EVENTS_MASK             ( EVENT_NEW_MSG | EVENT_IFC_CHANGED | EVENT_TERMINATE )
+
+
+/**
+ * @brief Interface counters, updated with relaxed atomics by the thread that
+ * calls the send function and read by rlog_get_stats()
+ */
+struct ifc_stats_s
+{
+    atomic_uint     sent;
+    atomic_uint     failed;
+    atomic_uint     dropped;
+    atomic_uint     latency[RLOG_LATENCY_BUCKETS];
+    atomic_uint_fast64_t latency_us;
+};
+
+/**
+ * @brief Dispatch lane. A bounded queue of rendered messages and a worker
+ * thread that owns all calls to the poll and send functions of one interface, 
+ * so a slow interface cannot stall the delivery to the others.
+ */
+typedef struct rlog_lane_t
+{
+    /**
+     * @brief Protects the ring buffer and the counters
+     */
+    os_mutex_t*     lock;
+
+    /**
+     * @brief Counts the messages waiting in the ring buffer
+     */
+    os_sem_t*       items;
+
+    /**
+     * @brief Signaled by the worker once it has terminated
+     */
+    os_sem_t*       done;
+
+    os_thread_t*    thread_handle;
+    rlog_ifc_t      ifc;
+    atomic_bool     terminate;
+
+    /**
+     * @brief Last result of the interface poll function, read by rlog_poll()
+     */
+    atomic_bool     up;
+
+    char*           buffer;
+    int*            len;
+
+    /**
+     * @brief Time each message was queued, 0 for replayed messages
+     */
+    uint64_t*       stamp;
+
+    unsigned int    depth;
+    unsigned int    head;
+    unsigned int    tail;
 
+    /**
+     * @brief Number of direct messages, they are the oldest ones in the ring
+     * buffer, see lane_put()
+     */
+    unsigned int    urgent;
+
+    /**
+     * @brief Changed with the lock held, also read by the worker without it
+     * to decide whether to terminate
+     */
+    atomic_uint     cnt;
+
+    rlog_lane_stats_t stats;
+
+    /**
+     * @brief Counters of the interface, see rlog_get_stats()
+     */
+    struct ifc_stats_s* counters;
+
+    /**
+     * @brief Worker copy of the message being sent
+     */
+    char            msg[MSG_MAX_SIZE_CHAR];
+
+}rlog_lane_t;
 
 /**
  * @brief Communication interface control block
@@ -95,26 +294,156 @@ static struct
     rlog_ifc_t ifc[RLOG_MAX_NUM_IFC];
     bool up[RLOG_MAX_NUM_IFC];
 
+    /**
+     * @brief Dispatch lane of each interface, NULL if the interface is 
+     * served directly by the rlog thread.
+     */
+    rlog_lane_t* lane[RLOG_MAX_NUM_IFC];
+
+    /**
+     * @brief Lanes taken off the interfaces by rlog_deinit() whose worker 
+     * did not terminate in time. They still count in stats.
+     */
+    rlog_lane_t* stuck[RLOG_MAX_NUM_IFC];
+
+    struct ifc_stats_s stats[RLOG_MAX_NUM_IFC];
+
+    /**
+     * @brief Number of interfaces that don't notify changes and have to be
+     * polled periodically by the rlog thread
+     */
+    unsigned char polled;
+
 } coms;
 static unsigned char n_ifc = 0; //empty
 
 /**
- * @brief Ring buffer implementation
+ * @brief Ring buffer implementation, one per severity class of a shard
  */
-struct queue_s
+struct queue_class_s
 {
     unsigned int    tail;
     unsigned int    head;
+    unsigned int    cnt;
+    unsigned int    size;
+    log_t*          buffer;
+
+    /**
+     * @brief Time each message was queued, to merge the shards and measure
+     * the latency of the interfaces
+     */
+    uint64_t*       stamp;
+};
+
+/**
+ * @brief Message queue shard
+ */
+struct __attribute__((aligned(QUEUE_ALIGN))) queue_s
+{
+    /**
+     * @brief Protects the ring buffers and the counters
+     */
+    os_mutex_t*     lock;
+
+    /**
+     * @brief Ring buffers from the most to the least severe class
+     */
+    struct queue_class_s cls[QUEUE_CLASSES];
+
+    /**
+     * @brief Storage of the ring buffers
+     */
     log_t           buffer[MSG_QUEUE_SIZE];
+
+    /**
+     * @brief Number of queued messages of all classes
+     */
     unsigned int    cnt;
     unsigned int    ovf;
     unsigned int    max_cnt;
+
+    /**
+     * @brief Number of messages queued so far
+     */
+    unsigned int    enq;
+
+    /**
+     * @brief Number of queued messages with level RLOG_URGENT_LEVEL or more severe
+     */
+    unsigned int    urgent;
+
+    /**
+     * @brief Number of messages moved to the backlog above the high watermark
+     */
+    unsigned int    spill;
+
+    /**
+     * @brief Time the oldest message was queued, only kept if batching is enabled
+     */
+    uint64_t        first_us;
+
+    /**
+     * @brief Set when a message that must be sent right away was queued
+     */
+    bool            flush;
+
+    /**
+     * @brief Storage of the queue times of the ring buffers
+     */
+    uint64_t        stamp[MSG_QUEUE_SIZE];
+};
+
+/**
+ * @brief Adaptive batching of live messages, see rlog_cfg_t::batch_nlogs
+ */
+static struct
+{
+    /**
+     * @brief Maximum batch size, 0 if batching is disabled
+     */
+    unsigned int    nlogs;
+
+    /**
+     * @brief Maximum time a message waits for its batch
+     */
+    uint64_t        us;
+
+    /**
+     * @brief Messages with this level or more severe are sent right away
+     */
+    RLOG_LEVEL      level;
+
+    /**
+     * @brief Current batch size, between 1 and nlogs
+     */
+    unsigned int    size;
+
+    /**
+     * @brief Time the last batch was sent
+     */
+    uint64_t        last_us;
+
+} batch;
+
+/**
+ * @brief Message queue, one shard per CPU core
+ */
+static struct queue_s   msg_queue[RLOG_QUEUE_SHARDS];
+
+/**
+ * @brief Capacity of each severity class
+ */
+static const unsigned int queue_class_size[QUEUE_CLASSES] = {
+    RLOG_QUEUE_SIZE_ERROR,
+    RLOG_QUEUE_SIZE_INFO,
+    RLOG_QUEUE_SIZE_DEBUG,
 };
 
 /**
- * @brief Message queue
+ * @brief Number of messages sent ahead of the waiting messages of each 
+ * class, see RLOG_QUEUE_QUOTA. Only used by the rlog thread.
  */
-static struct queue_s   msg_queue;
+static unsigned int queue_starved[QUEUE_CLASSES];
 
 /**
  * @brief  Message buffer
@@ -122,21 +451,113 @@ static struct queue_s   msg_queue;
 static char msg_buffer[MSG_MAX_SIZE_CHAR] = { 0 };
 
 /**
- * @brief Heartbeat timer counter
+ * @brief Time the last message taken from the queue was queued
+ */
+static uint64_t queue_stamp = 0;
+
+/**
+ * @brief Counters of the rlog thread, see rlog_get_stats()
+ */
+static struct
+{
+    /**
+     * @brief Messages that could not be stored in the backlog
+     */
+    atomic_uint     dropped;
+
+    /**
+     * @brief Messages handed to at least one interface
+     */
+    atomic_uint     sent;
+
+    /**
+     * @brief Messages replayed from the backlog
+     */
+    atomic_uint     replayed;
+
+    /**
+     * @brief Messages replayed per second over the last complete window of 
+     * REPLAY_RATE_WINDOW_US and the time in miliseconds that window ended,
+     * wrapping around
+     */
+    atomic_uint     replay_rate;
+    atomic_uint     replay_rate_ms;
+
+    /**
+     * @brief Current window start and count
+     */
+    uint64_t        window_us;
+    unsigned int    window_n;
+
+} counters;
+
+/**
+ * @brief Time the next heartbeat is due
  */
 #if RLOG_HEARTBEAT
-static int  heartbeat_timer = 0;
+static uint64_t heartbeat_deadline = 0;
+
+/**
+ * @brief Counters at the time of the last heartbeat
+ */
+static rlog_stats_t heartbeat_stats;
 #endif
 
 /**
- * @brief server thread handle
+ * @brief Backlog replay rate limit in messages per second, 0 for no limit
+ */
+static unsigned int replay_rate = 0;
+
+/**
+ * @brief Time the last replayed message was due, used to pace the replay
+ */
+static uint64_t replay_time = 0;
+
+/**
+ * @brief Set when queued messages were moved to the backlog and wait to be replayed
+ */
+static bool spilled = false;
+
+/**
+ * @brief File descriptor for rlog_panic_flush(), 0 to use the backlog
+ */
+static int panic_fd = 0;
+
+/**
+ * @brief Messages with direct_level or more severe skip the queue if direct
+ * is set, see rlog_cfg_t::direct
+ */
+static bool direct = false;
+static RLOG_LEVEL direct_level = RLOG_EMERGENCY;
+
+/**
+ * @brief server thread handle, cleared by the thread itself before it 
+ * terminates as the handle is not valid past that
+ */
+static _Atomic(os_thread_t*) thread_handle;
+
+/**
+ * @brief Signaled by the server thread once it has terminated
+ */
+static os_sem_t* thread_done = NULL;
+
+/**
+ * @brief Set by rlog_shutdown() once thread_done was signaled
  */
-static os_thread_t* thread_handle;
+static bool thread_joined = false;
 
 /**
- * @brief mutual exclusion semaphore
+ * @brief Set once the interfaces are de-initialized and the backlog is 
+ * closed, by the rlog thread or by rlog_shutdown() if some lane worker did 
+ * not terminate in time
  */
-static os_mutex_t*  queue_lock = NULL;
+static bool released = false;
+
+/**
+ * @brief Until when queued messages are still sent after termination was 
+ * requested, 0 to drop them right away. See rlog_shutdown().
+ */
+static uint64_t shutdown_deadline = 0;
 
 /**
  * @brief Mutex to control access to the comms interface list
@@ -151,12 +572,30 @@ static os_event_t* wakeup_events;
 /**
  * @brief Signals the thread must terminate.
  */
-static bool terminate = false;
+static atomic_bool terminate = false;
+
+/**
+ * @brief Life cycle of the server
+ */
+typedef enum {
+
+    RLOG_STATE_DOWN = 0,    ///< Not initialized or released
+    RLOG_STATE_UP,          ///< Messages are accepted
+    RLOG_STATE_STOPPING,    ///< Messages are dropped, objects still alive
+
+}RLOG_STATE;
+
+/**
+ * @brief Current RLOG_STATE of the server
+ */
+static atomic_int state = RLOG_STATE_DOWN;
 
 /**
- * @brief Indicate the server has already been intialized
+ * @brief Number of threads inside rlog(), rlogf(), rlog_get_stats(), 
+ * rlog_get_lane_stats() or rlog_install_interface() past the state check, 
+ * rlog_shutdown() waits for them before destroying anything they may use
  */
-static bool initialized = false;
+static atomic_uint callers;
 
 /**
  * @brief Device hostname, can be an IP or some other designator 
@@ -173,14 +612,6 @@ static RLOG_LEVEL filter = RLOG_DEBUG;
  */
 static RLOG_FORMAT log_format = RLOG_RFC3164;
 
-#if RLOG_DLOG_ENABLE
-/**
- * @brief If backup logging is enabled we shall use
- * dlog to store messages when disconnected.
- */
-static dlog_t logger;
-#endif
-
 /**
  * @brief Initializes the queue
  */
@@ -189,8 +620,9 @@ static void queue_init(void);
 /**
  * @brief Put a c string on the queue
  * @param msg Buffer holding the null-terminated string
+ * @return true If the rlog thread must be woken up
  */
-static void  queue_put(log_t log, const char* msg);
+static bool queue_put(log_t log, const char* msg);
 
 /**
  * @brief Composes a string based on a format string and args
@@ -198,16 +630,47 @@ static void  queue_put(log_t log, const char* msg);
  * @param log Log metadata
  * @param format Format string
  * @param args Argument list
+ * @return true If the rlog thread must be woken up
  */
-static void queue_putf(log_t log, const char* format,  va_list args);
+static bool queue_putf(log_t log, const char* format,  va_list args);
+
+/**
+ * @brief Removes a message from the queue without rendering it
+ * 
+ * @param log Pointer to hold the message
+ * @return true If there was a message in the queue
+ */
+static bool queue_pop(log_t* log);
 
 /**
  * @brief Removes a message from the queue
  * 
  * @param msg Buffer to hold the null-terminated string
+ * @param log Pointer to hold the message before rendering
  * @return Length of the received message 
  */
-static int  queue_get(char* msg);
+static int  queue_get(char* msg, log_t* log);
+
+/**
+ * @brief Send message to all interfaces that are initialized to receive
+ * 
+ * @param buf Buffer with message to be sent
+ * @param len Size of the message in bytes
+ * @param stamp Time the message was queued, 0 if it was replayed
+ * @param front Put the message at the front of the dispatch lanes
+ * @return true If at least one interface has received the message
+ * @return false If no interface has received the message
+ */
+static bool send_to_interfaces(const void* buf, int len, uint64_t stamp, bool front);
+
+/**
+ * @brief Deinitialize all installed interfaces. Can be called again for the
+ * interfaces whose lane worker did not terminate in time.
+ * 
+ * @param timeout Time in miliseconds to wait for each lane worker
+ * @return false If a lane worker is stuck in its interface, see coms.stuck
+ */
+static bool rlog_deinit(uint32_t timeout);
 
 /**
  * @brief Main thread to receive new log messages and dispatch
@@ -257,445 +720,2143 @@ void fast_strncpy(char* dst, const char* src, size_t n)
 static
 void queue_init(void)
 {
-    msg_queue.head = 0;
-    msg_queue.tail = 0;
-    msg_queue.cnt = 0;
-    msg_queue.ovf = 0;  
-    msg_queue.max_cnt = 0; 
-}
+    for( int i = 0; i < RLOG_QUEUE_SHARDS; i++ )
+    {
+        struct queue_s* q = &msg_queue[i];
+        unsigned int base = 0;
 
-static
-void queue_put(log_t log, const char* msg)
-{
-    bool full = false;
-    os_mutex_lock(queue_lock);
+        for( int c = 0; c < QUEUE_CLASSES; c++ )
+        {
+            struct queue_class_s* k = &q->cls[c];
+
+            k->head = 0;
+            k->tail = 0;
+            k->cnt = 0;
+            k->size = queue_class_size[c];
+            k->buffer = &q->buffer[base];
+            k->stamp = &q->stamp[base];
+            base += k->size;
+        }
 
-    if( msg_queue.cnt < MSG_QUEUE_SIZE ) {
-        msg_queue.cnt++;
-    } else {
-        msg_queue.ovf++;
-        full = true;
+        q->cnt = 0;
+        q->ovf = 0;  
+        q->max_cnt = 0; 
+        q->enq = 0;
+        q->urgent = 0;
+        q->spill = 0;
+        q->first_us = 0;
+        q->flush = false;
+        q->lock = os_mutex_create();
     }
 
-    msg_queue.buffer[msg_queue.tail].timestamp = log.timestamp;
-    msg_queue.buffer[msg_queue.tail].pri = log.pri;
-    const char* name = os_thread_get_name(NULL);
-    fast_strncpy(msg_queue.buffer[msg_queue.tail].proc, name, sizeof(msg_queue.buffer[msg_queue.tail].proc));
-    fast_strncpy(msg_queue.buffer[msg_queue.tail].msg, msg, sizeof(msg_queue.buffer[msg_queue.tail].msg));
+    for( int c = 0; c < QUEUE_CLASSES; c++ )
+        queue_starved[c] = 0;
+}
+
+/**
+ * @brief Select the shard of the calling thread
+ */
+static inline
+struct queue_s* queue_shard(void)
+{
+#if RLOG_QUEUE_SHARDS > 1
+    return &msg_queue[os_get_cpu() % RLOG_QUEUE_SHARDS];
+#else
+    return &msg_queue[0];
+#endif
+}
 
-    if( (msg_queue.tail == msg_queue.head) && full )
-        msg_queue.head = (msg_queue.head + 1) % MSG_QUEUE_SIZE;
+/**
+ * @brief Select the severity class of a message
+ * 
+ * @return 0 for RLOG_ERROR or more severe, 1 for RLOG_WARNING to RLOG_INFO
+ * and 2 for RLOG_DEBUG
+ */
+static inline
+int queue_class(uint8_t pri)
+{
+    uint8_t level = pri & 0x07;
 
-    msg_queue.tail = (msg_queue.tail + 1) % MSG_QUEUE_SIZE;
-    
-    os_mutex_unlock(queue_lock);
+    if( level <= RLOG_ERROR )
+        return 0;
+    if( level <= RLOG_INFO )
+        return 1;
+    return 2;
 }
 
+/**
+ * @brief Select the shard with the oldest message of a class
+ * 
+ * @param c Severity class
+ * @return Pointer to the shard, NULL if the class is empty in all of them
+ */
 static
-void queue_putf(log_t log, const char* format,  va_list args)
+struct queue_s* queue_oldest(int c)
 {
-    bool full = false;
+#if RLOG_QUEUE_SHARDS > 1
+    struct queue_s* oldest = NULL;
 
-    os_mutex_lock(queue_lock);
+    // a stale read only changes the order of messages queued at about the
+    // same time, the shard is checked again once locked
+    for( int i = 0; i < RLOG_QUEUE_SHARDS; i++ )
+    {
+        struct queue_class_s* k = &msg_queue[i].cls[c];
+        if( k->cnt == 0 )
+            continue;
 
-    if( msg_queue.cnt < MSG_QUEUE_SIZE ) {
-        msg_queue.cnt++;
-    } else {
-        msg_queue.ovf++;
-        full = true;
+        if( oldest == NULL || 
+            k->stamp[k->head] < oldest->cls[c].stamp[oldest->cls[c].head] )
+            oldest = &msg_queue[i];
     }
-    msg_queue.buffer[msg_queue.tail].timestamp = log.timestamp;
-    msg_queue.buffer[msg_queue.tail].pri = log.pri;
-    const char* name = os_thread_get_name(NULL);
-    fast_strncpy(msg_queue.buffer[msg_queue.tail].proc, name, sizeof(msg_queue.buffer[msg_queue.tail].proc));
-    vsnprintf(msg_queue.buffer[msg_queue.tail].msg, sizeof(msg_queue.buffer[msg_queue.tail].msg), format, args);
-
-    if( (msg_queue.tail == msg_queue.head) && full )
-         msg_queue.head = (msg_queue.head + 1) % MSG_QUEUE_SIZE;
-
-    msg_queue.tail = (msg_queue.tail + 1) % MSG_QUEUE_SIZE;
-    
-    os_mutex_unlock(queue_lock);
+    return oldest;
+#else
+    return msg_queue[0].cls[c].cnt ? &msg_queue[0] : NULL;
+#endif
 }
 
+/**
+ * @brief Select the class to send from next: the most severe one with queued
+ * messages, unless a less severe one already waited for RLOG_QUEUE_QUOTA 
+ * messages.
+ * 
+ * @return Severity class, -1 if the queue is empty
+ */
 static
-int queue_get(char* msg)
+int queue_next_class(void)
 {
-    log_t log;
+    int next = -1;
 
-    os_mutex_lock(queue_lock);
+    for( int c = 0; c < QUEUE_CLASSES; c++ )
+    {
+        if( queue_oldest(c) == NULL ) {
+            queue_starved[c] = 0;
+            continue;
+        }
 
-    if( msg_queue.cnt == 0 )
-    {   
-        os_mutex_unlock(queue_lock); 
-        return 0;
+        if( next < 0 )
+            next = c;
+        else if( RLOG_QUEUE_QUOTA && queue_starved[c] >= RLOG_QUEUE_QUOTA )
+            return c;
     }
+    return next;
+}
 
-    log.timestamp = msg_queue.buffer[msg_queue.head].timestamp;
-    log.pri = msg_queue.buffer[msg_queue.head].pri;
-    fast_strncpy(log.proc, msg_queue.buffer[msg_queue.head].proc, sizeof(msg_queue.buffer[msg_queue.head].proc));
-    fast_strncpy(log.msg, msg_queue.buffer[msg_queue.head].msg, sizeof(msg_queue.buffer[msg_queue.head].msg));
-
-    msg_queue.head = (msg_queue.head + 1) % MSG_QUEUE_SIZE;
-    msg_queue.cnt--;
-    os_mutex_unlock(queue_lock);
-
-    make_log_string(log_format, hostname, msg, &log);
-    return strlen(msg);
+/**
+ * @brief Count a message taken from a class against the quota of the less 
+ * severe classes still waiting
+ */
+static
+void queue_served(int c)
+{
+    queue_starved[c] = 0;
+    for( int i = c + 1; i < QUEUE_CLASSES; i++ )
+    {
+        if( queue_oldest(i) != NULL )
+            queue_starved[i]++;
+    }
 }
 
-bool rlog_init(rlog_cfg_t cfg)
+/**
+ * @brief Check if a message must skip its turn, see RLOG_URGENT_LEVEL
+ */
+static inline
+bool is_urgent(uint8_t pri)
 {
-    OS_ASSERT(initialized == false);
+    return (pri & 0x07) <= RLOG_URGENT_LEVEL;
+}
 
-    // set log format
-    if( cfg.format >= RLOG_NO_FORMAT ) {   
-        DBG_PRINTF("[RLOG] Invalid configuration: format! \n"); 
-        return false;
-    }
-    log_format = cfg.format;
+/**
+ * @brief Update the count of urgent messages before writing the queue tail.
+ * Must be called with the shard locked.
+ */
+static
+void queue_count_urgent(struct queue_s* q, struct queue_class_s* k, uint8_t pri, bool full)
+{
+    // the oldest message is about to be overwritten
+    if( full && is_urgent(k->buffer[k->tail].pri) )
+        q->urgent--;
 
-    // set log level filter
-    filter = cfg.level;
+    if( is_urgent(pri) )
+        q->urgent++;
+}
 
-    // set device name
-    if( !set_device_name(cfg.name) ){
-        DBG_PRINTF("[RLOG] Invalid configuration: name! \n"); 
-        return false;
+/**
+ * @brief Check if there are urgent messages in the queue
+ */
+static
+bool queue_has_urgent(void)
+{
+    // a stale read only delays the message by one replayed message
+    for( int i = 0; i < RLOG_QUEUE_SHARDS; i++ )
+    {
+        if( msg_queue[i].urgent > 0 )
+            return true;
     }
+    return false;
+}
 
-    // create kernel objects...
+/**
+ * @brief Check if the rlog thread must be woken up for the message just 
+ * queued. Must be called with the shard locked.
+ */
+static
+bool queue_batch(struct queue_s* q, uint8_t pri)
+{
+    if( batch.nlogs == 0 )
+        return true;
 
-    // this lock may be created in rlog_install_interface, so check first
-    if(coms_lock == NULL) {
-        coms_lock = os_mutex_create();
+    if( (pri & 0x07) <= batch.level ) {
+        q->flush = true;
+        return true;
     }
 
-    queue_init();
-    queue_lock = os_mutex_create();
-    wakeup_events = os_event_create();    
-    
-#if RLOG_DLOG_ENABLE
-    int err = dlog_open(&logger, cfg.filepath, cfg.nlogs);
-    if( err != DLOG_OK ) {
-        DBG_PRINTF("[RLOG] rlog_init failed to open dlog. DLOG error %d\n", err);
-        return false;            
+    // the rlog thread starts timing the batch from its first message
+    if( q->cnt == 1 ) {
+        q->first_us = os_get_time_us();
+        return true;
     }
-#endif
+
+    return q->cnt == batch.size;
+}
+
+/**
+ * @brief Reserve the tail of the message class in a shard for a new message,
+ * overwriting the oldest one of the same class if it is full. Must be called
+ * with the shard locked.
+ * 
+ * @return Pointer to the message to fill in
+ */
+static
+log_t* queue_push(struct queue_s* q, log_t* log)
+{
+    struct queue_class_s* k = &q->cls[queue_class(log->pri)];
+    bool full = false;
+
+    q->enq++;
+    if( k->cnt < k->size ) {
+        k->cnt++;
+        q->cnt++;
+        if( q->cnt > q->max_cnt )
+            q->max_cnt = q->cnt;
+    } else {
+        q->ovf++;
+        full = true;
+    }
+
+    queue_count_urgent(q, k, log->pri, full);
+
+    if( (k->tail == k->head) && full )
+        k->head = (k->head + 1) % k->size;
+
+    k->stamp[k->tail] = os_get_time_us();
+
+    log_t* entry = &k->buffer[k->tail];
+    entry->timestamp = log->timestamp;
+    entry->pri = log->pri;
+    const char* name = os_thread_get_name(NULL);
+    fast_strncpy(entry->proc, name, sizeof(entry->proc));
+
+    k->tail = (k->tail + 1) % k->size;
+    return entry;
+}
+
+static
+bool queue_put(log_t log, const char* msg)
+{
+    struct queue_s* q = queue_shard();
+    os_mutex_lock(q->lock);
+
+    log_t* entry = queue_push(q, &log);
+    fast_strncpy(entry->msg, msg, sizeof(entry->msg));
+    bool wake = queue_batch(q, log.pri);
+    
+    os_mutex_unlock(q->lock);
+    return wake;
+}
+
+static
+bool queue_putf(log_t log, const char* format,  va_list args)
+{
+    struct queue_s* q = queue_shard();
+    os_mutex_lock(q->lock);
+
+    log_t* entry = queue_push(q, &log);
+    vsnprintf(entry->msg, sizeof(entry->msg), format, args);
+    bool wake = queue_batch(q, log.pri);
+    
+    os_mutex_unlock(q->lock);
+    return wake;
+}
+
+/**
+ * @brief Removes the oldest message of a class in a shard without rendering it
+ * 
+ * @param q Shard
+ * @param c Severity class
+ * @param log Pointer to hold the message
+ * @return true If there was a message of the class in the shard
+ */
+static
+bool queue_pop_shard(struct queue_s* q, int c, log_t* log)
+{
+    struct queue_class_s* k = &q->cls[c];
+
+    os_mutex_lock(q->lock);
+
+    if( k->cnt == 0 )
+    {   
+        os_mutex_unlock(q->lock); 
+        return false;
+    }
+
+    log->timestamp = k->buffer[k->head].timestamp;
+    log->pri = k->buffer[k->head].pri;
+    fast_strncpy(log->proc, k->buffer[k->head].proc, sizeof(k->buffer[k->head].proc));
+    fast_strncpy(log->msg, k->buffer[k->head].msg, sizeof(k->buffer[k->head].msg));
+    queue_stamp = k->stamp[k->head];
+
+    k->head = (k->head + 1) % k->size;
+    k->cnt--;
+    q->cnt--;
+    if( is_urgent(log->pri) )
+        q->urgent--;
+    os_mutex_unlock(q->lock);
+
+    return true;
+}
+
+static
+bool queue_pop(log_t* log)
+{
+    struct queue_s* q;
+    int c;
+
+    // the shard is checked again once locked
+    while( (c = queue_next_class()) >= 0 )
+    {
+        q = queue_oldest(c);
+        if( q && queue_pop_shard(q, c, log) ) {
+            queue_served(c);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+static
+int queue_get(char* msg, log_t* log)
+{
+    if( !queue_pop(log) )
+        return 0;
+
+    make_log_string(log_format, hostname, msg, log);
+    return strlen(msg);
+}
+
+/**
+ * @brief Destroy the kernel objects created by rlog_init(), except coms_lock
+ * which interfaces installed beforehand may use
+ */
+static
+void release_objects(void)
+{
+    for( int i = 0; i < RLOG_QUEUE_SHARDS; i++ ) 
+    {
+        if( msg_queue[i].lock )
+            os_mutex_destroy(msg_queue[i].lock);
+        msg_queue[i].lock = NULL;
+    }
+
+    if( wakeup_events )
+        os_event_destroy(wakeup_events);
+    wakeup_events = NULL;
+
+    if( thread_done )
+        os_sem_destroy(thread_done);
+    thread_done = NULL;
+}
+
+bool rlog_init(rlog_cfg_t cfg)
+{
+    // a previous rlog thread may still be running, see rlog_shutdown()
+    if( atomic_load(&state) != RLOG_STATE_DOWN ) {
+        DBG_PRINTF("[RLOG] rlog_init called before rlog_shutdown completed\n");
+        return false;
+    }
+
+    // set log format
+    if( cfg.format >= RLOG_NO_FORMAT ) {   
+        DBG_PRINTF("[RLOG] Invalid configuration: format! \n"); 
+        return false;
+    }
+    log_format = cfg.format;
+
+    // set log level filter
+    filter = cfg.level;
+
+    // set device name
+    if( !set_device_name(cfg.name) ){
+        DBG_PRINTF("[RLOG] Invalid configuration: name! \n"); 
+        return false;
+    }
+
+    // create kernel objects...
+
+    // this lock may be created in rlog_install_interface, so check first
+    if(coms_lock == NULL) {
+        coms_lock = os_mutex_create();
+    }
+
+    queue_init();
+    wakeup_events = os_event_create();    
+    thread_done = os_sem_create(1, 0);
+    if( coms_lock == NULL || wakeup_events == NULL || thread_done == NULL ) {
+        DBG_PRINTF("[RLOG] rlog_init failed to create kernel objects\n");
+        goto fail;
+    }
+    for( int i = 0; i < RLOG_QUEUE_SHARDS; i++ ) {
+        if( msg_queue[i].lock == NULL ) {
+            DBG_PRINTF("[RLOG] rlog_init failed to create kernel objects\n");
+            goto fail;
+        }
+    }
+
+    thread_joined = false;
+    released = false;
+    terminate = false;
+    shutdown_deadline = 0;
+    
+    backlog_commit_t commit = {
+        .nlogs = cfg.commit_nlogs,
+        .ms = cfg.commit_ms,
+        .level = cfg.commit_level,
+    };
+
+    if( !backlog_open(cfg.filepath, cfg.nlogs, commit) ) {
+        DBG_PRINTF("[RLOG] rlog_init failed to open backlog\n");
+        goto fail;            
+    }
+
+    replay_rate = cfg.replay_rate;
+    atomic_store(&counters.dropped, 0);
+    atomic_store(&counters.sent, 0);
+    atomic_store(&counters.replayed, 0);
+    atomic_store(&counters.replay_rate, 0);
+    atomic_store(&counters.replay_rate_ms, 0);
+    counters.window_us = 0;
+    counters.window_n = 0;
+
+    batch.nlogs = cfg.batch_nlogs;
+    batch.us = cfg.batch_us ? cfg.batch_us : RLOG_BATCH_US;
+    batch.level = cfg.batch_level;
+    batch.size = 1;
+    batch.last_us = 0;
+
+    panic_fd = cfg.panic_fd;
+    direct = cfg.direct;
+    direct_level = cfg.direct_level;
 
     if( cfg.priority < 1 )
         cfg.priority = 1;
 
-    thread_handle = os_thread_create("rlog", server_thread, NULL, RLOG_STACK_SIZE, cfg.priority);
+    os_thread_attr_t attr = {
+        .stack = cfg.stack ? cfg.stack : RLOG_STACK_SIZE,
+        .prio = cfg.priority,
+        .affinity = cfg.affinity,
+        .policy = cfg.policy,
+    };
+
+    // the rlog thread logs as soon as it starts
+    atomic_store(&state, RLOG_STATE_UP);
+    thread_handle = os_thread_create_attr("rlog", server_thread, NULL, &attr);
+    if( thread_handle == NULL ) {
+        DBG_PRINTF("[RLOG] rlog_init failed to create the rlog thread\n");
+        atomic_store(&state, RLOG_STATE_DOWN);
+        backlog_close();
+        goto fail;
+    }
 
-    initialized = true;
     os_sleep_us(1000);
     return true;
+
+fail:
+    release_objects();
+    return false;
 }
 
 void rlog_kill(void)
 {
+    int up = RLOG_STATE_UP;
+
+    // new messages are dropped, nobody is going to read them
+    if( !atomic_compare_exchange_strong(&state, &up, RLOG_STATE_STOPPING) )
+        return;
+
     terminate = true;
+    os_event_set(wakeup_events, EVENT_TERMINATE);
+}
+
+/**
+ * @brief Wait for the threads counted in callers to leave
+ * 
+ * @param timeout Time in miliseconds, OS_WAIT_FOREVER to wait indefinitely
+ * @return false If some are still inside, i.e. blocked on a direct send
+ */
+static
+bool wait_callers(uint32_t timeout)
+{
+    for( uint32_t ms = 0; atomic_load(&callers) != 0; ms++ )
+    {
+        if( timeout != OS_WAIT_FOREVER && ms >= timeout )
+            return false;
+        os_sleep_us(1000);
+    }
+
+    return true;
+}
+
+bool rlog_shutdown(uint32_t timeout)
+{
+    int up = RLOG_STATE_UP;
+
+    // new messages are dropped from now on, a previous call that timed out
+    // left the state at stopping and only waits again
+    if( atomic_compare_exchange_strong(&state, &up, RLOG_STATE_STOPPING) )
+    {
+        if( timeout == OS_WAIT_FOREVER )
+            shutdown_deadline = UINT64_MAX;
+        else
+            shutdown_deadline = os_get_time_us() + (uint64_t) timeout * 1000;
+
+        terminate = true;
+        os_event_set(wakeup_events, EVENT_TERMINATE);
+    }
+    else if( up == RLOG_STATE_DOWN )
+        return true;
+
+    uint32_t wait = timeout;
+    if( timeout != OS_WAIT_FOREVER )
+        wait += RLOG_SHUTDOWN_GRACE_MS;
+
+    if( !wait_callers(wait) || (!thread_joined && !os_sem_wait(thread_done, wait)) ) {
+        // stuck in an interface, nothing can be released safely
+        DBG_PRINTF("[RLOG] rlog_shutdown timed out waiting for the rlog thread\n");
+        return false;
+    }
+    thread_joined = true;
+
+    // the rlog thread leaves the lanes it could not stop, their workers 
+    // still use the interface list
+    if( !released ) 
+    {
+        if( !rlog_deinit(wait) ) {
+            DBG_PRINTF("[RLOG] rlog_shutdown timed out waiting for a dispatch lane\n");
+            return false;
+        }
+        backlog_close();
+        released = true;
+    }
+
+    // the thread and the lanes are gone, release everything
+    release_objects();
+
+    os_mutex_destroy(coms_lock);
+    coms_lock = NULL;
+    memset(&coms, 0, sizeof(coms));
+    n_ifc = 0;
+
+    terminate = false;
+    spilled = false;
+    replay_time = 0;
+    atomic_store(&state, RLOG_STATE_DOWN);
+    return true;
+}
+
+/**
+ * @brief Write a whole buffer to the panic file descriptor
+ */
+static
+void panic_write(const char* buf, int len)
+{
+    while( len > 0 )
+    {
+        ssize_t n = write(panic_fd, buf, len);
+        if( n < 0 && errno == EINTR )
+            continue;
+        if( n <= 0 )
+            return;
+
+        buf += n;
+        len -= n;
+    }
+}
+
+/**
+ * @brief Write the messages waiting on a dispatch lane during a panic flush.
+ * The lane is read without its lock, the indexes and lengths are not trusted.
+ */
+static
+void panic_flush_lane(rlog_lane_t* lane)
+{
+    unsigned int depth = lane->depth;
+    if( depth == 0 )
+        return;
+
+    unsigned int pos = lane->head % depth;
+    unsigned int left = atomic_load_explicit(&lane->cnt, memory_order_relaxed);
+    if( left > depth )
+        left = depth;
+
+    for( ; left > 0; left-- )
+    {
+        const char* msg = &lane->buffer[pos * MSG_MAX_SIZE_CHAR];
+        int len = lane->len[pos];
+
+        if( len > 0 && len <= MSG_MAX_SIZE_CHAR ) 
+        {
+            if( panic_fd > 0 )
+                panic_write(msg, len);
+            else
+                backlog_panic_put(NULL, msg, len);
+        }
+
+        pos = (pos + 1) % depth;
+    }
+}
+
+void rlog_panic_flush(void)
+{
+    static atomic_bool flushing;
+    char line[MSG_MAX_SIZE_CHAR + 1];
+    unsigned int pos[RLOG_QUEUE_SHARDS];
+    unsigned int left[RLOG_QUEUE_SHARDS];
+
+    if( atomic_load(&state) == RLOG_STATE_DOWN || atomic_exchange(&flushing, true) )
+        return;
+
+    // commits the staged messages, even if they go to the file descriptor
+    bool backlog = backlog_panic_begin();
+    if( !backlog && panic_fd <= 0 )
+        return;
+
+    // the lanes hold rendered messages taken off the queue before the ones
+    // still queued. A message waiting on several lanes is written once for
+    // each of them
+    for( int i = 0; i < RLOG_MAX_NUM_IFC; i++ ) 
+    {
+        rlog_lane_t* lane = coms.lane[i];
+        if( lane != NULL )
+            panic_flush_lane(lane);
+    }
+
+    // the locks may be held by a thread that is not coming back, read the
+    // queue as it is, most severe class first
+    unsigned int base = 0;
+    for( int c = 0; c < QUEUE_CLASSES; c++ )
+    {
+        // the buffer pointers of the classes are not trusted either
+        unsigned int size = queue_class_size[c];
+
+        for( int i = 0; i < RLOG_QUEUE_SHARDS; i++ )
+        {
+            pos[i] = msg_queue[i].cls[c].head % size;
+            left[i] = msg_queue[i].cls[c].cnt;
+            if( left[i] > size )
+                left[i] = size;
+        }
+
+        while( 1 )
+        {
+            int s = -1;
+
+            for( int i = 0; i < RLOG_QUEUE_SHARDS; i++ )
+            {
+                if( left[i] == 0 )
+                    continue;
+#if RLOG_QUEUE_SHARDS > 1
+                if( s >= 0 && msg_queue[i].stamp[base + pos[i]] >= msg_queue[s].stamp[base + pos[s]] )
+                    continue;
+#endif
+                s = i;
+            }
+
+            if( s < 0 )
+                break;
+
+            const log_t* log = &msg_queue[s].buffer[base + pos[s]];
+            int len = make_log_string_safe(log_format, hostname, line, sizeof(line), log);
+
+            if( panic_fd > 0 )
+                panic_write(line, len);
+            else
+                backlog_panic_put(log, line, len);
+
+            pos[s] = (pos[s] + 1) % size;
+            left[s]--;
+        }
+
+        base += size;
+    }
+
+    if( backlog )
+        backlog_panic_end();
+}
+
+void rlog_ifc_changed(void)
+{
+    if( wakeup_events )
+        os_event_set(wakeup_events, EVENT_IFC_CHANGED);
+}
+
+/**
+ * @brief Render a message and send it from the calling thread, see 
+ * rlog_cfg_t::direct. The message must be filled in except for the process.
+ * The message is rendered on the stack of the calling thread.
+ * 
+ * @return false If no interface took the message and it must be queued
+ */
+static
+bool send_direct(log_t* log)
+{
+    char buf[MSG_MAX_SIZE_CHAR];
+    uint64_t stamp = os_get_time_us();
+
+    // the rlog thread may be calling it from an interface, don't reenter it
+    if( os_get_active_thread() == thread_handle )
+        return false;
+
+    const char* name = os_thread_get_name(NULL);
+    fast_strncpy(log->proc, name, sizeof(log->proc) - 1);
+
+    int len = make_log_string(log_format, hostname, buf, log);
+    if( len <= 0 )
+        return false;
+
+    return send_to_interfaces(buf, len, stamp, true);
+}
+
+/**
+ * @brief Count the calling thread in callers, counted before the check so 
+ * rlog_shutdown() sees either one or the other
+ * 
+ * @return false If the server is not up, i.e. the message must be dropped
+ */
+static inline
+bool caller_enter(void)
+{
+    atomic_fetch_add(&callers, 1);
+    if( atomic_load(&state) == RLOG_STATE_UP )
+        return true;
+
+    atomic_fetch_sub(&callers, 1);
+    return false;
+}
+
+static inline
+void caller_leave(void)
+{
+    atomic_fetch_sub(&callers, 1);
+}
+
+void rlog(RLOG_LEVEL level, const char* msg)
+{
+    log_t log;
+    bool sent = false;
+
+    if(level > filter || !caller_enter())
+        return;
+
+#if RLOG_TIMESTAMP_ENABLE
+    time(&log.timestamp);
+#endif
+    log.pri = 8 + level;
+
+    if( direct && level <= direct_level ) 
+    {
+        fast_strncpy(log.msg, msg, sizeof(log.msg) - 1);
+        sent = send_direct(&log);
+    }
+
+    if( !sent && queue_put(log, msg) )
+        os_event_set(wakeup_events, EVENT_NEW_MSG);
+
+    caller_leave();
+}
+
+void rlogf(RLOG_LEVEL level, const char* format, ...)
+{
+    va_list args;
+    log_t log;
+
+    if(level > filter || !caller_enter())
+        return;
+
+#if RLOG_TIMESTAMP_ENABLE
+    time(&log.timestamp);
+#endif
+    log.pri = 8 + level;
+
+    if( direct && level <= direct_level ) 
+    {
+        va_start(args, format);
+        vsnprintf(log.msg, sizeof(log.msg), format, args);
+        va_end(args);
+        if( !send_direct(&log) && queue_put(log, log.msg) )
+            os_event_set(wakeup_events, EVENT_NEW_MSG);
+    }
+    else
+    {
+        va_start(args, format);
+        bool wake = queue_putf(log, format, args);
+        va_end(args);
+        if( wake )
+            os_event_set(wakeup_events, EVENT_NEW_MSG);
+    }
+
+    caller_leave();
+}
+
+static
+bool set_device_name(const char* name)
+{
+    if( !name )
+        return false;
+        
+    snprintf(hostname, sizeof(hostname), name); 
+    char * pcTmp  = hostname;
+    while (*pcTmp) {
+        if (*pcTmp == ' ') *pcTmp = '_';
+        ++pcTmp;
+    }
+   
+    return true;
+}
+
+/**
+ * @brief Clear the counters of an interface
+ */
+static
+void ifc_stats_reset(struct ifc_stats_s* st)
+{
+    atomic_store(&st->sent, 0);
+    atomic_store(&st->failed, 0);
+    atomic_store(&st->dropped, 0);
+    for( int i = 0; i < RLOG_LATENCY_BUCKETS; i++ )
+        atomic_store(&st->latency[i], 0);
+    atomic_store(&st->latency_us, 0);
+}
+
+/**
+ * @brief Latency histogram bucket of a time in microseconds, see 
+ * rlog_ifc_stats_t::latency
+ */
+static inline
+int latency_bucket(uint64_t us)
+{
+    int b = 0;
+
+    us >>= 6;
+    while( us && b < RLOG_LATENCY_BUCKETS - 1 ) {
+        us >>= 2;
+        b++;
+    }
+    return b;
+}
+
+/**
+ * @brief Count the result of a call to the send function of an interface
+ * 
+ * @param st Counters of the interface
+ * @param ok Result of the send function
+ * @param stamp Time the message was queued, 0 if it was replayed
+ */
+static
+void ifc_count_send(struct ifc_stats_s* st, bool ok, uint64_t stamp)
+{
+    if( !ok ) {
+        atomic_fetch_add_explicit(&st->failed, 1, memory_order_relaxed);
+        return;
+    }
+
+    atomic_fetch_add_explicit(&st->sent, 1, memory_order_relaxed);
+    if( stamp ) {
+        uint64_t now = os_get_time_us();
+        uint64_t us = now > stamp ? now - stamp : 0;
+        atomic_fetch_add_explicit(&st->latency[latency_bucket(us)], 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&st->latency_us, us, memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Poll the interface of a lane and wake up the rlog thread if the
+ * result changed
+ */
+static
+void lane_poll(rlog_lane_t* lane)
+{
+    bool up = lane->ifc.poll(lane->ifc.ctx);
+
+    if( up != lane->up ) {
+        lane->up = up;
+        rlog_ifc_changed();
+    }
+}
+
+/**
+ * @brief Dispatch lane worker. Sends the messages queued on the lane to
+ * its interface until the lane is terminated. The interface is polled when
+ * the lane is idle and after every failed send.
+ */
+static
+void lane_thread(void* arg)
+{
+    rlog_lane_t* lane = (rlog_lane_t*) arg;
+    uint64_t stamp;
+    int len;
+
+    lane_poll(lane);
+
+    while( 1 )
+    {
+        bool item = os_sem_wait(lane->items, LANE_POLLING_PERIOD);
+
+        // messages left are sent until the shutdown deadline
+        if( lane->terminate && (lane->cnt == 0 || os_get_time_us() >= shutdown_deadline) )
+            break;
+
+        if( !item && !lane->terminate ) 
+        {
+            lane_poll(lane);
+            continue;
+        }
+
+        os_mutex_lock(lane->lock);
+        if( lane->cnt == 0 ) {
+            os_mutex_unlock(lane->lock);
+            continue;
+        }
+        len = lane->len[lane->head];
+        stamp = lane->stamp[lane->head];
+        memcpy(lane->msg, &lane->buffer[lane->head * MSG_MAX_SIZE_CHAR], len);
+        lane->head = (lane->head + 1) % lane->depth;
+        lane->cnt--;
+        if( lane->urgent > 0 )
+            lane->urgent--;
+        os_mutex_unlock(lane->lock);
+
+        bool ok = lane->ifc.send(lane->ifc.ctx, lane->msg, len);
+        ifc_count_send(lane->counters, ok, stamp);
+        if( !ok )
+            lane_poll(lane);
+
+        os_mutex_lock(lane->lock);
+        if( ok )
+            lane->stats.sent++;
+        else
+            lane->stats.failed++;
+        os_mutex_unlock(lane->lock);
+    }
+
+    // the handle is gone with the thread
+    lane->thread_handle = NULL;
+    os_sem_signal(lane->done);
+    os_thread_destroy(NULL);
+}
+
+/**
+ * @brief Copy a ring buffer entry of a dispatch lane to another one
+ */
+static
+void lane_move(rlog_lane_t* lane, unsigned int from, unsigned int to)
+{
+    from %= lane->depth;
+    to %= lane->depth;
+
+    memcpy(&lane->buffer[to * MSG_MAX_SIZE_CHAR], &lane->buffer[from * MSG_MAX_SIZE_CHAR], lane->len[from]);
+    lane->len[to] = lane->len[from];
+    lane->stamp[to] = lane->stamp[from];
+}
+
+/**
+ * @brief Queue a rendered message on a dispatch lane. If the lane is full 
+ * the oldest message is dropped, but never a direct message for a regular 
+ * one: the direct messages are kept at the head of the ring buffer, in the
+ * order they were put, and the regular message after them is dropped instead.
+ * 
+ * @param lane Dispatch lane
+ * @param buf Buffer with message to be sent
+ * @param len Size of the message in bytes
+ * @param stamp Time the message was queued, 0 if it was replayed
+ * @param front Direct message, put it ahead of the regular ones waiting
+ */
+static
+void lane_put(rlog_lane_t* lane, const void* buf, int len, uint64_t stamp, bool front)
+{
+    unsigned int slot;
+    bool full = false;
+
+    if( len > MSG_MAX_SIZE_CHAR )
+        len = MSG_MAX_SIZE_CHAR;
+
+    os_mutex_lock(lane->lock);
+
+    if( lane->cnt < lane->depth ) {
+        lane->cnt++;
+        if( lane->cnt > lane->stats.max_cnt )
+            lane->stats.max_cnt = lane->cnt;
+    } else {
+        lane->stats.dropped++;
+        atomic_fetch_add_explicit(&lane->counters->dropped, 1, memory_order_relaxed);
+        full = true;
+    }
+
+    if( full && lane->urgent == lane->depth )
+    {
+        // only direct messages left, the oldest one goes
+        if( front ) {
+            lane->head = (lane->head + 1) % lane->depth;
+            lane->urgent--;
+        } else {
+            os_mutex_unlock(lane->lock);
+            return;
+        }
+    }
+    else if( full && front ) 
+    {
+        // the newest regular message makes room
+        lane->tail = (lane->tail + lane->depth - 1) % lane->depth;
+    }
+    else if( full )
+    {
+        // the oldest regular message goes, the direct ones move up one slot
+        for( unsigned int i = lane->urgent; i > 0; i-- )
+            lane_move(lane, lane->head + i - 1, lane->head + i);
+
+        lane->head = (lane->head + 1) % lane->depth;
+    }
+
+    if( front ) 
+    {
+        // goes after the direct messages already waiting
+        lane->head = (lane->head + lane->depth - 1) % lane->depth;
+        for( unsigned int i = 0; i < lane->urgent; i++ )
+            lane_move(lane, lane->head + i + 1, lane->head + i);
+
+        slot = (lane->head + lane->urgent) % lane->depth;
+        lane->urgent++;
+    }
+    else
+    {
+        slot = lane->tail;
+        lane->tail = (lane->tail + 1) % lane->depth;
+    }
+
+    memcpy(&lane->buffer[slot * MSG_MAX_SIZE_CHAR], buf, len);
+    lane->len[slot] = len;
+    lane->stamp[slot] = stamp;
+
+    os_mutex_unlock(lane->lock);
+
+    // overwriting does not add a new item for the worker
+    if( !full )
+        os_sem_signal(lane->items);
+}
+
+/**
+ * @brief Allocate a dispatch lane and start its worker
+ * 
+ * @param interface Interface to be served by the lane
+ * @param cfg Lane configuration
+ * @param counters Counters of the interface
+ * @return Pointer to the new lane or NULL if failed
+ */
+static
+rlog_lane_t* lane_create(rlog_ifc_t interface, rlog_lane_cfg_t cfg, struct ifc_stats_s* counters)
+{
+    rlog_lane_t* lane = calloc(1, sizeof(rlog_lane_t));
+    if( lane == NULL )
+        return NULL;
+
+    if( cfg.depth < 1 )
+        cfg.depth = 1;
+
+    if( cfg.priority < 1 )
+        cfg.priority = 1;
+
+    lane->ifc = interface;
+    lane->counters = counters;
+    lane->depth = cfg.depth;
+    lane->buffer = malloc(cfg.depth * MSG_MAX_SIZE_CHAR);
+    lane->len = malloc(cfg.depth * sizeof(int));
+    lane->stamp = malloc(cfg.depth * sizeof(uint64_t));
+    lane->lock = os_mutex_create();
+    lane->items = os_sem_create(cfg.depth + 1, 0);
+    lane->done = os_sem_create(1, 0);
+
+    if( !lane->buffer || !lane->len || !lane->stamp || !lane->lock || !lane->items || !lane->done ) 
+        goto fail;
+
+    os_thread_attr_t attr = {
+        .stack = RLOG_LANE_STACK_SIZE,
+        .prio = cfg.priority,
+        .affinity = cfg.affinity,
+        .policy = cfg.policy,
+    };
+
+    lane->thread_handle = os_thread_create_attr("rlog_lane", lane_thread, lane, &attr);
+    if( lane->thread_handle == NULL )
+        goto fail;
+
+    return lane;
+
+fail:
+    DBG_PRINTF("[RLOG] lane_create failed!\n");
+    if( lane->items ) os_sem_destroy(lane->items);
+    if( lane->done ) os_sem_destroy(lane->done);
+    if( lane->lock ) os_mutex_destroy(lane->lock);
+    free(lane->buffer);
+    free(lane->len);
+    free(lane->stamp);
+    free(lane);
+    return NULL;
+}
+
+#if !RLOG_BACKLOG_BINARY
+/**
+ * @brief Level of a rendered message, taken from its priority field
+ */
+static
+RLOG_LEVEL lane_msg_level(const char* msg, int len)
+{
+    unsigned int pri = 0;
+
+    for( int i = 1; i < len && i < 5 && msg[i] >= '0' && msg[i] <= '9'; i++ )
+        pri = pri * 10 + (msg[i] - '0');
+
+    return (RLOG_LEVEL)(pri & 0x07);
+}
+#endif
+
+/**
+ * @brief Move the messages the worker did not send to the backlog. They are 
+ * already rendered, so they are dropped if RLOG_BACKLOG_BINARY is set.
+ * Only called once the worker has terminated.
+ */
+static
+void lane_drain(rlog_lane_t* lane)
+{
+    char msg[MSG_MAX_SIZE_CHAR + 1];
+
+    for( ; lane->cnt > 0; lane->cnt-- )
+    {
+        int len = lane->len[lane->head];
+        memcpy(msg, &lane->buffer[lane->head * MSG_MAX_SIZE_CHAR], len);
+        msg[len] = 0;
+        lane->head = (lane->head + 1) % lane->depth;
+
+#if RLOG_BACKLOG_BINARY
+        bool ok = false;
+#else
+        bool ok = len > 0 && backlog_put(msg, lane_msg_level(msg, len));
+#endif
+        if( !ok )
+            atomic_fetch_add_explicit(&counters.dropped, 1, memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Stop the lane worker, move the messages it did not send to the 
+ * backlog and release all lane resources
+ * 
+ * @param lane Dispatch lane
+ * @param timeout Time in miliseconds to wait for the worker
+ * @return false If the worker is stuck in its interface. The lane is left
+ * to it and leaked, as it can't be released safely.
+ */
+static
+bool lane_destroy(rlog_lane_t* lane, uint32_t timeout)
+{
+    lane->terminate = true;
+    os_sem_signal(lane->items);
+    if( !os_sem_wait(lane->done, timeout) )
+        return false;
+
+    lane_drain(lane);
+
+    os_sem_destroy(lane->items);
+    os_sem_destroy(lane->done);
+    os_mutex_destroy(lane->lock);
+    free(lane->buffer);
+    free(lane->len);
+    free(lane->stamp);
+    free(lane);
+    return true;
+}
+
+/**
+ * @brief Validate, initialize and add an interface to the interface list.
+ * 
+ * @param interface Interface descriptor
+ * @param lane Pointer to lane configuration, or NULL if the interface is to 
+ * be served directly by the rlog thread.
+ * @return true If interface was installed and initialized.
+ */
+static
+bool add_interface( rlog_ifc_t interface, const rlog_lane_cfg_t* lane )
+{
+
+    if(interface.poll == NULL) {
+        DBG_PRINTF("[RLOG] rlog_install_interface failed. Invalid parameter\n");
+        return false;
+    }
+
+    if(interface.init == NULL) {
+        DBG_PRINTF("[RLOG] rlog_install_interface failed. Invalid parameter\n");
+        return false;
+    }
+
+    if(interface.send == NULL) {
+        DBG_PRINTF("[RLOG] rlog_install_interface failed. Invalid parameter\n");
+        return false;
+    }
+
+    // try to initialize the interface
+    if( !interface.init(interface.ctx) )
+    {
+        DBG_PRINTF("[RLOG] rlog_install_interface failed to initialize interface\n");
+        return false;
+    }
+
+    if(coms_lock == NULL) {
+        coms_lock = os_mutex_create();
+    }
+
+    os_mutex_lock(coms_lock);
+
+    if( n_ifc >= RLOG_MAX_NUM_IFC ) {
+        DBG_PRINTF("[RLOG] rlog_install_interface failed. Too many interfaces!\n");
+        os_mutex_unlock(coms_lock);
+        return false;
+    }
+
+    ifc_stats_reset(&coms.stats[n_ifc]);
+
+    coms.lane[n_ifc] = NULL;
+    if( lane ) 
+    {
+        coms.lane[n_ifc] = lane_create(interface, *lane, &coms.stats[n_ifc]);
+        if( coms.lane[n_ifc] == NULL ) {
+            DBG_PRINTF("[RLOG] rlog_install_interface failed to create dispatch lane\n");
+            os_mutex_unlock(coms_lock);
+            return false;
+        }
+    }
+
+    // lanes poll their own interface
+    if( lane == NULL && !interface.notify )
+        coms.polled++;
+
+    coms.ifc[n_ifc++] = interface;
+    os_mutex_unlock(coms_lock);
+
+    // don't wait for the next poll to start sending
+    rlog_ifc_changed();
+    return true;
+}
+
+/**
+ * @brief Install an interface, before rlog_init() or while the server is up 
+ * but not while rlog_shutdown() releases the interface list
+ */
+static
+bool install_interface( rlog_ifc_t interface, const rlog_lane_cfg_t* lane )
+{
+    bool counted = caller_enter();
+
+    if( !counted && atomic_load(&state) != RLOG_STATE_DOWN ) {
+        DBG_PRINTF("[RLOG] rlog_install_interface failed. Server is stopping\n");
+        return false;
+    }
+
+    bool ok = add_interface(interface, lane);
+
+    if( counted )
+        caller_leave();
+    return ok;
+}
+
+bool rlog_install_interface( rlog_ifc_t interface )
+{
+    return install_interface(interface, NULL);
+}
+
+bool rlog_install_interface_lane( rlog_ifc_t interface, rlog_lane_cfg_t cfg )
+{
+    return install_interface(interface, &cfg);
+}
+
+bool rlog_get_lane_stats( unsigned int index, rlog_lane_stats_t* stats )
+{
+    bool ok = false;
+
+    if( stats == NULL || !caller_enter() )
+        return false;
+
+    os_mutex_lock(coms_lock);
+    if( index < n_ifc && coms.lane[index] )
+    {
+        rlog_lane_t* lane = coms.lane[index];
+        os_mutex_lock(lane->lock);
+        *stats = lane->stats;
+        os_mutex_unlock(lane->lock);
+        ok = true;
+    }
+    os_mutex_unlock(coms_lock);
+
+    caller_leave();
+    return ok;
+}
+
+bool rlog_get_stats( rlog_stats_t* stats )
+{
+    // the queue locks are gone once rlog_shutdown() gets to release them
+    if( stats == NULL || !caller_enter() )
+        return false;
+
+    memset(stats, 0, sizeof(*stats));
+
+    for( int i = 0; i < RLOG_QUEUE_SHARDS; i++ )
+    {
+        struct queue_s* q = &msg_queue[i];
+
+        os_mutex_lock(q->lock);
+        stats->enqueued += q->enq;
+        stats->overflowed += q->ovf;
+        stats->spilled += q->spill;
+        stats->queue_cnt += q->cnt;
+        if( q->max_cnt > stats->queue_max_cnt )
+            stats->queue_max_cnt = q->max_cnt;
+        os_mutex_unlock(q->lock);
+    }
+
+    stats->dropped = atomic_load_explicit(&counters.dropped, memory_order_relaxed);
+    stats->sent = atomic_load_explicit(&counters.sent, memory_order_relaxed);
+    stats->backlog_cnt = backlog_count();
+    stats->replayed = atomic_load_explicit(&counters.replayed, memory_order_relaxed);
+
+    // the rate is only updated while replaying
+    unsigned int rate_ms = atomic_load_explicit(&counters.replay_rate_ms, memory_order_relaxed);
+    if( (unsigned int)(os_get_time_us() / 1000) - rate_ms < 2 * REPLAY_RATE_WINDOW_US / 1000 )
+        stats->replay_rate = atomic_load_explicit(&counters.replay_rate, memory_order_relaxed);
+
+    // the rlog thread may hold coms_lock for a whole slow send, don't wait on it
+    stats->n_ifc = n_ifc;
+    for( int i = 0; i < stats->n_ifc; i++ )
+    {
+        struct ifc_stats_s* st = &coms.stats[i];
+
+        stats->ifc[i].sent = atomic_load_explicit(&st->sent, memory_order_relaxed);
+        stats->ifc[i].failed = atomic_load_explicit(&st->failed, memory_order_relaxed);
+        stats->ifc[i].dropped = atomic_load_explicit(&st->dropped, memory_order_relaxed);
+        for( int b = 0; b < RLOG_LATENCY_BUCKETS; b++ )
+            stats->ifc[i].latency[b] = atomic_load_explicit(&st->latency[b], memory_order_relaxed);
+        stats->ifc[i].latency_us = atomic_load_explicit(&st->latency_us, memory_order_relaxed);
+    }
+
+    caller_leave();
+    return true;
+}
+
+/**
+ * @brief Poll all installed interfaces to see which is avaialble.
+ * 
+ * @return true If at least on interface is initialized to receive messages
+ * @return false If no interface can receive messages at the moment.
+ */
+bool rlog_poll()
+{
+    rlog_ifc_t p;
+    bool up = false;
+
+    os_mutex_lock(coms_lock);
+    for( int i=0; i < n_ifc; i++ )
+    {
+        p = coms.ifc[i];         
+
+        if( coms.lane[i] ) {
+            // the lane worker polls its own interface
+            coms.up[i] = coms.lane[i]->up;
+        } else {
+            coms.up[i] = p.poll(p.ctx);
+        }
+
+        if( !up ) {
+            up = coms.up[i];
+        }
+    }
+    os_mutex_unlock(coms_lock);
+
+    return up;   
+}
+
+static
+bool send_to_interfaces(const void* buf, int len, uint64_t stamp, bool front)
+{
+    rlog_ifc_t p;
+    unsigned char ok = 0;
+
+    os_mutex_lock(coms_lock);
+    for( int i=0; i < n_ifc; i++ )
+    {
+        if( coms.up[i] )
+        {
+            p = coms.ifc[i]; 
+
+            if( coms.lane[i] ) 
+            {
+                // the lane worker will do the actual sending
+                lane_put(coms.lane[i], buf, len, stamp, front);
+                ok++;
+            }
+            else if ( p.send(p.ctx, buf, len) )
+            {
+                ifc_count_send(&coms.stats[i], true, stamp);
+                ok++;            
+            }
+            else
+            {
+                ifc_count_send(&coms.stats[i], false, stamp);
+            }
+        }         
+    }
+    os_mutex_unlock(coms_lock);
+
+    if( ok > 0 )
+        atomic_fetch_add_explicit(&counters.sent, 1, memory_order_relaxed);
+    return ( ok > 0 );
+}
+
+/**
+ * @brief Send message to all interfaces that are initialized to receive
+ * 
+ * @param buf Buffer with message to be sent
+ * @param len Size of the message in bytes
+ * @param stamp Time the message was queued, 0 if it was replayed
+ * @return true If at least one interface has received the message
+ * @return false If no interface has received the message
+ */
+bool rlog_send(const void* buf, int len, uint64_t stamp)
+{
+    return send_to_interfaces(buf, len, stamp, false);
+}
+
+/**
+ * @brief Time in miliseconds left to the lane workers to terminate: until the
+ * shutdown deadline plus half of RLOG_SHUTDOWN_GRACE_MS, so the rlog thread
+ * still terminates within the time rlog_shutdown() waits for it.
+ */
+static
+uint32_t lane_timeout(void)
+{
+    uint64_t now = os_get_time_us();
+
+    if( shutdown_deadline == UINT64_MAX )
+        return OS_WAIT_FOREVER;
+
+    uint64_t ms = RLOG_SHUTDOWN_GRACE_MS / 2;
+    if( shutdown_deadline > now )
+        ms += (shutdown_deadline - now) / 1000;
+
+    return ms < OS_WAIT_FOREVER ? (uint32_t) ms : OS_WAIT_FOREVER - 1;
+}
+
+static
+bool rlog_deinit(uint32_t timeout)
+{
+    rlog_ifc_t ifc[RLOG_MAX_NUM_IFC];
+    rlog_lane_t* lane[RLOG_MAX_NUM_IFC];
+    bool done = true;
+    int n;
+
+    // the lane workers may take a while, don't hold the lock meanwhile.
+    // Interfaces are only deinitialized once
+    os_mutex_lock(coms_lock);
+    n = n_ifc;
+    for( int i=0; i < n; i++ )
+    {
+        if( coms.lane[i] ) {
+            coms.stuck[i] = coms.lane[i];
+            coms.lane[i] = NULL;
+        }
+
+        ifc[i] = coms.ifc[i]; 
+        lane[i] = coms.stuck[i];
+        coms.ifc[i].deinit = NULL;
+    }
+    os_mutex_unlock(coms_lock);
+
+    for( int i=0; i < n; i++ )
+    {
+        // an interface still used by a stuck worker is not deinitialized
+        if( lane[i] && !lane_destroy(lane[i], timeout) ) {
+            DBG_PRINTF("[RLOG] dispatch lane of interface %d did not terminate\n", i);
+            os_mutex_lock(coms_lock);
+            coms.ifc[i].deinit = ifc[i].deinit;
+            os_mutex_unlock(coms_lock);
+            done = false;
+            continue;
+        }
+
+        if( lane[i] ) {
+            os_mutex_lock(coms_lock);
+            coms.stuck[i] = NULL;
+            os_mutex_unlock(coms_lock);
+        }
+
+        if( ifc[i].deinit ) {
+            ifc[i].deinit(ifc[i].ctx);
+        }
+    }
+
+    return done;
+}
+
+#if _RLOG_DBG_   
+static
+void rlog_print_dbg_stats()
+{
+ 
+    // frequency divider so not to pollute stdout
+    static uint32_t dbg_ctr = 0;
+
+    uint32_t    queue_ovf;
+    uint32_t    queue_cnt;
+    uint32_t    queue_max_cnt;
+    uint32_t    queue_spill;
+
+    if( dbg_ctr++ < 50)
+        return;
+
+    dbg_ctr = 0;
+    queue_ovf = 0;
+    queue_cnt = 0;
+    queue_max_cnt = 0;
+    queue_spill = 0;
+    for( int i = 0; i < RLOG_QUEUE_SHARDS; i++ )
+    {
+        os_mutex_lock(msg_queue[i].lock);
+        queue_ovf += msg_queue[i].ovf;
+        queue_cnt += msg_queue[i].cnt;
+        queue_max_cnt += msg_queue[i].max_cnt;    
+        queue_spill += msg_queue[i].spill;
+        os_mutex_unlock(msg_queue[i].lock);
+    }
+
+    DBG_PRINTF("[RLOG] Queue overflows: %d\n", queue_ovf);
+    DBG_PRINTF("[RLOG] Queue count: %d\n", queue_cnt);
+    DBG_PRINTF("[RLOG] Queue watermark: %d\n", queue_max_cnt);
+    DBG_PRINTF("[RLOG] Queue spilled to backlog: %d\n", queue_spill);
+
+}
+#endif
+
+#define SERVER_BANNER "RLOG Server v"RLOG_VERSION " up and running!"
+#define EVENT_TIMEOUT_SEC 1
+#define EVENT_TIMEOUT (EVENT_TIMEOUT_SEC * 1000)
+#define QUEUE_POLLING_PERIOD_US 0
+
+#if RLOG_HEARTBEAT
+    #define HEARTBEAT_PERIOD_US ((uint64_t) RLOG_HEARTBEAT_PERIOD_SEC * 1000 * 1000)
+#endif
+
+/**
+ * @brief Store a message in the backlog, in compact or rendered form 
+ * according to RLOG_BACKLOG_BINARY
+ * 
+ * @param log Message
+ * @param msg Rendered message, may be NULL in compact form
+ * @return false If the message was lost
+ */
+static
+bool store_to_backlog(const log_t* log, const char* msg)
+{
+#if RLOG_BACKLOG_BINARY
+    bool ok = backlog_put_log(log);
+#else
+    bool ok = backlog_put(msg, log->pri & 0x07);
+#endif
+    if( !ok )
+        atomic_fetch_add_explicit(&counters.dropped, 1, memory_order_relaxed);
+    return ok;
+}
+
+/**
+ * @brief Read the next message to replay from the backlog, rendering it if needed
+ * 
+ * @param msg Buffer to hold the null-terminated string
+ * @return Length of the message or 0 if there are no more messages to read
+ */
+static
+int load_from_backlog(char* msg)
+{
+#if RLOG_BACKLOG_BINARY
+    log_t log;
+
+    if( !backlog_read_log(&log) )
+        return 0;
+
+    make_log_string(log_format, hostname, msg, &log);
+    return strlen(msg);
+#else
+    return backlog_read(msg, MSG_MAX_SIZE_CHAR);
+#endif
+}
+
+/**
+ * @brief Move the oldest messages of a class in a queue shard to the backlog
+ * once it goes past RLOG_QUEUE_HIGH_WATERMARK of its capacity, down to 
+ * RLOG_QUEUE_LOW_WATERMARK.
+ * 
+ * @return Number of messages moved
+ */
+static
+unsigned int spill_class_to_backlog(struct queue_s* q, int c)
+{
+    unsigned int n = 0;
+#if RLOG_DLOG_ENABLE && RLOG_QUEUE_HIGH_WATERMARK
+    log_t log;
+
+    unsigned int size = q->cls[c].size;
+
+    os_mutex_lock(q->lock);
+    unsigned int cnt = q->cls[c].cnt;
+    os_mutex_unlock(q->lock);
+
+    if( cnt < QUEUE_HIGH_WATERMARK(size) )
+        return 0;
+
+    for( ; cnt - n > QUEUE_LOW_WATERMARK(size); n++ )
+    {
+        if( !queue_pop_shard(q, c, &log) )
+            break;
+#if RLOG_BACKLOG_BINARY
+        store_to_backlog(&log, NULL);
+#else
+        make_log_string(log_format, hostname, msg_buffer, &log);
+        store_to_backlog(&log, msg_buffer);
+#endif
+    }
+
+    os_mutex_lock(q->lock);
+    q->spill += n;
+    os_mutex_unlock(q->lock);
+#endif
+    return n;
 }
 
-void rlog(RLOG_LEVEL level, const char* msg)
+/**
+ * @brief Move the oldest queued messages to the backlog once a class of a 
+ * queue shard goes past RLOG_QUEUE_HIGH_WATERMARK, down to 
+ * RLOG_QUEUE_LOW_WATERMARK. They are committed together and replayed later 
+ * instead of being overwritten.
+ */
+static
+void spill_queue_to_backlog(void)
 {
-    log_t log;
+#if RLOG_DLOG_ENABLE && RLOG_QUEUE_HIGH_WATERMARK
+    bool spill = false;
 
-    if(level > filter)
-        return;
+    for( int i = 0; i < RLOG_QUEUE_SHARDS; i++ )
+    {
+        for( int c = 0; c < QUEUE_CLASSES; c++ )
+        {
+            if( spill_class_to_backlog(&msg_queue[i], c) )
+                spill = true;
+        }
+    }
 
-#if RLOG_TIMESTAMP_ENABLE
-    time(&log.timestamp);
+    if( spill ) {
+        backlog_commit();
+        spilled = true;
+    }
 #endif
-    log.pri = 8 + level;
-    queue_put(log, msg);
-    os_event_set(wakeup_events, EVENT_NEW_MSG);
 }
 
-void rlogf(RLOG_LEVEL level, const char* format, ...)
+/**
+ * @brief Send queued messages to the remote interfaces
+ * 
+ * @param max Maximum number of messages to send, 0 for no limit
+ * @return false If a message could not be sent and went to the backlog
+ */
+static 
+bool dump_queue_to_remote(unsigned int max)
 {
-    va_list args;
     log_t log;
+    unsigned int n = 0;
 
-    if(level > filter)
-        return;
+    //dispatch all enqueued log messages
+    while( (max == 0 || n < max) )
+    {        
+        // what is left after the shutdown deadline goes to the backlog
+        if( terminate && os_get_time_us() >= shutdown_deadline )
+            break;
 
-#if RLOG_TIMESTAMP_ENABLE
-    time(&log.timestamp);
-#endif
-    log.pri = 8 + level;
-    va_start(args, format);
-    queue_putf(log, format, args);
-    va_end(args);
-    os_event_set(wakeup_events, EVENT_NEW_MSG);
-}
+        spill_queue_to_backlog();
 
-static
-bool set_device_name(const char* name)
-{
-    if( !name )
-        return false;
-        
-    snprintf(hostname, sizeof(hostname), name); 
-    char * pcTmp  = hostname;
-    while (*pcTmp) {
-        if (*pcTmp == ' ') *pcTmp = '_';
-        ++pcTmp;
+        int len = queue_get(msg_buffer, &log);
+        if( len == 0 )
+            break;
+
+        if( !rlog_send(msg_buffer, len, queue_stamp) )
+        {
+            // failed to send, put it on the backlog for later
+            store_to_backlog(&log, msg_buffer);
+            return false;
+        }           
+        os_sleep_us(QUEUE_POLLING_PERIOD_US);
+        n++;
     }
-   
+
     return true;
 }
 
-bool rlog_install_interface( rlog_ifc_t interface )
+/**
+ * @brief Count replayed messages and measure the replay rate over windows of
+ * REPLAY_RATE_WINDOW_US
+ */
+static
+void count_replayed(unsigned int n)
 {
+    uint64_t now = os_get_time_us();
 
-    if(interface.poll == NULL) {
-        DBG_PRINTF("[RLOG] rlog_install_interface failed. Invalid parameter\n");
-        return false;
-    }
+    atomic_fetch_add_explicit(&counters.replayed, n, memory_order_relaxed);
 
-    if(interface.init == NULL) {
-        DBG_PRINTF("[RLOG] rlog_install_interface failed. Invalid parameter\n");
-        return false;
+    if( now - counters.window_us >= REPLAY_RATE_WINDOW_US ) 
+    {
+        // a window cut by a long idle gap is not measured
+        unsigned int rate = 0;
+        if( now - counters.window_us < 2 * REPLAY_RATE_WINDOW_US )
+            rate = (uint64_t) counters.window_n * 1000000 / (now - counters.window_us);
+
+        atomic_store_explicit(&counters.replay_rate, rate, memory_order_relaxed);
+        atomic_store_explicit(&counters.replay_rate_ms, (unsigned int)(now / 1000), memory_order_relaxed);
+        counters.window_us = now;
+        counters.window_n = 0;
     }
 
-    if(interface.send == NULL) {
-        DBG_PRINTF("[RLOG] rlog_install_interface failed. Invalid parameter\n");
-        return false;
-    }
+    counters.window_n += n;
+}
 
-    // try to initialize the interface
-    if( !interface.init(interface.ctx) )
+/**
+ * @brief Replay one chunk of the backlog, at most replay_rate messages per 
+ * second. Urgent queued messages are sent before the next replayed message.
+ * 
+ * @return 0 if there may be more to replay right away, the time in 
+ * miliseconds until the replay rate allows to send again or OS_WAIT_FOREVER
+ * if there is nothing left to replay or a message could not be sent.
+ */
+static
+uint32_t dump_backlog_to_remote()
+{
+    unsigned int credit = RLOG_REPLAY_CHUNK;
+    unsigned int n = 0;
+    uint64_t interval = 0;
+    int len;
+
+    if( replay_rate )
     {
-        DBG_PRINTF("[RLOG] rlog_install_interface failed to initialize interface\n");
-        return false;
-    }
+        uint64_t now = os_get_time_us();
+        uint64_t burst;
 
-    if(coms_lock == NULL) {
-        coms_lock = os_mutex_create();
+        interval = 1000000 / replay_rate;
+        burst = interval * RLOG_REPLAY_CHUNK;
+
+        // don't save up more than a chunk while idle
+        if( now > replay_time + burst )
+            replay_time = now - burst;
+
+        credit = (now - replay_time) / interval;
+        if( credit == 0 )
+            return (replay_time + interval - now) / 1000 + 1;
+        if( credit > RLOG_REPLAY_CHUNK )
+            credit = RLOG_REPLAY_CHUNK;
     }
 
-    os_mutex_lock(coms_lock);
+    while( n < credit )
+    {        
+        if( queue_has_urgent() && !dump_queue_to_remote(0) )
+            break;
 
-    if( n_ifc >= RLOG_MAX_NUM_IFC ) {
-        DBG_PRINTF("[RLOG] rlog_install_interface failed. Too many interfaces!\n");
-        os_mutex_unlock(coms_lock);
-        return false;
+        spill_queue_to_backlog();
+
+        len = load_from_backlog(msg_buffer);
+        if( len == 0 || !rlog_send(msg_buffer, len, 0) ) 
+            break;
+
+        backlog_ack();
+        n++;
     }
 
-    coms.ifc[n_ifc++] = interface;
-    os_mutex_unlock(coms_lock);
+    // progress is written back once per chunk
+    backlog_consume();
+    replay_time += n * interval;
+    count_replayed(n);
 
-    return true;
+    return (n == credit) ? 0 : OS_WAIT_FOREVER;
 }
 
 /**
- * @brief Poll all installed interfaces to see which is avaialble.
+ * @brief Send live and backlog messages, taking turns with a weighted round robin
  * 
- * @return true If at least on interface is initialized to receive messages
- * @return false If no interface can receive messages at the moment.
+ * @return Time in miliseconds until the backlog replay can go on or 
+ * OS_WAIT_FOREVER 
  */
-bool rlog_poll()
+static
+uint32_t dispatch_to_remote()
 {
-    rlog_ifc_t p;
-    bool up = false;
+    uint32_t replay;
 
-    os_mutex_lock(coms_lock);
-    for( int i=0; i < n_ifc; i++ )
+    do 
     {
-        p = coms.ifc[i];         
-        coms.up[i] = p.poll(p.ctx);
+        if( !dump_queue_to_remote(RLOG_LIVE_WEIGHT) )
+            return OS_WAIT_FOREVER;
 
-        if( !up ) {
-            up = coms.up[i];
-        }
-    }
-    os_mutex_unlock(coms_lock);
+        replay = dump_backlog_to_remote();
+        os_sleep_us(QUEUE_POLLING_PERIOD_US);
+    } 
+    while( replay == 0 && !terminate );
 
-    return up;   
+    // the replay is done or paced, the queue is not limited anymore
+    spilled = false;
+    dump_queue_to_remote(0);
+
+    // messages just moved to the backlog are replayed right away
+    if( spilled && replay == OS_WAIT_FOREVER )
+        replay = 0;
+
+    return replay;
 }
 
-/**
- * @brief Send message to all interfaces that are initialized to receive
- * 
- * @param buf Buffer with message to be sent
- * @param len Size of the message in bytes
- * @return true If at least one interface has received the message
- * @return false If no interface has received the message
- */
-bool rlog_send(const void* buf, int len)
+static 
+void dump_queue_to_backlog()
 {
-    rlog_ifc_t p;
-    unsigned char ok = 0;
+#if RLOG_DLOG_ENABLE
+    log_t log;
 
-    os_mutex_lock(coms_lock);
-    for( int i=0; i < n_ifc; i++ )
+#if RLOG_BACKLOG_BINARY
+    // no need to render messages that may never be sent
+    while( queue_pop(&log) )
     {
-        if( coms.up[i] )
-        {
-            p = coms.ifc[i]; 
-
-            if ( p.send(p.ctx, buf, len) )
-                ok++;            
-        }         
+        store_to_backlog(&log, NULL);
+        os_sleep_us(QUEUE_POLLING_PERIOD_US);
     }
-    os_mutex_unlock(coms_lock);
-    return ( ok > 0 );
+#else
+    while( queue_get(msg_buffer, &log) )
+    {
+        store_to_backlog(&log, msg_buffer);
+        os_sleep_us(QUEUE_POLLING_PERIOD_US);
+    }
+#endif
+#endif
 }
 
+#if RLOG_HEARTBEAT
 /**
- * @brief Deinitialize all installed interfaces 
+ * @brief Render the heartbeat metrics as structured data: messages sent and 
+ * lost since the last heartbeat, queue watermark, backlog depth, and the mean 
+ * and 99th percentile in microseconds of the time from queueing to sending.
+ * The percentile is the upper bound of its latency histogram bucket.
+ * 
+ * Messages are counted once whatever the number of interfaces. Lost messages
+ * are the ones that never reached an interface, plus the most any single 
+ * interface dropped.
+ * 
+ * @param sd Buffer to hold the structured data
+ * @param size Size of the buffer
+ * @return false If the counters can't be read, i.e. the server is stopping
  */
-void rlog_deinit()
+static
+bool heartbeat_sd(char* sd, int size)
 {
-    rlog_ifc_t p;
+    static const rlog_ifc_stats_t zero;
+    rlog_stats_t* last = &heartbeat_stats;
+    rlog_stats_t now;
+    unsigned int hist[RLOG_LATENCY_BUCKETS] = { 0 };
+    unsigned int sent;
+    unsigned int lost;
+    unsigned int ifc_lost = 0;
+    uint64_t sum = 0;
+    unsigned int n = 0;
+    unsigned int p99 = 0;
+
+    if( !rlog_get_stats(&now) )
+        return false;
 
-    os_mutex_lock(coms_lock);
-    for( int i=0; i < n_ifc; i++ )
+    // counters wrap around, the differences don't
+    sent = now.sent - last->sent;
+    lost = (now.overflowed - last->overflowed) + (now.dropped - last->dropped);
+    for( unsigned int i = 0; i < now.n_ifc; i++ )
     {
-        p = coms.ifc[i]; 
+        // interfaces installed since the last heartbeat start from zero
+        const rlog_ifc_stats_t* base = ( i < last->n_ifc && now.n_ifc >= last->n_ifc ) ? &last->ifc[i] : &zero;
 
-        if( p.deinit ) {
-            p.deinit(p.ctx);
+        unsigned int d = now.ifc[i].dropped - base->dropped;
+        if( d > ifc_lost )
+            ifc_lost = d;
+
+        sum += now.ifc[i].latency_us - base->latency_us;
+        for( int b = 0; b < RLOG_LATENCY_BUCKETS; b++ ) 
+        {
+            d = now.ifc[i].latency[b] - base->latency[b];
+            hist[b] += d;
+            n += d;
         }
+    }
+    lost += ifc_lost;
 
+    for( unsigned int b = 0, cnt = 0; n && b < RLOG_LATENCY_BUCKETS; b++ )
+    {
+        cnt += hist[b];
+        if( (uint64_t) cnt * 100 >= (uint64_t) n * 99 ) {
+            // the last bucket has no upper bound
+            p99 = (b < RLOG_LATENCY_BUCKETS - 1) ? 64u << (2 * b) : 64u << (2 * (b - 1));
+            break;
+        }
     }
-    os_mutex_unlock(coms_lock);
+
+    snprintf(sd, size, "[" RLOG_HEARTBEAT_SD_ID " sent=\"%u\" lost=\"%u\" qmax=\"%u\" backlog=\"%u\" lat=\"%u\" p99=\"%u\"]",
+        sent, lost, now.queue_max_cnt, now.backlog_cnt, n ? (unsigned int)(sum / n) : 0, p99);
+
+    *last = now;
+    return true;
 }
+#endif
 
-#if _RLOG_DBG_   
+/**
+ * @brief Send a heartbeat with runtime metrics once per 
+ * RLOG_HEARTBEAT_PERIOD_SEC. It is rendered and sent right away, and lost if
+ * no interface takes it.
+ */
 static
-void rlog_print_dbg_stats()
+void send_heartbeat(void)
 {
- 
-    // frequency divider so not to pollute stdout
-    static uint32_t dbg_ctr = 0;
-
-    uint32_t    queue_ovf;
-    uint32_t    queue_cnt;
-    uint32_t    queue_max_cnt;
+#if RLOG_HEARTBEAT
+    char sd[MSG_MAX_SIZE_CHAR];
+    log_t log;
 
-    if( dbg_ctr++ < 50)
+    uint64_t now = os_get_time_us();
+    if( now < heartbeat_deadline ) 
         return;
 
-    dbg_ctr = 0;
-    os_mutex_lock(queue_lock);
-    queue_ovf = msg_queue.ovf;
-    queue_cnt = msg_queue.cnt;
-    queue_max_cnt = msg_queue.max_cnt;    
-    os_mutex_unlock(queue_lock);
+    heartbeat_deadline = now + HEARTBEAT_PERIOD_US;
 
-    DBG_PRINTF("[RLOG] Queue overflows: %d\n", queue_ovf);
-    DBG_PRINTF("[RLOG] Queue count: %d\n", queue_cnt);
-    DBG_PRINTF("[RLOG] Queue watermark: %d\n", queue_max_cnt);
+    // the metrics cover the period even if the heartbeat is filtered out
+    if( !heartbeat_sd(sd, sizeof(sd)) || RLOG_DEBUG > filter )
+        return;
 
-}
+#if RLOG_TIMESTAMP_ENABLE
+    time(&log.timestamp);
 #endif
+    log.pri = 8 + RLOG_DEBUG;
+    fast_strncpy(log.proc, os_thread_get_name(NULL), sizeof(log.proc) - 1);
+    fast_strncpy(log.msg, "Heartbeat", sizeof(log.msg) - 1);
 
-#define SERVER_BANNER "RLOG Server v"RLOG_VERSION " up and running!"
-#define EVENT_TIMEOUT_SEC 1
-#define EVENT_TIMEOUT (EVENT_TIMEOUT_SEC * 1000)
-#define QUEUE_POLLING_PERIOD_US 0
+    // truncated structured data can't be parsed
+    int len = make_log_string_sd(log_format, hostname, msg_buffer, &log, sd);
+    if( len <= 0 || len >= MSG_MAX_SIZE_CHAR - 1 )
+        len = make_log_string(log_format, hostname, msg_buffer, &log);
+
+    if( len > 0 )
+        rlog_send(msg_buffer, len, 0);
+#endif                
+}
 
+/**
+ * @brief Time left until the next heartbeat is due
+ * 
+ * @return Time in milliseconds, OS_WAIT_FOREVER if heartbeats are disabled
+ */
+static
+uint32_t heartbeat_timeout(void)
+{
 #if RLOG_HEARTBEAT
-    #define HEARTBEAT_PERIOD_TICKS (RLOG_HEARTBEAT_PERIOD_SEC / EVENT_TIMEOUT_SEC)
+    uint64_t now = os_get_time_us();
+    if( now >= heartbeat_deadline )
+        return 0;
+
+    return (uint32_t)((heartbeat_deadline - now) / 1000 + 1);
+#else
+    return OS_WAIT_FOREVER;
 #endif
+}
 
+/**
+ * @brief Decide if the queued messages can wait for the rest of their batch.
+ * When they are sent, the batch size is set to the number of messages 
+ * expected within the batch time at the current rate, so light traffic is 
+ * sent right away and heavy traffic in large batches.
+ * 
+ * @return Time in milliseconds the queue can still wait, 0 to send it now
+ */
 static
-void dump_dlog_to_remote()
+uint32_t batch_hold(void)
 {
-#if RLOG_DLOG_ENABLE
-    //dispatch all enqueued log messages
-    while( dlog_peek(&logger, msg_buffer, sizeof(msg_buffer)) )
-    {        
-        if( rlog_send(msg_buffer, strlen(msg_buffer)) ) 
-        { 
-            dlog_next(&logger); 
+    uint64_t now;
+    uint64_t first = UINT64_MAX;
+    uint64_t target;
+    unsigned int cnt = 0;
+    bool full = false;
+    bool flush = false;
+
+    if( batch.nlogs == 0 )
+        return 0;
+
+    for( int i = 0; i < RLOG_QUEUE_SHARDS; i++ )
+    {
+        struct queue_s* q = &msg_queue[i];
+
+        os_mutex_lock(q->lock);
+        if( q->flush ) {
+            q->flush = false;
+            flush = true;
         }
-        else
-        {
-            break;
-        }      
-        os_sleep_us(QUEUE_POLLING_PERIOD_US);
+        if( q->cnt && q->first_us < first )
+            first = q->first_us;
+        if( q->cnt >= batch.size )
+            full = true;
+        cnt += q->cnt;
+        os_mutex_unlock(q->lock);
     }
-#endif
-}
 
-static 
-void dump_queue_to_remote()
-{
-    //dispatch all enqueued log messages
-    int len = queue_get(msg_buffer);
-    while( len )
-    {        
-        if( !rlog_send(msg_buffer, len) )
-        {
-            // failed to send, put it on dlog for later
-            dlog_put(&logger, msg_buffer);
-            break;
-        }           
-        os_sleep_us(QUEUE_POLLING_PERIOD_US);
-        len = queue_get(msg_buffer);
+    now = os_get_time_us();
+    if( !flush && !full && cnt )
+    {
+        uint64_t age = (now > first) ? now - first : 0;
+        if( age < batch.us )
+            return (uint32_t)((batch.us - age) / 1000 + 1);
     }
-}
 
-static 
-void dump_queue_to_dlog()
-{
-#if RLOG_DLOG_ENABLE                                     
-    while( queue_get(msg_buffer) )
+    if( cnt && now > batch.last_us )
     {
-        dlog_put(&logger, msg_buffer);
-        os_sleep_us(QUEUE_POLLING_PERIOD_US);
+        // rate since the last batch, averaged with the current size while 
+        // batches fill up, so a burst alone doesn't make them large
+        target = (uint64_t) cnt * batch.us / (now - batch.last_us);
+        if( full )
+            target = (target + batch.size + 1) / 2;
+        if( target > batch.nlogs )
+            target = batch.nlogs;
+        batch.size = target ? target : 1;
+        batch.last_us = now;
     }
-#endif                   
+
+    return 0;
 }
 
+/**
+ * @brief Send the queued messages until the shutdown deadline, then move the
+ * rest to the backlog
+ */
 static
-void send_heartbeat(void)
+void drain_queue(void)
 {
-#if RLOG_HEARTBEAT
-    heartbeat_timer++;
-    if( heartbeat_timer > HEARTBEAT_PERIOD_TICKS ) 
+    log_t log;
+    int len;
+
+    if( os_get_time_us() < shutdown_deadline && rlog_poll() )
     {
-        rlog(RLOG_DEBUG,"Heartbeat.. rlog server is still running!");
-        heartbeat_timer = 0;
+        while( os_get_time_us() < shutdown_deadline )
+        {
+            len = queue_get(msg_buffer, &log);
+            if( len == 0 )
+                break;
+
+            if( !rlog_send(msg_buffer, len, queue_stamp) ) {
+                store_to_backlog(&log, msg_buffer);
+                break;
+            }
+        }
     }
-#endif                
+
+    dump_queue_to_backlog();
 }
 
 static
 void server_thread(void* arg)
 {                
     uint32_t evts = 0; 
+    uint32_t timeout = EVENT_TIMEOUT;
+    uint32_t replay = OS_WAIT_FOREVER;
+    uint32_t hold = 0;
+    bool up = false;
+
+#if RLOG_HEARTBEAT
+    heartbeat_deadline = os_get_time_us() + HEARTBEAT_PERIOD_US;
+    memset(&heartbeat_stats, 0, sizeof(heartbeat_stats));
+#endif
 
     rlog(RLOG_INFO, SERVER_BANNER);
     while( !terminate )
     {         
-        evts = os_event_wait(wakeup_events, EVENTS_MASK, EVENT_TIMEOUT);
+        evts = os_event_wait(wakeup_events, EVENTS_MASK, timeout);
         os_event_clear(wakeup_events, evts);
 
-        if( rlog_poll() )
-        {
-            // check backlog
-            dump_dlog_to_remote();
+        // the queue waits for the rest of its batch unless there is something
+        // else to do anyway
+        hold = 0;
+        if( (evts & ~EVENT_NEW_MSG) == 0 && replay == OS_WAIT_FOREVER && heartbeat_timeout() > 0 )
+            hold = batch_hold();
 
-            if( !evts )
+        if( hold == 0 )
+        {
+            up = rlog_poll();
+            if( up )
+            {
+                // due on time whatever the traffic
                 send_heartbeat();
 
-            if( evts & EVENT_NEW_MSG )
-                dump_queue_to_remote();
-        }
-        else
-        {
-            dump_queue_to_dlog();
+                // live messages and backlog replay
+                replay = dispatch_to_remote();
+            }
+            else
+            {
+                dump_queue_to_backlog();
+                replay = OS_WAIT_FOREVER;
+            }
         }
 
+        // sleep until something happens, interfaces that can't notify a
+        // change in their state still need to be polled periodically
+        timeout = coms.polled ? EVENT_TIMEOUT : OS_WAIT_FOREVER;
+
+        // wake up in time to commit staged backlog messages, to go on with 
+        // the replay and to send the heartbeat
+        uint32_t commit = backlog_sync();
+        if( timeout > commit )
+            timeout = commit;
+        if( timeout > replay )
+            timeout = replay;
+        if( up && timeout > heartbeat_timeout() )
+            timeout = heartbeat_timeout();
+        if( hold && timeout > hold )
+            timeout = hold;
+
 #if _RLOG_DBG_
         rlog_print_dbg_stats();
 #endif
     }
 
-    rlog_deinit(); 
+    // last chance for the queued messages
+    drain_queue();
+    if( rlog_deinit(lane_timeout()) ) {
+        backlog_close();
+        released = true;
+    }
+
+    // the handle is gone with the thread, send_direct() must not match a
+    // thread created later at the same address
+    thread_handle = NULL;
+    os_sem_signal(thread_done);
+    os_thread_destroy(NULL);
 }
\ No newline at end of file
@@ -42,10 +42,104 @@
     #define RLOG_TIMESTAMP_ENABLE 1
 #endif
 
+/**
+ * @brief Enable (1) or Disable (0) the backup file to store messages while
+ * no interface is available.
+ */
 #ifndef RLOG_DLOG_ENABLE
     #define RLOG_DLOG_ENABLE 1
 #endif
 
+/**
+ * @brief Backup file engines. 
+ * RLOG_BACKLOG_DLOG stores one line per message through the dlog library.
+ * RLOG_BACKLOG_MMAP stores messages in a fixed size memory-mapped circular 
+ * file, see backlog/mlog.h. Requires a POSIX mmap().
+ * RLOG_BACKLOG_SEGMENTS stores messages in segment files that are compressed
+ * once full, see backlog/slog.h. The budget of nlogs * MSG_MAX_SIZE_CHAR 
+ * bytes then holds several times more messages. Errors and worse, warnings to
+ * info and debug messages are kept apart: when the budget runs out debug 
+ * messages are dropped first, and replay sends errors first.
+ */
+#define RLOG_BACKLOG_DLOG 0
+#define RLOG_BACKLOG_MMAP 1
+#define RLOG_BACKLOG_SEGMENTS 2
+
+/**
+ * @brief Backup file engine, only used if RLOG_DLOG_ENABLE is set to 1.
+ */
+#ifndef RLOG_BACKLOG_ENGINE
+    #define RLOG_BACKLOG_ENGINE RLOG_BACKLOG_DLOG
+#endif
+
+/**
+ * @brief Size in bytes of each backup file segment when RLOG_BACKLOG_ENGINE
+ * is RLOG_BACKLOG_SEGMENTS. Full segments are compressed in the background.
+ */
+#ifndef RLOG_SEGMENT_SIZE
+    #define RLOG_SEGMENT_SIZE (64 * 1024)
+#endif
+
+/**
+ * @brief Store messages in the backup file in their compact form (timestamp, 
+ * priority, process and message) and only render them when they are sent. 
+ * This saves the formatting cost while disconnected, lets more messages fit
+ * in the mmap engine and renders them with the hostname and format in use at 
+ * replay time. Set to 0 to store fully rendered messages.
+ */
+#ifndef RLOG_BACKLOG_BINARY
+    #define RLOG_BACKLOG_BINARY 0
+#endif
+
+/**
+ * @brief Number of messages replayed from the backup file before the 
+ * progress is written back to it. On a power cut at most this many messages
+ * are sent again.
+ */
+#ifndef RLOG_REPLAY_CHUNK
+    #define RLOG_REPLAY_CHUNK 32
+#endif
+
+/**
+ * @brief While the backup file is replayed, live messages and replayed 
+ * messages take turns: up to RLOG_LIVE_WEIGHT messages from the queue, then
+ * up to RLOG_REPLAY_CHUNK messages from the backup file.
+ */
+#ifndef RLOG_LIVE_WEIGHT
+    #define RLOG_LIVE_WEIGHT 16
+#endif
+
+/**
+ * @brief Queued messages with this level or more severe don't wait for their
+ * turn, they are sent before the next replayed message.
+ */
+#ifndef RLOG_URGENT_LEVEL
+    #define RLOG_URGENT_LEVEL RLOG_CRIT
+#endif
+
+/**
+ * @brief Default maximum time in microseconds a queued message waits for the
+ * rest of its batch, see rlog_cfg_t::batch_nlogs
+ */
+#ifndef RLOG_BATCH_US
+    #define RLOG_BATCH_US 10000
+#endif
+
+/**
+ * @brief Maximum number of installed interfaces
+ */
+#ifndef RLOG_MAX_NUM_IFC
+    #define RLOG_MAX_NUM_IFC 2
+#endif
+
+/**
+ * @brief Number of buckets of the interface latency histograms, see 
+ * rlog_ifc_stats_t::latency
+ */
+#ifndef RLOG_LATENCY_BUCKETS
+    #define RLOG_LATENCY_BUCKETS 8
+#endif
+
 /**
  * @brief RLOG configuration structure
  */
@@ -62,6 +156,27 @@ typedef struct rlog_cfg_t
      * @brief Rlog thread priority
      */
     unsigned int priority;
+
+    /**
+     * @brief Rlog thread stack size in bytes. Set to 0 (default) for 
+     * RLOG_STACK_SIZE.
+     */
+    unsigned int stack;
+
+    /**
+     * @brief Bit mask of the CPU cores the rlog thread may run on, bit 0 for 
+     * core 0. Set to 0 (default) to let the scheduler choose. On ESP32 the 
+     * thread is only pinned if a single core is set.
+     */
+    uint32_t affinity;
+
+    /**
+     * @brief Rlog thread scheduling policy. With OS_SCHED_FIFO or OS_SCHED_RR
+     * on Linux, priority is the real-time priority of the thread, which needs
+     * CAP_SYS_NICE. Without it the thread keeps the default policy. 
+     * Default value is OS_SCHED_DEFAULT.
+     */
+    os_sched_t policy;
     
     /**
      * @brief Fullpath for backup file, including filename. Only used if
@@ -88,21 +203,309 @@ typedef struct rlog_cfg_t
      */
     RLOG_LEVEL level;
 
+    /**
+     * @brief Backup file group commit. Messages are staged in RAM and written to
+     * the backup file together once this many are staged. At most this many 
+     * messages can be lost on a power cut. Set to 0 (default) to write every
+     * message as it comes. Only used if RLOG_DLOG_ENABLE is set to 1.
+     */
+    unsigned int commit_nlogs;
+
+    /**
+     * @brief Backup file group commit. Maximum time in miliseconds a message
+     * can stay staged in RAM, 0 means no limit. Only used if commit_nlogs is set.
+     */
+    unsigned int commit_ms;
+
+    /**
+     * @brief Backup file group commit. Messages with this level or more severe
+     * are written right away, along with everything staged before them. 
+     * Only used if commit_nlogs is set. Default value is RLOG_EMERGENCY.
+     */
+    RLOG_LEVEL commit_level;
+
+    /**
+     * @brief Maximum number of messages per second replayed from the backup
+     * file once the connection is back, so the collector is not flooded.
+     * Set to 0 (default) for no limit. Only used if RLOG_DLOG_ENABLE is set to 1.
+     */
+    unsigned int replay_rate;
+
+    /**
+     * @brief Batching of live messages. The rlog thread is woken up once a batch
+     * of messages is queued instead of once per message. The batch size adapts to
+     * the load: it grows up to this many messages while they come faster than 
+     * they are sent and shrinks down to one message when traffic is light.
+     * Set to 0 (default) to wake up the rlog thread for every message.
+     */
+    unsigned int batch_nlogs;
+
+    /**
+     * @brief Batching of live messages. Maximum time in microseconds a message 
+     * waits for the rest of its batch, rounded up to miliseconds. Set to 0 for
+     * RLOG_BATCH_US. Only used if batch_nlogs is set.
+     */
+    unsigned int batch_us;
+
+    /**
+     * @brief Batching of live messages. Messages with this level or more severe
+     * are sent right away, along with everything queued before them.
+     * Only used if batch_nlogs is set. Default value is RLOG_EMERGENCY.
+     */
+    RLOG_LEVEL batch_level;
+
+    /**
+     * @brief File descriptor rlog_panic_flush() writes the queued messages to,
+     * opened beforehand. Set to 0 (default) to write them to the panic file
+     * next to the backup file instead, which only works with the 
+     * RLOG_BACKLOG_MMAP engine. They are moved to the backup file by the next
+     * rlog_init().
+     */
+    int panic_fd;
+
+    /**
+     * @brief Direct path. Messages with direct_level or more severe skip the
+     * queue: the calling thread renders them and sends them to the interfaces
+     * right away, waiting at most for the message the rlog thread is sending.
+     * Interfaces with a dispatch lane get them at the front of the lane. If no
+     * interface takes the message it is queued as usual and ends up in the 
+     * backup file. The message is rendered on the stack of the calling 
+     * thread, which needs MSG_MAX_SIZE_CHAR bytes more for it: make room in
+     * small RTOS task stacks. Disabled by default.
+     */
+    bool direct;
+
+    /**
+     * @brief Direct path level, only used if direct is set. Default value is 
+     * RLOG_EMERGENCY.
+     */
+    RLOG_LEVEL direct_level;
+
 }rlog_cfg_t;
 
+/**
+ * @brief Dispatch lane configuration, see rlog_install_interface_lane()
+ */
+typedef struct rlog_lane_cfg_t
+{
+    /**
+     * @brief Maximum number of messages waiting on the lane. Once full
+     * the oldest message is dropped.
+     */
+    unsigned int depth;
+
+    /**
+     * @brief Lane worker thread priority
+     */
+    unsigned int priority;
+
+    /**
+     * @brief Lane worker CPU affinity, see rlog_cfg_t::affinity
+     */
+    uint32_t affinity;
+
+    /**
+     * @brief Lane worker scheduling policy, see rlog_cfg_t::policy
+     */
+    os_sched_t policy;
+
+}rlog_lane_cfg_t;
+
+/**
+ * @brief Dispatch lane counters
+ */
+typedef struct rlog_lane_stats_t
+{
+    /**
+     * @brief Messages successfully sent by the interface
+     */
+    unsigned int sent;
+
+    /**
+     * @brief Messages the interface failed to send. These are lost.
+     */
+    unsigned int failed;
+
+    /**
+     * @brief Messages dropped because the lane was full
+     */
+    unsigned int dropped;
+
+    /**
+     * @brief Maximum number of messages waiting on the lane so far
+     */
+    unsigned int max_cnt;
+
+}rlog_lane_stats_t;
+
+/**
+ * @brief Interface counters, see rlog_get_stats()
+ */
+typedef struct rlog_ifc_stats_t
+{
+    /**
+     * @brief Messages successfully sent by the interface
+     */
+    unsigned int sent;
+
+    /**
+     * @brief Messages the interface failed to send
+     */
+    unsigned int failed;
+
+    /**
+     * @brief Messages dropped because the dispatch lane of the interface was full
+     */
+    unsigned int dropped;
+
+    /**
+     * @brief Histogram of the time from the message being queued to being 
+     * sent. Bucket i counts the messages sent in less than 64 << (2 * i) 
+     * microseconds (64us, 256us, 1ms, 4ms...) and not in the previous ones, 
+     * the last bucket counts all the slower ones. Replayed messages are not 
+     * counted.
+     */
+    unsigned int latency[RLOG_LATENCY_BUCKETS];
+
+    /**
+     * @brief Sum in microseconds of the times counted in the latency 
+     * histogram. The mean over a period is the difference of two readings 
+     * divided by the messages counted in between.
+     */
+    uint64_t latency_us;
+
+}rlog_ifc_stats_t;
+
+/**
+ * @brief Logging counters, see rlog_get_stats()
+ */
+typedef struct rlog_stats_t
+{
+    /**
+     * @brief Messages put on the queue
+     */
+    unsigned int enqueued;
+
+    /**
+     * @brief Messages overwritten because their queue class was full
+     */
+    unsigned int overflowed;
+
+    /**
+     * @brief Messages that could neither be sent nor stored in the backup file
+     */
+    unsigned int dropped;
+
+    /**
+     * @brief Messages handed to at least one interface, counted once 
+     * whatever the number of interfaces
+     */
+    unsigned int sent;
+
+    /**
+     * @brief Messages moved to the backup file above RLOG_QUEUE_HIGH_WATERMARK
+     */
+    unsigned int spilled;
+
+    /**
+     * @brief Messages waiting on the queue
+     */
+    unsigned int queue_cnt;
+
+    /**
+     * @brief Maximum number of messages waiting on a queue shard so far
+     */
+    unsigned int queue_max_cnt;
+
+    /**
+     * @brief Messages waiting on the backup file to be replayed. Only the
+     * RLOG_BACKLOG_MMAP engine counts the ones left by a previous run.
+     */
+    unsigned int backlog_cnt;
+
+    /**
+     * @brief Messages replayed from the backup file
+     */
+    unsigned int replayed;
+
+    /**
+     * @brief Messages replayed per second over the last second, 0 if the 
+     * replay is idle
+     */
+    unsigned int replay_rate;
+
+    /**
+     * @brief Number of installed interfaces
+     */
+    unsigned int n_ifc;
+
+    /**
+     * @brief Counters of each interface, in order of installation
+     */
+    rlog_ifc_stats_t ifc[RLOG_MAX_NUM_IFC];
+
+}rlog_stats_t;
+
 /**
  * @brief Initializes rlog server.
  * @param cfg Configuration options
  * @return true if succesfull initialized the server
- * @return false if failed
+ * @return false if failed, or if a previous rlog_shutdown() didn't complete
  */
 bool rlog_init(rlog_cfg_t cfg);
 
 /**
- * @brief Kills the server and de-initialize all installed interfaces;
+ * @brief Kills the server and de-initialize all installed interfaces; 
+ * Messages logged from now on are dropped. Queued messages are moved to the
+ * backup file. Call rlog_shutdown() to release the resources before calling
+ * rlog_init() again.
  */
 void rlog_kill(void);
 
+/**
+ * @brief Stops the server and releases all its resources so rlog_init() can 
+ * be called again. Queued messages, including the ones waiting on dispatch 
+ * lanes, are sent until the timeout expires and the rest is written to the 
+ * backup file. Messages left on dispatch lanes are already rendered, so they
+ * are dropped instead if RLOG_BACKLOG_BINARY is set, and a message left on
+ * several lanes is stored once for each of them. Installed interfaces are 
+ * de-initialized and removed. 
+ * Messages logged from now on are dropped, threads already logging are waited
+ * for before anything is released.
+ * 
+ * @param timeout Time in miliseconds for sending the queued messages, 
+ * OS_WAIT_FOREVER to send all of them
+ * @return false If the rlog thread, a dispatch lane worker or a logging 
+ * thread didn't finish in time, i.e. it is blocked on an interface. Nothing
+ * is released then, and rlog_init() fails until rlog_shutdown() is called 
+ * again and succeeds.
+ */
+bool rlog_shutdown(uint32_t timeout);
+
+/**
+ * @brief Emergency drain of the message queue and the dispatch lanes, meant 
+ * to be called from a fatal signal handler or an assert hook. Messages not 
+ * sent yet are rendered without taking any lock or allocating memory and 
+ * written to rlog_cfg_t::panic_fd or to the panic file, see 
+ * RLOG_BACKLOG_PANIC_NLOGS. Messages staged for the backup file are copied 
+ * first. It never waits for another thread.
+ * 
+ * The queue, the lanes and the staged messages are read without their locks,
+ * as a lock may be held by a thread that will never run again. So some 
+ * messages can still be lost:
+ * - a message being queued, staged or taken off a lane at that moment can be
+ * garbled or missed;
+ * - the message an interface is sending at that moment, it is no longer 
+ * queued;
+ * - the oldest messages if there are more than the panic file holds;
+ * - lane messages going to the panic file with RLOG_BACKLOG_BINARY set, as 
+ * only their rendered form is left.
+ * 
+ * A message waiting on several lanes is written once for each of them.
+ * Only the first call does something.
+ */
+void rlog_panic_flush(void);
+
 /**
  * @brief Insert a log message into the queue
  * 
@@ -126,10 +529,55 @@ void rlogf(RLOG_LEVEL type, const char* format, ...);
  * This function will first attempt to intialize the interface using the provided 
  * init function and only then it will install the function pointers.
  * 
+ * Interfaces can be installed before rlog_init() or while the server is up.
+ * 
  * @param interface  Interface descriptor
  * @return true If interface was installed and initialized.
- * @return false If failed to install the interface.
+ * @return false If failed to install the interface, also while 
+ * rlog_shutdown() is in progress.
  */
 bool rlog_install_interface(rlog_ifc_t interface);
 
+/**
+ * @brief Install a new interface instance served by its own dispatch lane.
+ * The rlog thread only copies messages to the lane queue and a dedicated worker 
+ * calls the send function, so a slow interface (i.e. a TCP peer with a full window
+ * or a slow UART console) does not delay the delivery to the other interfaces.
+ * Messages dropped on a full lane or that fail to be sent by the worker are
+ * not stored in the backup file, see rlog_get_lane_stats().
+ * 
+ * @param interface Interface descriptor
+ * @param cfg Lane configuration
+ * @return true If interface was installed and initialized.
+ * @return false If failed to install the interface.
+ */
+bool rlog_install_interface_lane(rlog_ifc_t interface, rlog_lane_cfg_t cfg);
+
+/**
+ * @brief Wake up the rlog thread to poll the interfaces again. To be called by
+ * interfaces with the notify flag set whenever the result of their poll 
+ * function may have changed. Can be called from any thread.
+ */
+void rlog_ifc_changed(void);
+
+/**
+ * @brief Read the counters of a dispatch lane.
+ * 
+ * @param index Interface index, in order of installation starting from 0
+ * @param stats Pointer to structure to hold the counters
+ * @return true If the interface exists and is served by a dispatch lane
+ * @return false Otherwise, also if the server is not up
+ */
+bool rlog_get_lane_stats(unsigned int index, rlog_lane_stats_t* stats);
+
+/**
+ * @brief Read the logging counters. Can be called from any thread, the 
+ * counters are read one by one and may be slightly out of step.
+ * 
+ * @param stats Pointer to structure to hold the counters
+ * @return true If the server is up
+ * @return false Otherwise, also while rlog_shutdown() is in progress
+ */
+bool rlog_get_stats(rlog_stats_t* stats);
+
 #endif //_RLOG_H_
\ No newline at end of file
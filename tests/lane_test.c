@@ -0,0 +1,165 @@
+/**
+ * @file lane_test.c
+ * @author edsp
+ * @brief Direct messages on a full dispatch lane. Linux only, see 
+ * tests/Makefile.
+ * @version 1.0.0
+ * @date 2024-01-10
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *
+ * The lane worker is held inside the send function while regular messages
+ * fill its lane. Two direct messages are put on the full lane and more 
+ * regular messages follow. Once the worker is released the direct messages
+ * must be the next ones sent, in the order they were logged.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "rlog.h"
+
+#define TEST_LANE_DEPTH 4
+#define TEST_MAX_SENT   64
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+    if( !(cond) ) { \
+        printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+        failures++; \
+    } \
+} while(0)
+
+static pthread_mutex_t gate = PTHREAD_MUTEX_INITIALIZER;
+static char sent[TEST_MAX_SENT][RLOG_MAX_SIZE_CHAR];
+static int n_sent = 0;
+
+static bool test_init(void* ctx)
+{
+    return true;
+}
+
+static bool test_poll(void* ctx)
+{
+    return true;
+}
+
+/**
+ * @brief Record the message, blocks while the gate is held
+ */
+static bool test_send(void* ctx, const void* buf, int len)
+{
+    pthread_mutex_lock(&gate);
+    if( n_sent < TEST_MAX_SENT ) {
+        if( len >= RLOG_MAX_SIZE_CHAR )
+            len = RLOG_MAX_SIZE_CHAR - 1;
+        memcpy(sent[n_sent], buf, len);
+        sent[n_sent][len] = 0;
+        n_sent++;
+    }
+    pthread_mutex_unlock(&gate);
+    return true;
+}
+
+/**
+ * @brief Position of the first message sent containing text, -1 if none
+ */
+static int find_sent(const char* text)
+{
+    int pos = -1;
+
+    pthread_mutex_lock(&gate);
+    for( int i = 0; i < n_sent && pos < 0; i++ )
+        if( strstr(sent[i], text) )
+            pos = i;
+    pthread_mutex_unlock(&gate);
+
+    return pos;
+}
+
+int main(void)
+{
+    char path[] = "/tmp/lane_test_XXXXXX";
+    int fd = mkstemp(path);
+    if( fd < 0 ) {
+        printf("FAIL: can't create %s\n", path);
+        return 1;
+    }
+    close(fd);
+    unlink(path);
+
+    rlog_cfg_t cfg = {
+        .name = "host",
+        .priority = 1,
+        .format = RLOG_RFC5424,
+        .level = RLOG_DEBUG,
+        .filepath = path,
+        .nlogs = 100,
+        .direct = true,
+        .direct_level = RLOG_ALERT,
+    };
+    rlog_ifc_t ifc = { .init = test_init, .poll = test_poll, .send = test_send, .notify = true };
+    rlog_lane_cfg_t lane = { .depth = TEST_LANE_DEPTH, .priority = 1 };
+
+    pthread_mutex_lock(&gate);
+
+    CHECK(rlog_init(cfg), "init failed");
+    CHECK(rlog_install_interface_lane(ifc, lane), "install failed");
+    usleep(100000);
+
+    // the worker is stuck on the first message, the rest fill the lane
+    for( int i = 0; i < 3 * TEST_LANE_DEPTH; i++ )
+        rlogf(RLOG_INFO, "before %d", i);
+    usleep(100000);
+
+    rlog(RLOG_EMERGENCY, "direct 1");
+    rlog(RLOG_ALERT, "direct 2");
+
+    for( int i = 0; i < 3 * TEST_LANE_DEPTH; i++ )
+        rlogf(RLOG_INFO, "after %d", i);
+    usleep(100000);
+
+    pthread_mutex_unlock(&gate);
+    usleep(200000);
+
+    int d1 = find_sent("direct 1");
+    int d2 = find_sent("direct 2");
+
+    CHECK(d1 >= 0, "direct 1 was not sent");
+    CHECK(d2 >= 0, "direct 2 was not sent");
+    CHECK(d1 == 1 && d2 == 2, "direct messages sent as #%d and #%d, expected #1 and #2", d1, d2);
+    CHECK(find_sent("after") > d2, "regular messages went ahead of the direct ones");
+
+    rlog_lane_stats_t stats;
+    CHECK(rlog_get_lane_stats(0, &stats) && stats.dropped > 0, "lane never overflowed");
+
+    CHECK(rlog_shutdown(1000), "shutdown failed");
+
+    char panic_path[sizeof(path) + 8];
+    snprintf(panic_path, sizeof(panic_path), "%s.panic", path);
+    unlink(panic_path);
+    unlink(path);
+
+    printf("lane_test: %s, %d messages sent, %u dropped on the lane\n", 
+        failures ? "FAILED" : "passed", n_sent, stats.dropped);
+    return failures ? 1 : 0;
+}
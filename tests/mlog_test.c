@@ -0,0 +1,132 @@
+/**
+ * @file mlog_test.c
+ * @author edsp
+ * @brief Recovery of the memory-mapped backlog file after a crash. Linux 
+ * only, see tests/Makefile.
+ * @version 1.0.0
+ * @date 2024-01-10
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ *
+ * A child process appends a large backlog without ever calling mlog_sync(),
+ * as the write-through policy does, and dies without closing the file. The
+ * records checked when the file is opened again must stay within 
+ * MLOG_CHECKPOINT_BYTES and none of the records may be lost.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "backlog/mlog.h"
+
+#define TEST_FILE_SIZE  (4 * 1024 * 1024)
+#define TEST_RECORDS    200000
+#define TEST_REC_SIZE   56
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+    if( !(cond) ) { \
+        printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+        failures++; \
+    } \
+} while(0)
+
+/**
+ * @brief Append the records and die as if the process crashed
+ */
+static
+void writer(const char* path)
+{
+    mlog_t log;
+    char rec[TEST_REC_SIZE];
+
+    if( mlog_open(&log, path, TEST_FILE_SIZE) != MLOG_OK )
+        _exit(2);
+
+    for( unsigned int i = 0; i < TEST_RECORDS; i++ )
+    {
+        snprintf(rec, sizeof(rec), "%055u", i);
+        if( !mlog_put(&log, rec, TEST_REC_SIZE) )
+            _exit(3);
+    }
+
+    _exit(0);
+}
+
+int main(void)
+{
+    char path[] = "/tmp/mlog_test_XXXXXX";
+    const void* rec;
+    mlog_t log;
+    int status;
+
+    int fd = mkstemp(path);
+    if( fd < 0 ) {
+        printf("FAIL: can't create %s\n", path);
+        return 1;
+    }
+    close(fd);
+    unlink(path);
+
+    pid_t pid = fork();
+    if( pid == 0 )
+        writer(path);
+
+    waitpid(pid, &status, 0);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0, "writer failed %d", status);
+
+    CHECK(mlog_open(&log, path, TEST_FILE_SIZE) == MLOG_OK, "open failed");
+
+    uint32_t bound = MLOG_CHECKPOINT_BYTES / MLOG_ALIGN(sizeof(mlog_rec_t) + TEST_REC_SIZE) + 2;
+    CHECK(log.recovered <= bound, "checked %u records on open, expected at most %u", log.recovered, bound);
+
+    // the newest record must be there, and the records must be in sequence
+    uint32_t count = mlog_count(&log);
+    unsigned int first = 0;
+    uint64_t pos = 0;
+    unsigned int n = 0;
+    uint32_t len;
+
+    CHECK(count > 0 && count <= TEST_RECORDS, "count %u", count);
+
+    while( (len = mlog_read(&log, &pos, &rec)) )
+    {
+        unsigned int v = strtoul(rec, NULL, 10);
+        if( n == 0 )
+            first = v;
+
+        CHECK(len == TEST_REC_SIZE && v == first + n, "record %u is %u", n, v);
+        if( failures )
+            break;
+        n++;
+    }
+
+    CHECK(n == count, "read %u of %u records", n, count);
+    CHECK(first + n == TEST_RECORDS, "last record %u", first + n - 1);
+
+    mlog_close(&log);
+    unlink(path);
+
+    printf("mlog_test: %s, %u records checked on open for %u in the file\n", 
+        failures ? "FAILED" : "passed", log.recovered, count);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,240 @@
+/**
+ * @file rlogcat.c
+ * @author edsp
+ * @brief Print the messages of a backlog pulled off a device, see 
+ * backlog/reader.h. Host only.
+ * @version 1.0.0
+ * @date 2024-01-10
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ * 
+ * 
+ * Build from the repository root:
+ * 
+ *     gcc -O2 -I. -o rlogcat tools/rlogcat.c backlog/reader.c backlog/record.c \
+ *         backlog/mlog.c backlog/segment.c backlog/lz.c backlog/crc32c.c format/format.c
+ * 
+ * Usage: rlogcat [-f from] [-t to] [-l level] [-p proc] [-n host] [-j] path
+ * 
+ *     -f, -t  Time window, seconds since the epoch or local time as 
+ *             YYYY-MM-DD[THH:MM[:SS]]
+ *     -l      Least severe level to print, 0 to 7 or a name (err, info...)
+ *     -p      Only print messages of this process
+ *     -n      Hostname to render messages with, default "-"
+ *     -j      Print one JSON object per line instead of RFC 5424
+ *     path    Backlog file (mmap engine) or base path of the segment files
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "backlog/reader.h"
+
+static const char* levels[] = {
+    "emerg", "alert", "crit", "err", "warning", "notice", "info", "debug"
+};
+
+static
+bool parse_time(const char* str, time_t* t)
+{
+    const char* formats[] = { "%Y-%m-%dT%H:%M:%S", "%Y-%m-%dT%H:%M", "%Y-%m-%d" };
+    struct tm tm;
+    char* end;
+
+    *t = strtoll(str, &end, 10);
+    if( *end == '\0' )
+        return true;
+
+    for( unsigned int i = 0; i < sizeof(formats) / sizeof(formats[0]); i++ )
+    {
+        memset(&tm, 0, sizeof(tm));
+        end = strptime(str, formats[i], &tm);
+        if( end && *end == '\0' ) {
+            tm.tm_isdst = -1;
+            *t = mktime(&tm);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static
+bool parse_level(const char* str, RLOG_LEVEL* level)
+{
+    char* end;
+    long n = strtol(str, &end, 10);
+
+    if( *end == '\0' && n >= RLOG_EMERGENCY && n <= RLOG_DEBUG ) {
+        *level = n;
+        return true;
+    }
+
+    for( int i = RLOG_EMERGENCY; i <= RLOG_DEBUG; i++ )
+    {
+        if( strncasecmp(str, levels[i], strlen(str)) == 0 ) {
+            *level = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static
+void print_json_string(const char* str, size_t len)
+{
+    putchar('"');
+    for( size_t i = 0; i < len; i++ )
+    {
+        unsigned char ch = str[i];
+
+        if( ch == '"' || ch == '\\' )
+            printf("\\%c", ch);
+        else if( ch == '\n' )
+            fputs("\\n", stdout);
+        else if( ch == '\r' )
+            fputs("\\r", stdout);
+        else if( ch < 0x20 )
+            printf("\\u%04x", ch);
+        else
+            putchar(ch);
+    }
+    putchar('"');
+}
+
+/**
+ * @brief Rendered messages end with "\r\n"
+ */
+static
+size_t trim(const char* str, size_t len)
+{
+    while( len && (str[len - 1] == '\n' || str[len - 1] == '\r') )
+        len--;
+    return len;
+}
+
+static
+void print_json(int kind, const log_t* log, const char* text, size_t text_len)
+{
+    char date[32];
+
+    printf("{\"pri\":%u,\"severity\":\"%s\"", log->pri, levels[log->pri & 0x07]);
+
+    if( kind == RLOG_READER_LOG ) 
+    {
+        struct tm tm;
+        localtime_r(&log->timestamp, &tm);
+        strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", &tm);
+        printf(",\"timestamp\":\"%s\",\"proc\":", date);
+        print_json_string(log->proc, strlen(log->proc));
+        fputs(",\"msg\":", stdout);
+        print_json_string(log->msg, strlen(log->msg));
+    }
+    else 
+    {
+        fputs(",\"text\":", stdout);
+        print_json_string(text, trim(text, text_len));
+    }
+
+    fputs("}\n", stdout);
+}
+
+static
+int usage(void)
+{
+    fprintf(stderr, "usage: rlogcat [-f from] [-t to] [-l level] [-p proc] [-n host] [-j] path\n");
+    return 2;
+}
+
+int main(int argc, char** argv)
+{
+    static rlog_backlog_reader_t reader;
+    static char out[1 << 16];
+    char str[MSG_MAX_SIZE_CHAR + 1];
+    char host[64] = "-";
+    rlog_backlog_filter_t filter = { .level = RLOG_DEBUG };
+    bool json = false;
+    log_t log;
+    int opt;
+    int kind;
+
+    while( (opt = getopt(argc, argv, "f:t:l:p:n:j")) != -1 )
+    {
+        switch( opt )
+        {
+            case 'f':
+                if( !parse_time(optarg, &filter.from) )
+                    return usage();
+                break;
+            case 't':
+                if( !parse_time(optarg, &filter.to) )
+                    return usage();
+                break;
+            case 'l':
+                if( !parse_level(optarg, &filter.level) )
+                    return usage();
+                break;
+            case 'p':
+                filter.proc = optarg;
+                break;
+            case 'n':
+                snprintf(host, sizeof(host), "%s", optarg);
+                break;
+            case 'j':
+                json = true;
+                break;
+            default:
+                return usage();
+        }
+    }
+
+    if( optind != argc - 1 )
+        return usage();
+
+    if( !rlog_backlog_reader_open(&reader, argv[optind]) ) {
+        fprintf(stderr, "rlogcat: no backlog found at %s\n", argv[optind]);
+        return 1;
+    }
+
+    setvbuf(stdout, out, _IOFBF, sizeof(out));
+    rlog_backlog_reader_seek(&reader, &filter);
+
+    while( (kind = rlog_backlog_reader_next(&reader, &log)) != RLOG_READER_END )
+    {
+        if( json ) {
+            print_json(kind, &log, reader.text, reader.text_len);
+        } 
+        else if( kind == RLOG_READER_LOG ) {
+            int len = make_log_string(RLOG_RFC5424, host, str, &log);
+            if( len > 0 )
+                printf("%.*s\n", (int) trim(str, len), str);
+        } 
+        else {
+            printf("%.*s\n", (int) trim(reader.text, reader.text_len), reader.text);
+        }
+    }
+
+    if( reader.corrupt )
+        fprintf(stderr, "rlogcat: %u corrupted records or blocks skipped\n", reader.corrupt);
+
+    rlog_backlog_reader_close(&reader);
+    return 0;
+}
\ No newline at end of file